@@ -0,0 +1,459 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "tgaimage.h"
+#include "geometry.h"
+#include "rasterizer.h"
+#include "clipper.h"
+#include "threadpool.h"
+#include "vertexstage.h"
+#include "objparser.h"
+#include "texture.h"
+#include "framebuffer.h"
+#include "pipeline.h"
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE ""
+#endif
+
+//分阶段性能测试：对每个场景分别计时渲染流程的各个阶段
+//  obj_parse         解析OBJ(内存映射+快速解析，单线程)
+//  texture_decode    读取漫反射纹理(与Model相同，读取时翻转)
+//  vertex_transform  顶点处理阶段，每个顶点变换一次
+//  triangle_setup    三角形装配：取变换结果、齐次空间裁剪、背面剔除、建立边方程
+//  raster            清除深度缓冲后光栅化和深度测试(只写深度)
+//  fragment_shading  对通过深度测试的片元插值纹理坐标、采样漫反射纹理、乘光照强度并写入帧缓冲
+//  tga_encode        把渲染结果写成RLE压缩的TGA文件
+//  flip_vertically   上下翻转漫反射纹理
+//  scale             把漫反射纹理缩小一半
+//每个阶段先预热若干次，再重复计时，输出最小值、平均值和百分位数；后面的阶段使用前面阶段预先算好的输入，
+//所以每次计时只包含这一个阶段
+//
+//用法(在构建目录中运行，模型路径相对于obj目录)：
+//  tinyrenderer_bench [--reps N] [--warmup N] [--json 文件] [--obj-dir 目录] [--scene 名字] [--stage 名字]
+
+//场景的一部分：一个OBJ文件和它的漫反射纹理(可以没有)
+struct Part {
+    std::string obj;
+    std::string diffuse;
+};
+
+struct Scene {
+    std::string name;
+    std::vector<Part> parts;
+};
+
+//一个阶段的计时结果，单位为毫秒
+struct StageResult {
+    std::string scene;
+    std::string stage;
+    long long items;          //每次处理的数量
+    std::string unit;         //items的单位
+    std::vector<double> samples;
+    double min, mean, p50, p90, p99, max;
+};
+
+struct Options {
+    int reps;
+    int warmup;
+    std::string json;
+    std::string objDir;
+    std::string scene;        //为空时测所有场景
+    std::string stage;        //为空时测所有阶段
+    Options() : reps(30), warmup(3), json("bench.json"), objDir("../obj") {}
+};
+
+//最近秩百分位数，samples已排序
+static double percentile(const std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p / 100 * samples.size());
+    return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+//计时：setup在每次执行前调用(不计时)，body为要测的阶段
+static StageResult measure(const Options& opt, const std::string& scene, const std::string& stage, long long items, const char* unit,
+                           const std::function<void()>& setup, const std::function<void()>& body) {
+    StageResult r;
+    r.scene = scene;
+    r.stage = stage;
+    r.items = items;
+    r.unit = unit;
+    for (int i = 0; i < opt.warmup + opt.reps; i++) {
+        if (setup) setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (i >= opt.warmup) r.samples.push_back(ms);
+    }
+    std::vector<double> sorted = r.samples;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double s : sorted) sum += s;
+    r.min = sorted.empty() ? 0 : sorted.front();
+    r.max = sorted.empty() ? 0 : sorted.back();
+    r.mean = sorted.empty() ? 0 : sum / sorted.size();
+    r.p50 = percentile(sorted, 50);
+    r.p90 = percentile(sorted, 90);
+    r.p99 = percentile(sorted, 99);
+    return r;
+}
+
+//通过深度测试的片元，重心坐标相对于setup中的三角形(透视正确的)
+struct Fragment {
+    int x, y;
+    int tri;
+    float bc0, bc1, bc2;
+};
+
+//已建立的三角形
+struct Triangle {
+    EdgeSetup setup;
+    PerspectiveSetup persp;
+    int part;
+    int face;
+    float intensity;
+    Vec3f bary[3];    //顶点相对于原面片的重心坐标(裁剪产生的子三角形用，否则为单位向量)
+};
+
+//场景的全部输入和中间结果，每个阶段计时之前准备好
+struct SceneData {
+    std::vector<ObjData> meshes;
+    std::vector<TGAImage> images;      //漫反射纹理，没有纹理的部分为空图
+    std::vector<Texture> textures;
+    std::vector<VertexStage> stages;
+    std::vector<Triangle> triangles;
+    std::vector<Fragment> fragments;
+    std::vector<float> zbuffer;
+    float viewport[16];
+    int faces;
+    int clipped;                       //经过裁剪的面片数
+    SceneData() : faces(0), clipped(0) {}
+};
+
+static bool file_exists(const std::string& name) {
+    std::ifstream in(name.c_str(), std::ios::binary);
+    return in.good();
+}
+
+//屏幕空间的三角形取整后建立边方程和透视正确插值的平面方程(w为三个顶点的裁剪空间w)，背面(屏幕上顺时针)剔除
+static void add_triangle(SceneData& d, Vec3f* pts, const float* w, const Vec3f* bary, int part, int face, float intensity) {
+    static const TileRect screen(0, 0, width - 1, height - 1);
+    for (int j = 0; j < 3; j++) pts[j] = Vec3f(static_cast<int>(pts[j].x), static_cast<int>(pts[j].y), static_cast<int>(pts[j].z));
+    float area = (pts[1].x - pts[0].x) * (pts[2].y - pts[0].y) - (pts[1].y - pts[0].y) * (pts[2].x - pts[0].x);
+    if (area <= 0) return;
+    Triangle t;
+    if (!setup_triangle(pts, screen, t.setup)) return;
+    setup_perspective(t.setup, w, t.persp);
+    t.part = part;
+    t.face = face;
+    t.intensity = intensity;
+    for (int j = 0; j < 3; j++) t.bary[j] = bary[j];
+    d.triangles.push_back(t);
+}
+
+//三角形装配：与main.cpp中的assemble_perspective相同(取顶点处理阶段的结果，用clip_project齐次空间裁剪和投影，建立边方程)，
+//只是按屏幕上的绕向剔除背面而不按面片光照强度剔除，这样地板这样与光线平行的面片也参与测试
+static void setup_scene_triangles(SceneData& d, const ClipParams& params) {
+    d.triangles.clear();
+    d.clipped = 0;
+    for (size_t p = 0; p < d.meshes.size(); p++) {
+        const ObjData& mesh = d.meshes[p];
+        const VertexStage& vs = d.stages[p];
+        int nfaces = (int)mesh.vertIdx.size() / 3;
+        for (int i = 0; i < nfaces; i++) {
+            const int* face = &mesh.vertIdx[i * 3];
+            const Vec3f& v0 = mesh.verts[face[0]];
+            Vec3f normal = (mesh.verts[face[2]] - v0) ^ (mesh.verts[face[1]] - v0);
+            normal.normalize();
+            float intensity = std::max(0.f, normal * lightDir);
+            Vec4f clip[3] = { vs.clip(face[0]), vs.clip(face[1]), vs.clip(face[2]) };
+            Vec3f projected[3] = { vs.screen(face[0]), vs.screen(face[1]), vs.screen(face[2]) };
+            Vec3f screen[3 * CLIP_MAX_TRIANGLES], bary[3 * CLIP_MAX_TRIANGLES];
+            bool clipped;
+            int ntris = clip_project(params, viewport_, clip, screen, bary, clipped, projected);
+            if (clipped && ntris > 0) d.clipped++;
+            for (int k = 0; k < ntris; k++) {
+                //子三角形顶点的w由相对于原三角形的重心坐标插值得到，与assemble_perspective相同
+                float w[3];
+                for (int j = 0; j < 3; j++) {
+                    const Vec3f& b = bary[k * 3 + j];
+                    w[j] = clip[0].w * b.x + clip[1].w * b.y + clip[2].w * b.z;
+                }
+                add_triangle(d, &screen[k * 3], w, &bary[k * 3], (int)p, i, intensity);
+            }
+        }
+    }
+}
+
+//光栅化和深度测试；fragments非空时记下通过深度测试的片元
+static long long raster_scene(SceneData& d, std::vector<Fragment>* fragments) {
+    std::fill(d.zbuffer.begin(), d.zbuffer.end(), -std::numeric_limits<float>::max());
+    long long passed = 0;
+    for (size_t t = 0; t < d.triangles.size(); t++) {
+        const Triangle& tri = d.triangles[t];
+        rasterize(tri.setup, [&](const RasterBlock& blk) {
+            float* zrow = &d.zbuffer[(size_t)blk.y * width + blk.x];
+            int mask = depth_test(blk, zrow);
+            if (!mask) return;
+            float bc[3][RASTER_BLOCK];
+            if (fragments) perspective_bary(tri.persp, blk.x, blk.y, bc[0], bc[1], bc[2]);
+            for (; mask; mask &= mask - 1) {
+                int i = raster_lowest_bit(mask);
+                zrow[i] = blk.z[i];
+                passed++;
+                if (fragments) {
+                    Fragment f = { blk.x + i, blk.y, (int)t, bc[0][i], bc[1][i], bc[2][i] };
+                    fragments->push_back(f);
+                }
+            }
+        });
+    }
+    return passed;
+}
+
+//片元着色：与framebuffer_texture_triangle相同(最近点采样漫反射纹理*面片光照强度)
+static void shade_fragments(const SceneData& d, Framebuffer& fb) {
+    for (const Fragment& f : d.fragments) {
+        const Triangle& t = d.triangles[f.tri];
+        const ObjData& mesh = d.meshes[t.part];
+        const int* uvi = &mesh.uvIdx[t.face * 3];
+        Vec2f uv;
+        if (uvi[0] >= 0) {
+            Vec3f bc = t.bary[0] * f.bc0 + t.bary[1] * f.bc1 + t.bary[2] * f.bc2;
+            uv = mesh.uvs[uvi[0]] * bc.x + mesh.uvs[uvi[1]] * bc.y + mesh.uvs[uvi[2]] * bc.z;
+        }
+        const Texture& tex = d.textures[t.part];
+        TGAColor c = tex.empty() ? TGAColor(255, 255, 255, 255) : tex.nearest(uv);
+        *fb.color(f.x, f.y) = Framebuffer::pack(c * t.intensity);
+    }
+}
+
+//TGAImage读取文件时会在std::cerr上输出图像尺寸，读纹理和计时的时候关掉
+struct QuietStderr {
+    std::streambuf* saved;
+    QuietStderr() : saved(std::cerr.rdbuf(NULL)) {}
+    ~QuietStderr() {
+        std::cerr.rdbuf(saved);
+        std::cerr.clear();
+    }
+};
+
+static bool selected(const std::string& filter, const std::string& name) {
+    return filter.empty() || filter == name;
+}
+
+static void bench_scene(const Options& opt, const Scene& scene, std::vector<StageResult>& results) {
+    SceneData d;
+    ThreadPool single(1);    //只有调用线程，各阶段都是单线程
+    size_t nparts = scene.parts.size();
+    d.meshes.resize(nparts);
+    d.images.resize(nparts);
+    d.textures.resize(nparts);
+    d.stages.resize(nparts);
+    d.zbuffer.resize((size_t)width * height);
+
+    std::vector<std::string> objs(nparts), diffuse(nparts);
+    long long objBytes = 0, verts = 0, texels = 0;
+    for (size_t p = 0; p < nparts; p++) {
+        objs[p] = opt.objDir + "/" + scene.parts[p].obj;
+        if (!scene.parts[p].diffuse.empty()) diffuse[p] = opt.objDir + "/" + scene.parts[p].diffuse;
+        if (!parse_obj_file(objs[p].c_str(), d.meshes[p], &single)) {
+            std::cerr << "can't open " << objs[p] << std::endl;
+            return;
+        }
+        std::ifstream in(objs[p].c_str(), std::ios::binary | std::ios::ate);
+        objBytes += (long long)in.tellg();
+        verts += (long long)d.meshes[p].verts.size();
+        d.faces += (int)d.meshes[p].vertIdx.size() / 3;
+        QuietStderr quiet;
+        if (!diffuse[p].empty() && file_exists(diffuse[p]) && d.images[p].read_tga_file(diffuse[p].c_str(), true)) {
+            texels += (long long)d.images[p].get_width() * d.images[p].get_height();
+            d.textures[p].build(d.images[p], false);
+        }
+    }
+
+    //与主程序的默认场景相同的相机、透视投影和视口变换(见pipeline.h)
+    float mvp[16];
+    matrix2floats(projection_ * view_ * model_ * camera_, mvp);
+    matrix2floats(viewport_, d.viewport);
+    for (size_t p = 0; p < nparts; p++) {
+        d.stages[p].set_transform(mvp, d.viewport);
+        d.stages[p].process(d.meshes[p].verts.data(), (int)d.meshes[p].verts.size());
+    }
+    ClipParams params = ClipParams::guard_band(width, height, 4096);
+    setup_scene_triangles(d, params);
+    long long passed = raster_scene(d, &d.fragments);
+
+    Framebuffer fb(width, height);
+    fb.clear();
+    shade_fragments(d, fb);
+    TGAImage frame(width, height, TGAImage::RGB);
+    fb.to_image(frame, true);
+
+    //翻转和缩放用最大的一张纹理
+    int largest = -1;
+    for (size_t p = 0; p < nparts; p++)
+        if (d.images[p].get_width() > 0 && (largest < 0 || d.images[p].get_width() * d.images[p].get_height() > d.images[largest].get_width() * d.images[largest].get_height()))
+            largest = (int)p;
+
+    std::cout << scene.name << ": " << nparts << " parts, " << verts << " vertices, " << d.faces << " faces, "
+              << d.triangles.size() << " front-facing triangles (" << d.clipped << " faces clipped), "
+              << passed << " fragments" << std::endl;
+
+    auto run = [&](const char* stage, long long items, const char* unit, const std::function<void()>& setup, const std::function<void()>& body) {
+        if (!selected(opt.stage, stage)) return;
+        StageResult r = measure(opt, scene.name, stage, items, unit, setup, body);
+        printf("  %-17s p50 %9.3f ms  p90 %9.3f ms  p99 %9.3f ms  min %9.3f ms  (%lld %s, %.1f ns each)\n",
+               stage, r.p50, r.p90, r.p99, r.min, r.items, unit, r.items > 0 ? r.p50 * 1e6 / r.items : 0.0);
+        results.push_back(r);
+    };
+
+    run("obj_parse", objBytes, "bytes", NULL, [&]() {
+        ObjData data;
+        for (size_t p = 0; p < nparts; p++) parse_obj_file(objs[p].c_str(), data, &single);
+    });
+    if (texels > 0) {
+        QuietStderr quiet;
+        run("texture_decode", texels, "texels", NULL, [&]() {
+            for (size_t p = 0; p < nparts; p++) {
+                if (d.images[p].get_width() == 0) continue;
+                TGAImage image;
+                image.read_tga_file(diffuse[p].c_str(), true);
+            }
+        });
+    }
+    run("vertex_transform", verts, "vertices", NULL, [&]() {
+        for (size_t p = 0; p < nparts; p++) d.stages[p].process(d.meshes[p].verts.data(), (int)d.meshes[p].verts.size());
+    });
+    run("triangle_setup", d.faces, "faces", NULL, [&]() {
+        setup_scene_triangles(d, params);
+    });
+    run("raster", (long long)d.triangles.size(), "triangles", NULL, [&]() {
+        raster_scene(d, NULL);
+    });
+    run("fragment_shading", (long long)d.fragments.size(), "fragments", NULL, [&]() {
+        shade_fragments(d, fb);
+    });
+    const std::string encoded = "bench_encode.tga";
+    run("tga_encode", (long long)width * height, "pixels", NULL, [&]() {
+        frame.write_tga_file(encoded.c_str());
+    });
+    remove(encoded.c_str());
+    if (largest >= 0) {
+        TGAImage& image = d.images[largest];
+        long long n = (long long)image.get_width() * image.get_height();
+        run("flip_vertically", n, "texels", NULL, [&]() {
+            image.flip_vertically();
+        });
+        TGAImage scaled;
+        run("scale", n, "texels", [&]() {
+            scaled = image;
+        }, [&]() {
+            scaled.scale(image.get_width() / 2, image.get_height() / 2);
+        });
+    }
+}
+
+//JSON字符串转义(名字只含ASCII，只需处理引号和反斜杠)
+static std::string json_string(const std::string& s) {
+    std::string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') r += '\\';
+        r += c;
+    }
+    return r + "\"";
+}
+
+static bool write_json(const Options& opt, const std::vector<StageResult>& results) {
+    std::ofstream out(opt.json.c_str());
+    if (!out) return false;
+    const char* simd =
+#if RASTER_AVX2
+        "avx2";
+#elif RASTER_SSE2
+        "sse2";
+#else
+        "scalar";
+#endif
+    out.precision(6);
+    out << "{\n";
+    out << "  \"build\": {\"type\": " << json_string(BENCH_BUILD_TYPE) << ", \"raster_simd\": \"" << simd << "\", \"compiler\": " << json_string(
+#if defined(__clang__)
+        "clang " __clang_version__
+#elif defined(__GNUC__)
+        "gcc " __VERSION__
+#elif defined(_MSC_VER)
+        "msvc"
+#else
+        "unknown"
+#endif
+    ) << "},\n";
+    out << "  \"config\": {\"width\": " << width << ", \"height\": " << height << ", \"warmup\": " << opt.warmup
+        << ", \"reps\": " << opt.reps << ", \"hardware_threads\": " << ThreadPool::hardware_threads() << "},\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"scene\": " << json_string(r.scene) << ", \"stage\": " << json_string(r.stage)
+            << ", \"items\": " << r.items << ", \"unit\": " << json_string(r.unit)
+            << ", \"min_ms\": " << r.min << ", \"mean_ms\": " << r.mean << ", \"p50_ms\": " << r.p50
+            << ", \"p90_ms\": " << r.p90 << ", \"p99_ms\": " << r.p99 << ", \"max_ms\": " << r.max << ", \"samples_ms\": [";
+        for (size_t k = 0; k < r.samples.size(); k++) out << (k ? ", " : "") << r.samples[k];
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+    return out.good();
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--reps" && hasValue) opt.reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue) opt.warmup = std::max(0, atoi(argv[++i]));
+        else if (arg == "--json" && hasValue) opt.json = argv[++i];
+        else if (arg == "--obj-dir" && hasValue) opt.objDir = argv[++i];
+        else if (arg == "--scene" && hasValue) opt.scene = argv[++i];
+        else if (arg == "--stage" && hasValue) opt.stage = argv[++i];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--reps N] [--warmup N] [--json file] [--obj-dir dir] [--scene name] [--stage name]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Scene> scenes(4);
+    scenes[0].name = "african_head";
+    scenes[0].parts.push_back(Part{ "african_head/african_head.obj", "african_head/african_head_diffuse.tga" });
+    scenes[1].name = "diablo3_pose";
+    scenes[1].parts.push_back(Part{ "diablo3_pose/diablo3_pose.obj", "diablo3_pose/diablo3_pose_diffuse.tga" });
+    scenes[2].name = "boggie";
+    scenes[2].parts.push_back(Part{ "boggie/body.obj", "" });
+    scenes[2].parts.push_back(Part{ "boggie/head.obj", "boggie/head_diffuse.tga" });
+    scenes[2].parts.push_back(Part{ "boggie/eyes.obj", "boggie/eyes_diffuse.tga" });
+    scenes[3].name = "floor";
+    scenes[3].parts.push_back(Part{ "floor/floor.obj", "floor/floor_diffuse.tga" });
+
+    std::cout << "tinyrenderer_bench: " << width << "x" << height << ", warmup " << opt.warmup << ", " << opt.reps << " reps" << std::endl;
+    std::vector<StageResult> results;
+    for (const Scene& scene : scenes)
+        if (selected(opt.scene, scene.name)) bench_scene(opt, scene, results);
+
+    if (!opt.json.empty()) {
+        if (!write_json(opt, results)) {
+            std::cerr << "can't write " << opt.json << std::endl;
+            return 1;
+        }
+        std::cout << "results written to " << opt.json << std::endl;
+    }
+    return results.empty() ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef __ASYNCTEXTURE_H__
+#define __ASYNCTEXTURE_H__
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "tgaimage.h"
+#include "texture.h"
+#include "threadpool.h"
+
+//异步加载的纹理
+//load提交读取+上下翻转+生成mip链的任务后立即返回，第一次get时还没加载完才阻塞
+//状态机：PENDING(已提交未开始) -> RUNNING -> DONE，或 PENDING -> CANCELLED(析构时还没开始)
+//get遇到PENDING时抢先把状态改成RUNNING，在当前线程直接执行加载，不依赖线程池何时调度到这个任务，
+//所以即使线程池被占满(或在池内线程上等待)也不会死锁；遇到RUNNING时等待执行它的线程完成
+class AsyncTexture {
+private:
+	enum Status { EMPTY, PENDING, RUNNING, DONE, CANCELLED };
+
+	//任务和纹理对象共享的状态：纹理析构后仍在队列里的任务还要访问它
+	struct State {
+		std::atomic<int> status;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::string filename;
+		Texture texture;
+		bool ok;
+		double ms;             //读取、翻转和生成纹理的耗时
+		State() : status(EMPTY), ok(false), ms(0) {}
+	};
+	std::shared_ptr<State> state_;
+
+	static void run(State& s);          //状态为PENDING时执行加载，返回时已不是PENDING
+	void wait() const;
+
+	AsyncTexture(const AsyncTexture&);
+	AsyncTexture& operator=(const AsyncTexture&);
+
+public:
+	AsyncTexture();
+	~AsyncTexture();                    //取消还没开始的任务，等待正在执行的任务
+
+	//提交加载任务；pool为空时在当前线程立即加载
+	void load(const std::string& filename, ThreadPool* pool);
+
+	const Texture& get();               //等待加载完成后返回纹理(没有调用过load或读取失败时返回空纹理)
+	bool ready() const;                 //是否已经加载完成(不阻塞)
+	bool ok();                          //等待加载完成，返回是否读取成功
+	double load_ms();                   //等待加载完成，返回加载耗时
+
+	static ThreadPool& default_pool();  //模型共用的纹理加载线程池，至少有一个工作线程
+};
+
+#endif //__ASYNCTEXTURE_H__
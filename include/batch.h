@@ -0,0 +1,72 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <iostream>
+#include "geometry.h"
+#include "model.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+
+//批量渲染
+//任务列表文件每行一个任务，由空白分隔的 键=值 组成，#之后为注释：
+//  model=../obj/african_head/african_head.obj output=head.tga eye=1,0.5,1.5 center=0,0,0 up=0,1,0 light=0,0,-1 size=800x800 shader=texture
+//model和output必须给出，其余键有上面的默认值；light是光线前进的方向，与light_dir相同
+struct RenderJob {
+	std::string model;
+	std::string output;
+	std::string shader;
+	Vec3f eye, center, up, light;
+	int width, height;
+	RenderJob();
+};
+
+//解析任务列表，出错时返回false，error中给出行号和原因
+bool parse_jobs(std::istream& in, std::vector<RenderJob>& jobs, std::string& error);
+bool parse_job_file(const char* filename, std::vector<RenderJob>& jobs, std::string& error);
+
+//模型缓存：同一路径的模型只加载一次(包括纹理)，之后的任务共用
+//多个线程同时请求一个还没加载的模型时，只有第一个线程加载，其余线程等待它完成
+class ModelCache {
+private:
+	std::map<std::string, std::shared_future<std::shared_ptr<Model> > > models_;
+	std::mutex mutex_;
+	int loads_;
+
+public:
+	ModelCache();
+	std::shared_ptr<Model> get(const std::string& path);   //返回时纹理已经加载完成
+	int loads();                                           //实际加载的次数
+	void clear();
+};
+
+//一个任务的结果，时间都是毫秒
+struct JobResult {
+	bool ok;
+	std::string error;
+	int thread;            //执行任务的线程编号
+	double modelMs;        //从缓存取模型(第一次时包括加载)
+	double renderMs;
+	double writeMs;        //转换成TGAImage并写文件
+	double totalMs;
+	JobResult() : ok(false), thread(0), modelMs(0), renderMs(0), writeMs(0), totalMs(0) {}
+};
+
+//渲染一个任务：把mesh画到fb中(fb已按任务的分辨率清除)，失败时返回false并设置error
+typedef std::function<bool(const RenderJob&, Model&, Framebuffer&, std::string&)> RenderJobFn;
+
+//在线程池上并行执行所有任务，模型从cache中取；每个线程复用自己的帧缓冲和输出图像(分辨率变化时才重新分配)
+//返回全部任务的墙钟时间(毫秒)
+double run_batch(const std::vector<RenderJob>& jobs, ModelCache& cache, ThreadPool& pool,
+                 const RenderJobFn& render, std::vector<JobResult>& results);
+
+//输出每个任务的耗时和总的吞吐量
+void print_batch_report(std::ostream& out, const std::vector<RenderJob>& jobs, const std::vector<JobResult>& results, double wallMs);
+
+#endif //__BATCH_H__
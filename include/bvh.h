@@ -0,0 +1,75 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include "geometry.h"
+#include "span.h"
+#include "threadpool.h"
+
+//包围体层次(BVH)，用于光线投射
+//构建：对三角形重心按轴分桶(BVH_BINS个)估计表面积启发(SAH)代价，选代价最小的划分；
+//大的子树交给线程池并行构建，得到二叉树后再把相邻两层合并成4叉树
+//遍历：一次用SSE2测试一个节点的4个子包围盒，按进入距离由近到远访问
+const int BVH_BINS = 16;
+const int BVH_MIN_LEAF = 4;      //不超过这么多三角形的节点直接作为叶子(再分下去省下的求交抵不上构建和遍历的开销)
+const int BVH_MAX_LEAF = 8;      //叶子最多的三角形数
+
+struct Ray {
+	Vec3f org, dir;              //dir不需要是单位向量，t按dir的长度计
+	float tmax;
+	Ray() : tmax(1e30f) {}
+	Ray(const Vec3f& o, const Vec3f& d, float t = 1e30f) : org(o), dir(d), tmax(t) {}
+};
+
+struct RayHit {
+	float t;
+	int face;                    //面片序号，-1表示没有击中
+	float u, v;                  //击中点的重心坐标：(1-u-v, u, v)分别对应面片的三个顶点
+	RayHit() : t(1e30f), face(-1), u(0), v(0) {}
+};
+
+//构建耗时等统计
+struct BvhBuildStats {
+	double ms;
+	int nodes;                   //4叉树节点数
+	int leaves;
+	int maxDepth;
+	BvhBuildStats() : ms(0), nodes(0), leaves(0), maxDepth(0) {}
+};
+
+class Bvh {
+public:
+	//4叉树节点：4个子包围盒按分量分开存放(SoA)，一次载入一个分量的4个值
+	//child >= 0 为内部节点序号；< 0 时为叶子，~child的高位为第一个三角形，低4位为三角形数(0表示空位)
+	struct Node {
+		float minx[4], miny[4], minz[4];
+		float maxx[4], maxy[4], maxz[4];
+		int child[4];
+	};
+	//叶子中的三角形：预先算好两条边(Möller-Trumbore求交)
+	struct Triangle {
+		Vec3f v0, e1, e2;
+		int face;
+	};
+
+private:
+	std::vector<Node> nodes_;
+	std::vector<Triangle> tris_;
+	BvhBuildStats stats_;
+
+public:
+	Bvh();
+	//由顶点和面片(每3个顶点序号一个三角形)构建，pool非空且三角形较多时并行构建
+	void build(Span<Vec3f> verts, Span<int> vertIdx, ThreadPool* pool = NULL);
+
+	bool empty() const { return tris_.empty(); }
+	const BvhBuildStats& build_stats() const { return stats_; }
+
+	//最近的交点，hit.t的初值也作为上限；cullBack为true时忽略背对光线的面片(朝外法线为(v1-v0)^(v2-v0))
+	//击中时返回true并更新hit
+	bool intersect(const Ray& ray, RayHit& hit, bool cullBack = false) const;
+	//(0, ray.tmax)内是否有任意交点，用于阴影
+	bool occluded(const Ray& ray) const;
+};
+
+#endif //__BVH_H__
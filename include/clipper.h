@@ -0,0 +1,39 @@
+#ifndef __CLIPPER_H__
+#define __CLIPPER_H__
+
+#include "geometry.h"
+
+//齐次空间裁剪
+//在透视除法之前，用Sutherland-Hodgman算法把三角形依次裁剪到下列平面的内侧：
+//  近平面 w >= nearW       (w趋于0的点在视点处，除法后坐标会发散，w<0的点在视点后面)
+//  保护带 -gx*w <= x <= gx*w, -gy*w <= y <= gy*w
+//保护带比视口大很多，跨过屏幕边缘的三角形只要在保护带内就不裁剪，交给光栅化时的包围盒截取处理；
+//保护带保证除法后的屏幕坐标有界，光栅化的边函数不会溢出，每个三角形的工作量也有上限
+//不裁剪远处：projectionMatrix的z行是单位阵，z >= -w 对应的距离随相机远近变化(相机在2个单位外时整个模型都在它后面)，
+//而深度缓冲是float，没有需要保护的深度范围
+
+const int CLIP_MAX_VERTS = 3 + 5;                    //每个平面最多增加一个顶点
+const int CLIP_MAX_TRIANGLES = CLIP_MAX_VERTS - 2;   //扇形三角化后的三角形数
+
+//裁剪空间中的顶点：齐次坐标，以及相对于原三角形的重心坐标(用来插值uv、法线等任意属性)
+struct ClipVertex {
+	Vec4f pos;
+	Vec3f bary;
+	ClipVertex() {}
+	ClipVertex(const Vec4f& p, const Vec3f& b) : pos(p), bary(b) {}
+};
+
+struct ClipParams {
+	float guardX, guardY;   //保护带在NDC中的半宽/半高(视口为1)
+	float nearW;
+	ClipParams(float gx = 8.f, float gy = 8.f, float w = 1e-3f) : guardX(gx), guardY(gy), nearW(w) {}
+	static ClipParams guard_band(int width, int height, int guardPixels);   //视口外每边留guardPixels像素的保护带
+};
+
+//三个顶点是否都在所有平面内侧(不需要裁剪)；outside非空时返回是否整个在某个平面外侧
+bool clip_trivial(const Vec4f* pos, const ClipParams& params, bool* outside);
+
+//裁剪一个三角形，结果是凸多边形，返回顶点数(0表示完全被裁掉)
+int clip_triangle(const Vec4f* pos, const ClipParams& params, ClipVertex* out);
+
+#endif //__CLIPPER_H__
@@ -0,0 +1,90 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "tgaimage.h"
+#include "tiler.h"
+
+//帧缓冲：颜色和深度放在一起，像素读写不做任何检查，只在输出时转换成TGAImage
+//颜色格式固定为每像素4字节(RGBA8，字节顺序与TGAColor相同，即B、G、R、A)或4个float(RGBA32F，同样的通道顺序，取值0..255)
+//深度为float，越大越近，与zbuffer相同
+//LINEAR布局：颜色和深度各是一个按行存放的平面，可以取整行的指针
+//TILED布局：按8x8的块存放，一个块的64个颜色紧接着它的64个深度，块内按行存放；
+//同一块的颜色和深度在相邻的cache行上，光栅化一个小三角形只接触很少的几个块
+//两种布局下color(x,y)/depth(x,y)返回的指针向右都至少连续span(x)个像素(同一行内)
+class Framebuffer {
+public:
+	enum Format { RGBA8, RGBA32F };
+	enum Layout { LINEAR, TILED };
+	static const int TILE = 8;
+
+private:
+	int width_, height_;
+	Format format_;
+	Layout layout_;
+	int colorWords_;            //每像素颜色占的32位字数
+	int tilesX_, tilesY_;
+	int tileWords_;             //TILED布局下一个块占的32位字数
+	std::vector<uint32_t> storage_;
+	uint32_t* depth_;           //LINEAR布局下深度平面的开头
+
+	Framebuffer(const Framebuffer&);
+	Framebuffer& operator=(const Framebuffer&);
+
+	uint32_t* pixel(int x, int y) const {
+		if (layout_ == LINEAR) return const_cast<uint32_t*>(&storage_[0]) + ((size_t)y * width_ + x) * colorWords_;
+		uint32_t* tile = const_cast<uint32_t*>(&storage_[0]) + ((size_t)(y >> 3) * tilesX_ + (x >> 3)) * tileWords_;
+		return tile + (((y & 7) << 3) | (x & 7)) * colorWords_;
+	}
+
+public:
+	Framebuffer(int width, int height, Format format = RGBA8, Layout layout = LINEAR);
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	Format format() const { return format_; }
+	Layout layout() const { return layout_; }
+
+	//(x,y)处的颜色(RGBA8)和深度；不检查坐标
+	uint32_t* color(int x, int y) { return pixel(x, y); }
+	float* color_f(int x, int y) { return reinterpret_cast<float*>(pixel(x, y)); }   //RGBA32F
+	float* depth(int x, int y) {
+		if (layout_ == LINEAR) return reinterpret_cast<float*>(depth_ + (size_t)y * width_ + x);
+		uint32_t* tile = &storage_[0] + ((size_t)(y >> 3) * tilesX_ + (x >> 3)) * tileWords_;
+		return reinterpret_cast<float*>(tile + TILE * TILE * colorWords_) + (((y & 7) << 3) | (x & 7));
+	}
+	//从x开始同一行内连续存放的像素数
+	int span(int x) const { return layout_ == LINEAR ? width_ - x : TILE - (x & 7); }
+
+	//整行的指针，只用于LINEAR布局
+	uint32_t* color_row(int y) { return color(0, y); }
+	float* depth_row(int y) { return depth(0, y); }
+
+	//写一段同一行上的n个像素(RGBA8)，按块边界拆开，不检查坐标
+	void write_span(int x, int y, int n, const uint32_t* colors);
+	void write_span(int x, int y, int n, const float* colors);    //RGBA32F，每像素4个float
+
+	//把光栅化的包围盒左边界对齐到块的边界，这样每个8像素的RasterBlock都落在同一个块的同一行内，
+	//可以直接用color(blk.x, blk.y)、depth(blk.x, blk.y)访问整块；LINEAR布局下原样返回
+	TileRect aligned(const TileRect& box) const {
+		TileRect r = box;
+		if (layout_ == TILED) r.x0 &= ~(TILE - 1);
+		return r;
+	}
+
+	void clear(const TGAColor& color = TGAColor(0, 0, 0, 0), float depth = -std::numeric_limits<float>::max());
+
+	//转换为image(必须已是同样大小，按image的每像素字节数取B、G、R、A的前几个)，flip为true时上下翻转
+	bool to_image(TGAImage& image, bool flip = false) const;
+
+	static uint32_t pack(const TGAColor& c) {
+		uint32_t v;
+		memcpy(&v, c.bgra, 4);
+		return v;
+	}
+};
+
+#endif //__FRAMEBUFFER_H__
@@ -0,0 +1,58 @@
+#ifndef __FRAMEWRITER_H__
+#define __FRAMEWRITER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "framebuffer.h"
+#include "tgaimage.h"
+
+//在后台线程中按提交顺序写出帧(转换成TGAImage，上下翻转，写TGA文件)
+//帧缓冲在渲染线程和写线程之间循环：acquire取一个空闲的帧缓冲，全部在排队或正在写时阻塞；
+//渲染完submit交给写线程，写线程转换成TGAImage之后就放回空闲队列(写文件时不再占用)。帧缓冲的个数就是队列的容量，
+//两个时即双缓冲：渲染第k帧的同时写第k-1帧，渲染比写快时渲染线程在acquire处等待，内存不会无限增长
+//只有一个硬件线程时不启动写线程，submit直接在调用线程中写(与ThreadPool只有一个线程时相同)
+class FrameWriter {
+private:
+	struct Job {
+		Framebuffer* fb;
+		std::string filename;
+	};
+	std::vector<std::unique_ptr<Framebuffer> > buffers_;
+	TGAImage image_;           //转换用的图像，只分配一次；帧缓冲的格式和大小都相同
+	std::deque<Framebuffer*> free_;
+	std::deque<Job> pending_;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stop_;
+	int busy_;                 //写线程正在处理的帧数(0或1)
+	int written_, failed_;
+	double writeMs_;           //写线程转换和写文件的总耗时
+	std::thread thread_;
+
+	void write(const Job& job);
+	void writerLoop();
+
+	FrameWriter(const FrameWriter&);
+	FrameWriter& operator=(const FrameWriter&);
+
+public:
+	FrameWriter(int width, int height, int nbuffers = 2,
+	            Framebuffer::Format format = Framebuffer::RGBA8, Framebuffer::Layout layout = Framebuffer::LINEAR);
+	~FrameWriter();            //写完已提交的帧后结束写线程
+
+	Framebuffer& acquire();
+	void submit(Framebuffer& fb, const std::string& filename);
+	void finish();             //等待已提交的帧全部写完
+	bool background() const;   //是否在后台线程中写
+
+	int written() const;
+	int failed() const;
+	double write_ms() const;
+};
+
+#endif //__FRAMEWRITER_H__
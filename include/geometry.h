@@ -5,12 +5,17 @@
 #include <cmath>
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GEOMETRY_SSE2 1
+#endif
+
 //模板类，2d向量，用法是Vec2<int>(2d整形向量)、Vec2<float>(2d浮点数向量)
 template <class t> 
 struct Vec2 {
 	t x, y;
-	Vec2<t>() :x(t()), y(t()) {}
-	Vec2<t>(t _x, t _y) : x(_x),y(_y) {}
+	constexpr Vec2<t>() :x(t()), y(t()) {}
+	constexpr Vec2<t>(t _x, t _y) : x(_x),y(_y) {}
 	Vec2<t>(const Vec2<t>& v) { *this = v;  }
 	Vec2<t>& operator=(const Vec2<t>& v)
 	{
@@ -33,8 +38,8 @@ struct Vec2 {
 template <class t> 
 struct Vec3 {
 	t x, y, z;
-	Vec3<t>() :x(t()), y(t()), z(t()) {}
-	Vec3<t>(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
+	constexpr Vec3<t>() :x(t()), y(t()), z(t()) {}
+	constexpr Vec3<t>(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
 	Vec3<t>(const Vec3<t>& v) { *this = v; }
 	Vec3<t>& operator=(const Vec3<t>& v)
 	{
@@ -64,8 +69,8 @@ template <class t>
 struct Vec4
 {
 	t x, y, z, w;
-	Vec4<t>() :x(t()), y(t()), z(t()), w(t()) {}
-	Vec4<t>(t _x, t _y, t _z, t _w) : x(_x), y(_y), z(_z), w(_w) {}
+	constexpr Vec4<t>() :x(t()), y(t()), z(t()), w(t()) {}
+	constexpr Vec4<t>(t _x, t _y, t _z, t _w) : x(_x), y(_y), z(_z), w(_w) {}
 	Vec4<t>(const Vec4<t>& v) { *this = v; }
 	Vec4<t>& operator=(const Vec4<t>& v)
 	{
@@ -191,4 +196,204 @@ public:
 
 
 
+
+//定长向量与矩阵
+//大小在编译期确定，元素直接存在对象里(栈上)，不分配堆内存；
+//单位矩阵、相机、投影等构造函数都是constexpr，可以在编译期算好；4x4矩阵乘法用SSE
+
+//constexpr开方(双精度牛顿迭代再舍入到float，与std::sqrt(float)的结果相同)
+constexpr float const_sqrt(float x) {
+	if (!(x > 0)) return 0;
+	double r = x > 1 ? x : 1, prev = 0;
+	for (int i = 0; i < 64 && r != prev; i++) {
+		prev = r;
+		r = 0.5 * (r + x / r);
+	}
+	return (float)r;
+}
+
+//定长向量，用法是vec<3>、vec<4>
+template <int N>
+struct vec {
+	float data[N];
+
+	constexpr float& operator[](const int i) { return data[i]; }
+	constexpr const float& operator[](const int i) const { return data[i]; }
+
+	constexpr float norm() const { return const_sqrt((*this) * (*this)); }
+	constexpr vec<N> normalize(float l = 1) const { return (*this) * (l / norm()); }
+
+	//点乘，按下标顺序累加
+	constexpr float operator*(const vec<N>& v) const {
+		float r = data[0] * v.data[0];
+		for (int i = 1; i < N; i++) r += data[i] * v.data[i];
+		return r;
+	}
+	constexpr vec<N> operator*(float f) const {
+		vec<N> r{};
+		for (int i = 0; i < N; i++) r.data[i] = data[i] * f;
+		return r;
+	}
+	constexpr vec<N> operator+(const vec<N>& v) const {
+		vec<N> r{};
+		for (int i = 0; i < N; i++) r.data[i] = data[i] + v.data[i];
+		return r;
+	}
+	constexpr vec<N> operator-(const vec<N>& v) const {
+		vec<N> r{};
+		for (int i = 0; i < N; i++) r.data[i] = data[i] - v.data[i];
+		return r;
+	}
+};
+
+//叉乘
+constexpr vec<3> cross(const vec<3>& a, const vec<3>& b) {
+	return vec<3>{ { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] } };
+}
+
+//升维(多出的分量填fill)与降维(取前M个分量)
+template <int M, int N>
+constexpr vec<M> embed(const vec<N>& v, float fill = 1) {
+	vec<M> r{};
+	for (int i = 0; i < M; i++) r[i] = (i < N ? v[i] : fill);
+	return r;
+}
+
+template <int M, int N>
+constexpr vec<M> proj(const vec<N>& v) {
+	vec<M> r{};
+	for (int i = 0; i < M; i++) r[i] = v[i];
+	return r;
+}
+
+template <int N>
+std::ostream& operator<<(std::ostream& s, const vec<N>& v) {
+	s << "(";
+	for (int i = 0; i < N; i++) s << v[i] << (i < N - 1 ? ", " : ")\n");
+	return s;
+}
+
+//定长矩阵，R行C列，按行存储
+template <int R, int C>
+struct mat {
+	vec<C> rows[R];
+
+	constexpr vec<C>& operator[](const int i) { return rows[i]; }
+	constexpr const vec<C>& operator[](const int i) const { return rows[i]; }
+
+	constexpr vec<R> col(const int j) const {
+		vec<R> r{};
+		for (int i = 0; i < R; i++) r[i] = rows[i][j];
+		return r;
+	}
+
+	static constexpr mat<R, C> identity() {
+		mat<R, C> E{};
+		for (int i = 0; i < R && i < C; i++) E[i][i] = 1;
+		return E;
+	}
+
+	constexpr mat<C, R> transpose() const {
+		mat<C, R> t{};
+		for (int i = 0; i < R; i++)
+			for (int j = 0; j < C; j++) t[j][i] = rows[i][j];
+		return t;
+	}
+
+	//求逆：部分主元的高斯-约当消元，矩阵不可逆时结果无意义
+	constexpr mat<R, C> inverse() const {
+		static_assert(R == C, "only square matrices can be inverted");
+		mat<R, C> a = *this;
+		mat<R, C> inv = identity();
+		for (int i = 0; i < R; i++) {
+			int pivot = i;
+			for (int k = i + 1; k < R; k++) {
+				float pk = a[k][i] < 0 ? -a[k][i] : a[k][i];
+				float pp = a[pivot][i] < 0 ? -a[pivot][i] : a[pivot][i];
+				if (pk > pp) pivot = k;
+			}
+			if (pivot != i) {
+				vec<C> t = a[i]; a[i] = a[pivot]; a[pivot] = t;
+				t = inv[i]; inv[i] = inv[pivot]; inv[pivot] = t;
+			}
+			float d = 1 / a[i][i];
+			a[i] = a[i] * d;
+			inv[i] = inv[i] * d;
+			for (int k = 0; k < R; k++) {
+				if (k == i) continue;
+				float coeff = a[k][i];
+				a[k] = a[k] - a[i] * coeff;
+				inv[k] = inv[k] - inv[i] * coeff;
+			}
+		}
+		return inv;
+	}
+};
+
+//矩阵乘法，按k的顺序累加，与Matrix的结果相同
+template <int R, int K, int C>
+constexpr mat<R, C> operator*(const mat<R, K>& a, const mat<K, C>& b) {
+	mat<R, C> r{};
+	for (int i = 0; i < R; i++)
+		for (int j = 0; j < C; j++) {
+			float sum = a[i][0] * b[0][j];
+			for (int k = 1; k < K; k++) sum += a[i][k] * b[k][j];
+			r[i][j] = sum;
+		}
+	return r;
+}
+
+template <int R, int C>
+constexpr vec<R> operator*(const mat<R, C>& m, const vec<C>& v) {
+	vec<R> r{};
+	for (int i = 0; i < R; i++) r[i] = m[i] * v;
+	return r;
+}
+
+#if GEOMETRY_SSE2
+//4x4矩阵的SSE版本，非模板的重载在运行期优先于上面的模板，累加顺序相同，结果逐位一致
+//(编译期的4x4乘法会选中这里而无法求值，所以constexpr构造函数直接写出乘积)
+inline mat<4, 4> operator*(const mat<4, 4>& a, const mat<4, 4>& b) {
+	__m128 b0 = _mm_loadu_ps(b[0].data), b1 = _mm_loadu_ps(b[1].data);
+	__m128 b2 = _mm_loadu_ps(b[2].data), b3 = _mm_loadu_ps(b[3].data);
+	mat<4, 4> r;
+	for (int i = 0; i < 4; i++) {
+		const float* ai = a[i].data;
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(ai[0]), b0);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(ai[1]), b1));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(ai[2]), b2));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(ai[3]), b3));
+		_mm_storeu_ps(r[i].data, sum);
+	}
+	return r;
+}
+
+inline vec<4> operator*(const mat<4, 4>& m, const vec<4>& v) {
+	__m128 c0 = _mm_loadu_ps(m[0].data), c1 = _mm_loadu_ps(m[1].data);
+	__m128 c2 = _mm_loadu_ps(m[2].data), c3 = _mm_loadu_ps(m[3].data);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);   //转成按列存放
+	__m128 sum = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+	sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+	sum = _mm_add_ps(sum, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+	sum = _mm_add_ps(sum, _mm_mul_ps(c3, _mm_set1_ps(v[3])));
+	vec<4> r;
+	_mm_storeu_ps(r.data, sum);
+	return r;
+}
+#endif
+
+template <int R, int C>
+std::ostream& operator<<(std::ostream& s, const mat<R, C>& m) {
+	for (int i = 0; i < R; i++) {
+		for (int j = 0; j < C; j++) {
+			s << m[i][j];
+			if (j < C - 1) s << "\t";
+		}
+		s << "\n";
+	}
+	return s;
+}
+
+
+
 #endif //__GEOMETRY_H__
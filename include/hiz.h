@@ -0,0 +1,132 @@
+#ifndef __HIZ_H__
+#define __HIZ_H__
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include "rasterizer.h"
+
+//层次z缓冲：在float zbuffer之上为每个8x8块记录最小/最大深度，为每个64x64块记录其中8x8块的最小深度
+//zbuffer中越大越近，三角形在某块内的最大深度不大于该块的最小深度时，整块都不可能通过深度测试，可以在逐像素计算之前剔除
+//64x64的粗块与分块渲染的块对齐，分块渲染时每个线程只读写自己块内的数据
+//默认关闭：三角形很小、遮挡不多时块测试的开销会超过省下的光栅化，见test_hiz的对比
+class HiZBuffer {
+public:
+	static const int TILE = 8;
+	static const int COARSE = 64;
+
+private:
+	float* depth_;
+	int width_, height_;
+	int tilesX_, tilesY_;
+	int coarseX_, coarseY_;
+	std::vector<float> tileMin_, tileMax_;
+	std::vector<unsigned char> dirty_;         //8x8块写过深度，最小值已过期(偏小，仍然保守)
+	std::vector<float> coarseMin_;
+	std::vector<unsigned char> coarseDirty_;
+	bool enabled_;
+
+	std::atomic<long long> skippedPixels_;     //被剔除的包围盒像素数(省去的逐像素计算)
+	std::atomic<long long> rejectedTiles_;     //被剔除的三角形/8x8块组合数
+	std::atomic<long long> rejectedTriangles_; //在粗块一级就被整个剔除的三角形数
+
+	float coarse_min(int c);
+	void update_tile(int tx, int ty);   //从zbuffer重新统计一个8x8块的最小/最大深度
+	void mark_dirty(int tx, int ty, float zmax);   //写过深度后：最大值用三角形的最大深度放大，最小值标记为过期
+	//三角形不一定在块内所有像素之前时才需要精确的最小值，这时才重新统计过期的块
+	void refresh(int t, int tx, int ty, float zmin) { if (dirty_[t] && zmin <= tileMax_[t]) update_tile(tx, ty); }
+
+public:
+	HiZBuffer(float* depth, int width, int height);
+
+	float* depth();
+	void clear();                       //zbuffer被清为负无穷后调用
+	void set_enabled(bool enabled);
+	bool enabled() const;
+
+	void reset_counters();
+	long long skipped_pixels() const;
+	long long rejected_tiles() const;
+	long long rejected_triangles() const;
+
+	//遍历三角形包围盒覆盖的8x8块，被遮挡的块直接跳过(小三角形只做整体测试，不按块切分)
+	//其余块调用raster(box, acceptAll)，box为该块与包围盒的交集，acceptAll表示块内所有被覆盖像素都一定通过深度测试
+	//raster返回是否写过深度，写过的块在需要时才重新统计
+	template <class TileFn>
+	void traverse(const EdgeSetup& s, TileFn&& raster);
+};
+
+template <class TileFn>
+void HiZBuffer::traverse(const EdgeSetup& s, TileFn&& raster) {
+	//深度是线性插值的，最值在顶点处；重心坐标之和有舍入误差，插值结果可能略超出顶点深度，所以放宽一点保持保守
+	float zmin = std::min({ s.z[0], s.z[1], s.z[2] });
+	float zmax = std::max({ s.z[0], s.z[1], s.z[2] });
+	zmin -= (std::fabs(zmin) + 1.f) * 1e-5f;
+	zmax += (std::fabs(zmax) + 1.f) * 1e-5f;
+	const long long area = (long long)(s.box.x1 - s.box.x0 + 1) * (s.box.y1 - s.box.y0 + 1);
+	const int tx0 = s.box.x0 / TILE, tx1 = s.box.x1 / TILE;
+	const int ty0 = s.box.y0 / TILE, ty1 = s.box.y1 / TILE;
+
+	//粗块一级：只对跨越多个64x64块的大三角形有意义
+	if (tx1 - tx0 >= COARSE / TILE || ty1 - ty0 >= COARSE / TILE) {
+		bool visible = false;
+		for (int cy = s.box.y0 / COARSE; !visible && cy <= s.box.y1 / COARSE; cy++)
+			for (int cx = s.box.x0 / COARSE; !visible && cx <= s.box.x1 / COARSE; cx++)
+				visible = zmax > coarse_min(cx + cy * coarseX_);
+		if (!visible) {
+			skippedPixels_ += area;
+			rejectedTriangles_++;
+			return;
+		}
+	}
+
+	//小三角形(包围盒最多覆盖2x2个块)：整体测试，没被完全挡住就整体光栅化一次，避免按块切分的开销
+	if (tx1 - tx0 <= 1 && ty1 - ty0 <= 1) {
+		bool visible = false, acceptAll = true;
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				int t = tx + ty * tilesX_;
+				refresh(t, tx, ty, zmin);
+				visible |= zmax > tileMin_[t];
+				acceptAll &= zmin > tileMax_[t];
+			}
+		}
+		if (!visible) {
+			skippedPixels_ += area;
+			rejectedTiles_ += (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+			rejectedTriangles_++;
+			return;
+		}
+		if (raster(s.box, acceptAll)) {
+			for (int ty = ty0; ty <= ty1; ty++)
+				for (int tx = tx0; tx <= tx1; tx++)
+					mark_dirty(tx, ty, zmax);
+		}
+		return;
+	}
+
+	//大三角形：逐个8x8块测试，只光栅化没被挡住的块
+	long long skipped = 0, rejected = 0;
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			TileRect box(std::max(s.box.x0, tx * TILE), std::max(s.box.y0, ty * TILE),
+			             std::min(s.box.x1, tx * TILE + TILE - 1), std::min(s.box.y1, ty * TILE + TILE - 1));
+			int t = tx + ty * tilesX_;
+			refresh(t, tx, ty, zmin);
+			if (zmax <= tileMin_[t]) {
+				skipped += (long long)(box.x1 - box.x0 + 1) * (box.y1 - box.y0 + 1);
+				rejected++;
+				continue;
+			}
+			if (raster(static_cast<const TileRect&>(box), zmin > tileMax_[t]))
+				mark_dirty(tx, ty, zmax);
+		}
+	}
+	if (rejected) {
+		skippedPixels_ += skipped;
+		rejectedTiles_ += rejected;
+	}
+}
+
+#endif //__HIZ_H__
@@ -0,0 +1,35 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <cstddef>
+#include <vector>
+
+//只读的内存映射文件
+//POSIX下用mmap映射整个文件，按需缺页，不经过用户态缓冲区的拷贝；
+//其他平台退化为把整个文件一次读进内存，接口相同
+//以copyOnWrite打开时映射可写但是私有：写入的页在本进程内复制一份，不会改动文件
+class MappedFile {
+private:
+	char* data_;
+	size_t size_;
+	bool mapped_;              //true表示data_来自mmap，需要munmap
+	std::vector<char> buffer_; //退化实现读进来的内容
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename, bool copyOnWrite=false);   //失败时返回false，文件为空时映射成功但size()为0
+	void close();
+
+	const char* data() const;
+	char* mutable_data();              //只有以copyOnWrite打开时才能写
+	size_t size() const;
+	bool is_open() const;
+	bool is_mapped() const;            //是否真正使用了mmap
+};
+
+#endif //__MAPPEDFILE_H__
@@ -0,0 +1,51 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <string>
+#include <cstdint>
+#include "geometry.h"
+#include "span.h"
+#include "objparser.h"
+#include "mappedfile.h"
+
+//网格二进制缓存
+//放在.obj旁边(文件名为 xxx.obj.mcache)，内容是文件头加上ObjData的六个扁平数组，每个数组16字节对齐；
+//读取时直接内存映射，数组原地使用，不需要任何解析。文件头记录了格式版本、字节序、生成缓存时OBJ文件的
+//修改时间和大小以及数据的校验和，任何一项对不上都视为缓存失效，由调用者重新解析OBJ并重写缓存
+
+const uint32_t MESH_CACHE_VERSION = 1;
+
+struct MeshCacheHeader {
+	char magic[4];           //"TRMC"
+	uint32_t version;
+	uint32_t byteOrder;      //0x01020304，按本机字节序写入
+	uint32_t headerSize;
+	int64_t sourceMtime;     //OBJ文件的修改时间(纳秒)
+	uint64_t sourceSize;     //OBJ文件的大小
+	uint64_t count[6];       //verts、uvs、norms、vertIdx、uvIdx、normIdx的元素个数
+	uint64_t offset[6];      //各数组相对文件开头的偏移
+	uint64_t checksum;       //文件头之后所有字节的校验和
+};
+
+//缓存中各数组的视图，指向映射的内存
+struct MeshView {
+	Span<Vec3f> verts;
+	Span<Vec2f> uvs;
+	Span<Vec3f> norms;
+	Span<int> vertIdx;
+	Span<int> uvIdx;
+	Span<int> normIdx;
+};
+
+std::string mesh_cache_path(const char* objfile);
+
+//为objfile写缓存(先写唯一命名的临时文件再原子地改名替换，其他进程不会读到写了一半的缓存，也不会找不到缓存)，失败时返回false
+bool write_mesh_cache(const char* objfile, const ObjData& data);
+
+//映射并校验objfile的缓存，成功时view指向file映射的内存；缓存不存在或失效时返回false
+bool open_mesh_cache(const char* objfile, MappedFile& file, MeshView& view);
+
+//64位FNV-1a，每次处理8个字节
+uint64_t mesh_checksum(const char* data, size_t size);
+
+#endif //__MESHCACHE_H__
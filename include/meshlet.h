@@ -0,0 +1,86 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+#include <vector>
+#include "geometry.h"
+#include "span.h"
+
+//meshlet(三角形簇)
+//加载模型时把相邻的面片分成每簇最多MESHLET_MAX_FACES个三角形的簇，每簇记录包围球和法线锥；
+//每帧先整簇做视锥和背面剔除，被剔除的簇不做顶点变换和三角形装配
+const int MESHLET_MAX_FACES = 64;
+const int MESHLET_MAX_VERTICES = 64;
+
+struct Meshlet {
+	int firstFace, faceCount;        //在MeshletData::faces中的范围
+	int firstVertex, vertexCount;    //在MeshletData::vertices中的范围
+	Vec3f center;                    //包围球
+	float radius;
+	//法线锥：簇内所有面片的(朝外)法线与coneAxis的夹角都不超过θ，coneSin = sinθ；
+	//θ >= 90°时无法整簇做背面剔除，coneSin取2
+	Vec3f coneAxis;
+	float coneSin;
+};
+
+struct MeshletData {
+	std::vector<Meshlet> meshlets;
+	std::vector<int> faces;          //按簇排列的面片序号
+	std::vector<int> vertices;       //每簇用到的顶点序号(簇内升序，不同簇之间可能重复)
+	void clear();
+};
+
+//由顶点和面片(每3个顶点序号一个三角形)建立meshlet：从还没分配的面片开始，
+//每次加入与簇共享顶点最多、法线最接近簇平均法线的相邻面片，直到面片数或顶点数达到上限
+//面片的朝外法线为(v1-v0)^(v2-v0)
+void build_meshlets(Span<Vec3f> verts, Span<int> vertIdx, MeshletData& out);
+
+//每帧的剔除统计
+struct MeshletCullStats {
+	int meshlets;
+	int frustumCulled;               //包围球完全在视锥某个平面外侧
+	int coneCulled;                  //被法线锥剔除(按cull的coneTest)
+	long long faces;
+	long long facesCulled;
+	MeshletCullStats() { clear(); }
+	void clear();
+	MeshletCullStats& operator+=(const MeshletCullStats& s);
+};
+
+//法线锥剔除的方式，可以按位组合
+enum MeshletConeTest {
+	MESHLET_CONE_NONE = 0,
+	MESHLET_CONE_VIEW = 1,           //整簇背对视点(backfacing)
+	MESHLET_CONE_DIRECTION = 2       //整簇朝外法线与给定方向同向(facing_along)，如平行光照不到的簇
+};
+
+//按一个mvp矩阵(行主序，与VertexStage相同)和视口剔除meshlet
+//视锥取屏幕[0,width]x[0,height]向外扩一个像素(顶点坐标在光栅化前取整)和近平面(w>=nearW)，
+//与clipper一致不设远平面；透视投影的视点由mvp求出(x=y=w=0的点)，正交投影时用视线方向
+const int MESHLET_FRUSTUM_PLANES = 5;
+
+class MeshletCuller {
+private:
+	float planes_[MESHLET_FRUSTUM_PLANES][4];            //模型空间中的单位法线和偏移，内侧为非负
+	bool perspective_;
+	Vec3f eye_;
+	Vec3f forward_;                  //正交投影时的视线方向(单位向量，指向远处)
+
+public:
+	//viewport为视口变换矩阵(行主序，只用到x、y两行)
+	MeshletCuller(const float* mvp, const float* viewport, int width, int height, float nearW = 1e-3f);
+
+	bool perspective() const { return perspective_; }
+	const Vec3f& eye() const { return eye_; }
+	bool outside_frustum(const Meshlet& m) const;
+	//簇内所有面片都背对视点
+	bool backfacing(const Meshlet& m) const;
+	//簇内所有面片的朝外法线与dir的点积都>=0(用于按平行光方向剔除的渲染路径，dir为单位向量)
+	static bool facing_along(const Meshlet& m, const Vec3f& dir);
+
+	//剔除data中的所有簇，visible中依次放入可见簇的序号(只在容量不够时分配内存)
+	//coneTest为MeshletConeTest的组合，满足其中任意一项的簇算作锥剔除；dir只在含MESHLET_CONE_DIRECTION时使用
+	void cull(const MeshletData& data, std::vector<int>& visible, int coneTest,
+	          const Vec3f& dir = Vec3f(0, 0, 0), MeshletCullStats* stats = NULL) const;
+};
+
+#endif //__MESHLET_H__
@@ -4,37 +4,72 @@
 #include <vector>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "threadpool.h"
+#include "span.h"
+#include "objparser.h"
+#include "mappedfile.h"
+#include "asynctexture.h"
+#include "meshlet.h"
 
 //模型类
+//顶点、纹理坐标、法线各存一个连续数组，面片只支持三角形(多边形在读取时按扇形三角化)，
+//三个索引数组每个三角形占3个元素(面片中缺少的纹理坐标/法线索引为-1)，所有访问函数都不分配内存
+//OBJ中顶点、纹理坐标、法线各自编号，合成一个索引数组要先把(v,vt,vn)组合焊接成新的顶点，顶点数就不再是OBJ的顶点数，
+//顶点处理阶段、三角形簇和二进制缓存都按顶点序号工作，所以保留三个索引数组(渲染路径只用vertIdx_)
 class Model {
 private:
-	std::vector<Vec3f> verts_;//顶点集，每个顶点都是三维向量
-	std::vector<std::vector<Vec3i> > faces_;//面片集
+	//几何数据存放在storage_(解析OBJ得到)或cache_(映射的二进制缓存)中，下面的视图指向其中之一
+	ObjData storage_;
+	MappedFile cache_;
+
+	Span<Vec3f> verts_;//顶点集，每个顶点都是三维向量
+	Span<int> vertIdx_;//面片集：第i个三角形的顶点序号为vertIdx_[3i..3i+2]
+	Span<int> uvIdx_;  //纹理坐标序号
+	Span<int> normIdx_;//法线序号
+	MeshletData meshlets_;//加载时建立的三角形簇，用于整簇剔除
 
 	//纹理内容
-	std::vector<Vec3f> norms_;
-	std::vector<Vec2f> uv_;
-	TGAImage diffusemap_;
-	TGAImage normalmap_;
-	TGAImage specularmap_;
+	Span<Vec3f> norms_;
+	Span<Vec2f> uv_;
+	//纹理在线程池中异步加载(加载时生成mip链和分块存放的Texture)，第一次采样时如果还没加载完才阻塞
+	AsyncTexture diffusemap_;
+	AsyncTexture normalmap_;
+	AsyncTexture specularmap_;
 
-	void loadTexture(std::string filename, const char* suffix, TGAImage& image);
+	void loadTexture(std::string filename, const char* suffix, AsyncTexture& texture, ThreadPool* pool);
 
 
 public:
-	Model(const char *filename);//根据.obj文件路径导入模型
+	//根据.obj文件路径导入模型，pool用于并行解析和异步加载纹理(为空时纹理使用AsyncTexture::default_pool())
+	//useCache为true时优先使用.obj旁边的二进制缓存(见meshcache.h)，缓存不存在或已过期时解析OBJ并重新生成缓存
+	Model(const char *filename, ThreadPool* pool = NULL, bool useCache = true);
 	~Model();
-	int nverts();//返回模型顶点数量
-	int nfaces();//返回模型面片数量
-	Vec3f normal(int iface, int nthvert);
+	int nverts() const;//返回模型顶点数量
+	int nfaces() const;//返回模型面片数量
+	Vec3f normal(int iface, int nthvert) const;
 	Vec3f normal(Vec2f uv);
-	Vec3f vert(int i);//返回第i个顶点
-	Vec3f vert(int iface, int nthvert);
-    Vec2f uv(int iface, int nthvert);
-    TGAColor diffuse(Vec2f uv);
+	Vec3f vert(int i) const;//返回第i个顶点
+	Vec3f vert(int iface, int nthvert) const;
+    Vec2f uv(int iface, int nthvert) const;
+    TGAColor diffuse(Vec2f uv);   //三个纹理的最近点采样(第0层)
     float specular(Vec2f uv);
-	std::vector<int> face(int idx);//返回第idx个面
+	//纹理对象，用于双线性/三线性等过滤采样(会等待纹理加载完成)
+	const Texture& diffuse_map();
+	const Texture& normal_map();
+	const Texture& specular_map();
+	Span<int> face(int idx) const;//返回第idx个面的三个顶点序号
 
+	//整个数组的视图
+	Span<Vec3f> verts() const;
+	Span<Vec2f> uvs() const;
+	Span<Vec3f> normals() const;
+	Span<int> vert_indices() const;
+	Span<int> uv_indices() const;
+	Span<int> normal_indices() const;
+	const MeshletData& meshlets() const;   //三角形簇(见meshlet.h)
+	bool from_cache() const;   //几何数据是否来自二进制缓存
+	void wait_textures();      //等待所有纹理加载完成
+	bool textures_ready() const;
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef __OBJPARSER_H__
+#define __OBJPARSER_H__
+
+#include <vector>
+#include <istream>
+#include "geometry.h"
+#include "threadpool.h"
+
+//OBJ文件解析的结果：扁平数组，面片按扇形三角化，每个三角形在三个索引数组中各占3个元素
+//索引从0开始(负索引已换算成绝对索引)，面片中缺少的纹理坐标/法线索引为-1
+struct ObjData {
+	std::vector<Vec3f> verts;
+	std::vector<Vec2f> uvs;
+	std::vector<Vec3f> norms;
+	std::vector<int> vertIdx;
+	std::vector<int> uvIdx;
+	std::vector<int> normIdx;
+
+	void clear();
+	bool identical(const ObjData& o) const;   //逐字节比较所有数组
+};
+
+//快速浮点数解析，p指向数字开头，返回解析结束的位置(没有数字时返回p)
+//尾数不超过2^24且十进制指数在[-10, 10]内时，尾数和10的幂都能用float精确表示，
+//一次乘/除法的舍入就是正确舍入(Clinger快速路径)；其余情况交给strtof，所以结果与strtof完全相同
+const char* parse_float(const char* p, const char* end, float& out);
+
+//解析内存中的OBJ文本，支持 v、vt、vn 以及 f v、f v/vt、f v//vn、f v/vt/vn 和负索引，其他行忽略
+//pool非空时按行边界切成若干块并行解析，再按顺序合并；pool为空且文本较大时临时创建线程池
+void parse_obj(const char* data, size_t size, ObjData& out, ThreadPool* pool = NULL);
+
+//内存映射文件后解析，打不开文件时返回false
+bool parse_obj_file(const char* filename, ObjData& out, ThreadPool* pool = NULL);
+
+//原来的解析方式(逐行getline+istringstream，只支持 f v/vt/vn)，只用来对照结果和速度
+void parse_obj_stream(std::istream& in, ObjData& out);
+
+#endif //__OBJPARSER_H__
@@ -0,0 +1,119 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "geometry.h"
+#include "clipper.h"
+
+//渲染管线的公共部分：默认场景(分辨率、相机、光照)、变换矩阵、三角形的裁剪和投影
+//主程序和性能测试(bench.cpp)都用这里的定义，性能测试测的就是主程序的管线
+
+//定义宽度高度深度
+const int width  = 800;
+const int height = 800;
+const int depth  = 255;
+
+//位置信息
+constexpr Vec3f lightDir(0, 0, -1);             //光照方向(单位向量)，光线前进的方向
+constexpr Vec3f cameraPos(1, 0.5, 1.5);         //相机位置
+constexpr Vec3f centerPos(0, 0, 0);             //中心点位置
+constexpr Vec3f        up(0, 1, 0);             //指向上方向的向量
+
+//变换都用定长矩阵mat<4,4>和定长向量vec<4>，不分配堆内存
+
+//四阶列向量
+vec<4> local2homo(Vec3f v);
+
+//降维
+Vec3f homo2vertices(const vec<4>& m);
+
+//四阶列向量转为齐次坐标
+Vec4f homo2vec4(const vec<4>& m);
+
+//4x4矩阵按行主序展开成数组，供顶点处理阶段使用
+void matrix2floats(const mat<4, 4>& m, float* out);
+
+//模型变换矩阵
+constexpr mat<4, 4> modelMatrix() {
+	return mat<4, 4>::identity();   //模型坐标已经是NDC坐标([-1, 1]范围内),因此无需变换，用单位矩阵代替
+}
+
+//视图变换矩阵
+constexpr mat<4, 4> viewMatrix() {
+	return mat<4, 4>::identity();
+}
+
+//透视投影变换矩阵
+constexpr mat<4, 4> projectionMatrix(float coeff) {
+	mat<4, 4> projection = mat<4, 4>::identity();
+	projection[3][2] = coeff;
+	return projection;
+}
+
+constexpr mat<4, 4> projectionMatrix() {
+	//return projectionMatrix(-1.0f / (cameraPos - centerPos).norm())；
+	return projectionMatrix(-1.0f / cameraPos.z);
+}
+
+//透视除法（前三个分量都除以第四个分量 即第四维归一）
+vec<4> projectionDivision(vec<4> m);
+
+//视口变换矩阵     //将[-1,1]^2中的点变换到以(x,y)为原点，w,h为宽与高的屏幕区域内
+constexpr mat<4, 4> viewportMatrix(int x, int y, int w, int h) {
+	mat<4, 4> m = mat<4, 4>::identity();
+	m[0][3] = x + w / 2.f;
+	m[1][3] = y + h / 2.f;
+	m[2][3] = depth / 2.f;
+
+	m[0][0] = w / 2.f;
+	m[1][1] = h / 2.f;
+	m[2][2] = depth / 2.f;
+	return m;
+}
+
+
+//摄像机变换矩阵    
+//https://zhuanlan.zhihu.com/p/400791821   
+//https://www.zhihu.com/question/447781866/answer/1859618164 
+//https://blog.csdn.net/qq960885333/article/details/8448036
+//更改摄像机视角=更改物体位置和角度，操作为互逆矩阵
+//摄像机变换是先旋转再平移，所以物体需要先平移后旋转，且都是逆矩阵
+constexpr mat<4, 4> cameraMatrix(const Vec3f& camera, const Vec3f& center, const Vec3f& up) {
+	//计算出z，根据z和up算出x，再算出y
+	vec<3> eye{ { camera.x, camera.y, camera.z } };
+	vec<3> z = (eye - vec<3>{ { center.x, center.y, center.z } }).normalize();
+	vec<3> x = cross(vec<3>{ { up.x, up.y, up.z } }, z).normalize();
+	vec<3> y = cross(z, x).normalize();
+	//正交矩阵的逆 = 正交矩阵的转置，作为旋转部分
+	mat<4, 4> res = mat<4, 4>::identity();
+	for (int i = 0; i < 3; i++) {
+		res[0][i] = x[i];
+		res[1][i] = y[i];
+		res[2][i] = z[i];
+	}
+	//***矩阵的第四列是用于平移的,需要将物体平移-camera***
+	//旋转*平移的乘积直接写出来：先平移物体，再旋转
+	res[0][3] = x * (eye * -1.f);
+	res[1][3] = y * (eye * -1.f);
+	res[2][3] = z * (eye * -1.f);
+	return res;
+}
+
+//mvp变换和视口变换，都在编译期算好
+constexpr mat<4, 4> model_ = modelMatrix();
+constexpr mat<4, 4> view_ = viewMatrix();
+constexpr mat<4, 4> projection_ = projectionMatrix();
+//constexpr mat<4, 4> viewport_ = viewportMatrix(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+constexpr mat<4, 4> viewport_ = viewportMatrix(0, 0, width, height);
+constexpr mat<4, 4> camera_ = cameraMatrix(cameraPos, centerPos, up);
+
+//裁剪空间坐标转屏幕坐标(透视除法+视口变换)
+Vec3f clip2screen(const Vec4f& v, const mat<4, 4>& viewport);
+
+//裁剪并投影一个三角形(裁剪空间坐标)，返回得到的屏幕空间三角形个数，第k个三角形的顶点为screen[3k..3k+2]
+//bary[3k+j]为该顶点相对于原三角形的重心坐标，用来插值属性；clipped为false时就是原三角形，bary为单位向量
+//projected非空时为顶点处理阶段已经算好的三个顶点的屏幕坐标，不需要裁剪时直接使用
+//params和viewport为裁剪参数和视口变换，不同分辨率的渲染各用自己的一组
+int clip_project(const ClipParams& params, const mat<4, 4>& viewport,
+                 const Vec4f* clip, Vec3f* screen, Vec3f* bary, bool& clipped, const Vec3f* projected = NULL);
+
+#endif //__PIPELINE_H__
@@ -0,0 +1,396 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include <cstdint>
+#include "geometry.h"
+#include "tiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RASTER_SSE2 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RASTER_AVX2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//边函数光栅化核心
+//每个三角形只建立一次整数边方程 E(x,y) = A*x + B*y + C，之后逐行按8像素块增量求值(AVX2一次8个，SSE2两次4个)，
+//覆盖掩码、深度和重心坐标都以向量形式输出，代替逐像素调用barycentric()
+
+const int RASTER_BLOCK = 8;   //每个块的像素数(同一行内连续的像素)
+
+//一个光栅化块：从(x,y)开始的一行像素，mask的第i位表示像素(x+i,y)被三角形覆盖
+struct RasterBlock {
+	int x, y;
+	int count;    //块内在包围盒以内的像素数(最后一个块可能不足8个)
+	int mask;
+	alignas(32) float bc0[RASTER_BLOCK];   //顶点0的重心坐标分量
+	float bc1[RASTER_BLOCK];
+	float bc2[RASTER_BLOCK];
+	float z[RASTER_BLOCK];   //插值后的深度
+};
+
+//三角形建立阶段的结果
+struct EdgeSetup {
+	int A[3], B[3];      //边方程系数，第i条边的值与顶点i的重心坐标成正比
+	int64_t C[3];
+	float invArea;       //1/(2倍有向面积)，已处理为正
+	float z[3];          //三个顶点的深度
+	TileRect box;        //已限制在裁剪矩形内的包围盒
+	bool narrow;         //包围盒内边函数的值是否都能用32位整数表示(否则走64位标量路径)
+};
+
+//建立三角形：顶点坐标取整后计算边方程和包围盒，退化或完全在clip外时返回false
+bool setup_triangle(const Vec3f* pts, const TileRect& clip, EdgeSetup& s);
+
+//最低位的1的位置
+inline int raster_lowest_bit(int mask) {
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, (unsigned long)mask);
+	return (int)idx;
+#else
+	return __builtin_ctz((unsigned int)mask);
+#endif
+}
+
+//计算块内覆盖像素的重心坐标和深度
+inline void raster_interpolate(const EdgeSetup& s, const int64_t* e0, const int64_t* e1, const int64_t* e2, RasterBlock& blk) {
+	for (int i = 0; i < RASTER_BLOCK; i++) {
+		blk.bc0[i] = static_cast<float>(e0[i]) * s.invArea;
+		blk.bc1[i] = static_cast<float>(e1[i]) * s.invArea;
+		blk.bc2[i] = static_cast<float>(e2[i]) * s.invArea;
+		blk.z[i] = s.z[0] * blk.bc0[i] + s.z[1] * blk.bc1[i] + s.z[2] * blk.bc2[i];
+	}
+}
+
+#if RASTER_SSE2
+//4个像素的覆盖、重心坐标和深度
+inline int raster_lanes4(const EdgeSetup& s, __m128i e0, __m128i e1, __m128i e2, RasterBlock& blk, int offset) {
+	int covered = (~_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(e0, e1), e2)))) & 0xF;
+	if (covered) {
+		__m128 inv = _mm_set1_ps(s.invArea);
+		__m128 b0 = _mm_mul_ps(_mm_cvtepi32_ps(e0), inv);
+		__m128 b1 = _mm_mul_ps(_mm_cvtepi32_ps(e1), inv);
+		__m128 b2 = _mm_mul_ps(_mm_cvtepi32_ps(e2), inv);
+		__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(s.z[0])), _mm_mul_ps(b1, _mm_set1_ps(s.z[1]))), _mm_mul_ps(b2, _mm_set1_ps(s.z[2])));
+		_mm_storeu_ps(blk.bc0 + offset, b0);
+		_mm_storeu_ps(blk.bc1 + offset, b1);
+		_mm_storeu_ps(blk.bc2 + offset, b2);
+		_mm_storeu_ps(blk.z + offset, z);
+	}
+	return covered;
+}
+#endif
+
+//光栅化：对每个至少覆盖一个像素的块调用fn(const RasterBlock&)，按行优先顺序(y外层，x内层)遍历
+//box必须在s.box以内(例如层次z缓冲中的一个小块)
+template <class BlockFn>
+void rasterize(const EdgeSetup& s, const TileRect& box, BlockFn&& fn) {
+	RasterBlock blk;
+	const int x0 = box.x0;
+	const int width = box.x1 - box.x0 + 1;
+	if (s.narrow) {
+#if RASTER_AVX2
+		const __m256i ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i dx0 = _mm256_mullo_epi32(_mm256_set1_epi32(s.A[0]), ramp);
+		const __m256i dx1 = _mm256_mullo_epi32(_mm256_set1_epi32(s.A[1]), ramp);
+		const __m256i dx2 = _mm256_mullo_epi32(_mm256_set1_epi32(s.A[2]), ramp);
+		const __m256i step0 = _mm256_set1_epi32(s.A[0] * RASTER_BLOCK);
+		const __m256i step1 = _mm256_set1_epi32(s.A[1] * RASTER_BLOCK);
+		const __m256i step2 = _mm256_set1_epi32(s.A[2] * RASTER_BLOCK);
+		const __m256 inv = _mm256_set1_ps(s.invArea);
+		for (int y = box.y0; y <= box.y1; y++) {
+			//行首的边函数值，之后每个块只做加法
+			__m256i e0 = _mm256_add_epi32(_mm256_set1_epi32((int)(s.A[0] * (int64_t)x0 + s.B[0] * (int64_t)y + s.C[0])), dx0);
+			__m256i e1 = _mm256_add_epi32(_mm256_set1_epi32((int)(s.A[1] * (int64_t)x0 + s.B[1] * (int64_t)y + s.C[1])), dx1);
+			__m256i e2 = _mm256_add_epi32(_mm256_set1_epi32((int)(s.A[2] * (int64_t)x0 + s.B[2] * (int64_t)y + s.C[2])), dx2);
+			for (int dx = 0; dx < width; dx += RASTER_BLOCK) {
+				int count = width - dx < RASTER_BLOCK ? width - dx : RASTER_BLOCK;
+				int covered = (~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_or_si256(e0, e1), e2)))) & ((1 << count) - 1);
+				if (covered) {
+					__m256 b0 = _mm256_mul_ps(_mm256_cvtepi32_ps(e0), inv);
+					__m256 b1 = _mm256_mul_ps(_mm256_cvtepi32_ps(e1), inv);
+					__m256 b2 = _mm256_mul_ps(_mm256_cvtepi32_ps(e2), inv);
+					__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(b0, _mm256_set1_ps(s.z[0])), _mm256_mul_ps(b1, _mm256_set1_ps(s.z[1]))), _mm256_mul_ps(b2, _mm256_set1_ps(s.z[2])));
+					_mm256_store_ps(blk.bc0, b0);
+					_mm256_storeu_ps(blk.bc1, b1);
+					_mm256_storeu_ps(blk.bc2, b2);
+					_mm256_storeu_ps(blk.z, z);
+					blk.x = x0 + dx;
+					blk.y = y;
+					blk.count = count;
+					blk.mask = covered;
+					fn(static_cast<const RasterBlock&>(blk));
+				}
+				e0 = _mm256_add_epi32(e0, step0);
+				e1 = _mm256_add_epi32(e1, step1);
+				e2 = _mm256_add_epi32(e2, step2);
+			}
+		}
+		return;
+#elif RASTER_SSE2
+		const __m128i dx0 = _mm_setr_epi32(0, s.A[0], 2 * s.A[0], 3 * s.A[0]);
+		const __m128i dx1 = _mm_setr_epi32(0, s.A[1], 2 * s.A[1], 3 * s.A[1]);
+		const __m128i dx2 = _mm_setr_epi32(0, s.A[2], 2 * s.A[2], 3 * s.A[2]);
+		const __m128i step0 = _mm_set1_epi32(s.A[0] * 4);
+		const __m128i step1 = _mm_set1_epi32(s.A[1] * 4);
+		const __m128i step2 = _mm_set1_epi32(s.A[2] * 4);
+		for (int y = box.y0; y <= box.y1; y++) {
+			__m128i e0 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[0] * (int64_t)x0 + s.B[0] * (int64_t)y + s.C[0])), dx0);
+			__m128i e1 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[1] * (int64_t)x0 + s.B[1] * (int64_t)y + s.C[1])), dx1);
+			__m128i e2 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[2] * (int64_t)x0 + s.B[2] * (int64_t)y + s.C[2])), dx2);
+			for (int dx = 0; dx < width; dx += RASTER_BLOCK) {
+				int count = width - dx < RASTER_BLOCK ? width - dx : RASTER_BLOCK;
+				//一个8像素块由两组4像素组成
+				int covered = raster_lanes4(s, e0, e1, e2, blk, 0);
+				e0 = _mm_add_epi32(e0, step0);
+				e1 = _mm_add_epi32(e1, step1);
+				e2 = _mm_add_epi32(e2, step2);
+				if (count > 4) covered |= raster_lanes4(s, e0, e1, e2, blk, 4) << 4;
+				e0 = _mm_add_epi32(e0, step0);
+				e1 = _mm_add_epi32(e1, step1);
+				e2 = _mm_add_epi32(e2, step2);
+				covered &= (1 << count) - 1;
+				if (covered) {
+					blk.x = x0 + dx;
+					blk.y = y;
+					blk.count = count;
+					blk.mask = covered;
+					fn(static_cast<const RasterBlock&>(blk));
+				}
+			}
+		}
+		return;
+#endif
+	}
+
+	//标量路径：没有SIMD，或者边函数值超出32位范围时使用64位整数
+	int64_t e0[RASTER_BLOCK], e1[RASTER_BLOCK], e2[RASTER_BLOCK];
+	for (int y = box.y0; y <= box.y1; y++) {
+		for (int dx = 0; dx < width; dx += RASTER_BLOCK) {
+			int count = width - dx < RASTER_BLOCK ? width - dx : RASTER_BLOCK;
+			int covered = 0;
+			for (int i = 0; i < RASTER_BLOCK; i++) {
+				int64_t x = x0 + dx + i;
+				e0[i] = s.A[0] * x + s.B[0] * (int64_t)y + s.C[0];
+				e1[i] = s.A[1] * x + s.B[1] * (int64_t)y + s.C[1];
+				e2[i] = s.A[2] * x + s.B[2] * (int64_t)y + s.C[2];
+				if (i < count && (e0[i] | e1[i] | e2[i]) >= 0) covered |= 1 << i;
+			}
+			if (!covered) continue;
+			raster_interpolate(s, e0, e1, e2, blk);
+			blk.x = x0 + dx;
+			blk.y = y;
+			blk.count = count;
+			blk.mask = covered;
+			fn(static_cast<const RasterBlock&>(blk));
+		}
+	}
+}
+
+template <class BlockFn>
+void rasterize(const EdgeSetup& s, BlockFn&& fn) {
+	rasterize(s, s.box, fn);
+}
+
+template <class BlockFn>
+void rasterize(const Vec3f* pts, const TileRect& clip, BlockFn&& fn) {
+	EdgeSetup s;
+	if (setup_triangle(pts, clip, s))
+		rasterize(s, fn);
+}
+
+//2x2 quad光栅化的一个包：相邻两个quad共4x2个像素，第q个quad中的像素(x+2q+dx, y+dy)在第4q+dx+2dy个通道
+//包内每个通道都算出重心坐标和深度，不论是否被覆盖(在三角形外时重心坐标有负的分量，相当于GPU的辅助像素)，
+//同一个quad中相邻通道之差就是屏幕空间的导数(quad_ddx/quad_ddy)
+struct RasterQuad {
+	int x, y;     //左上像素，x、y都是偶数
+	int mask;     //被三角形覆盖且在box内的通道
+	alignas(32) float bc0[RASTER_BLOCK];
+	float bc1[RASTER_BLOCK];
+	float bc2[RASTER_BLOCK];
+	float z[RASTER_BLOCK];
+	int px(int lane) const { return x + (lane >> 2) * 2 + (lane & 1); }
+	int py(int lane) const { return y + ((lane >> 1) & 1); }
+};
+
+//v为按通道排列的8个值，返回lane所在quad内沿x(右减左)、y(下减上，y增大的方向)的差分
+inline float quad_ddx(const float* v, int lane) { int b = lane & ~1; return v[b + 1] - v[b]; }
+inline float quad_ddy(const float* v, int lane) { int b = lane & ~2; return v[b + 2] - v[b]; }
+
+//按quad光栅化：对每个至少覆盖一个像素的包调用fn(const RasterQuad&)，包按行优先顺序遍历
+//包从box左上角向下取偶数对齐，box边上的包里超出box的通道不计入mask；深度与rasterize的结果逐位一致
+template <class QuadFn>
+void rasterize_quads(const EdgeSetup& s, const TileRect& box, QuadFn&& fn) {
+	RasterQuad q;
+	const int qx0 = box.x0 & ~1, qy0 = box.y0 & ~1;
+	static const int laneX[RASTER_BLOCK] = { 0, 1, 0, 1, 2, 3, 2, 3 };
+	static const int laneY[RASTER_BLOCK] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+	static const int colLanes[4] = { 0x05, 0x0A, 0x50, 0xA0 };   //包内第c列像素所在的通道
+#if RASTER_SSE2
+	//比rasterize多算box左边一列和下面一行，边函数值最多再变化|A|+|B|，不超过INT_MAX/2时仍在32位范围内
+	bool narrow = s.narrow;
+	for (int k = 0; k < 3; k++) {
+		int64_t a = s.A[k], b = s.B[k];
+		if ((a < 0 ? -a : a) + (b < 0 ? -b : b) > INT32_MAX / 2) narrow = false;
+	}
+#endif
+	for (int y = qy0; y <= box.y1; y += 2) {
+		int rowMask = (y >= box.y0 ? 0x33 : 0) | (y + 1 <= box.y1 ? 0xCC : 0);
+#if RASTER_SSE2
+		if (narrow) {
+			//每个quad一组4个通道：偏移为(0, A, B, A+B)，第二个quad再加2A
+			__m128i e[3], lo[3], hi[3], step[3];
+			for (int k = 0; k < 3; k++) {
+				lo[k] = _mm_setr_epi32(0, s.A[k], s.B[k], s.A[k] + s.B[k]);
+				hi[k] = _mm_add_epi32(lo[k], _mm_set1_epi32(2 * s.A[k]));
+				step[k] = _mm_set1_epi32(4 * s.A[k]);
+				e[k] = _mm_set1_epi32((int)(s.A[k] * (int64_t)qx0 + s.B[k] * (int64_t)y + s.C[k]));
+			}
+			const __m128 inv = _mm_set1_ps(s.invArea);
+			const __m128 z0 = _mm_set1_ps(s.z[0]), z1 = _mm_set1_ps(s.z[1]), z2 = _mm_set1_ps(s.z[2]);
+			for (int x = qx0; x <= box.x1; x += 4) {
+				__m128i l0 = _mm_add_epi32(e[0], lo[0]), l1 = _mm_add_epi32(e[1], lo[1]), l2 = _mm_add_epi32(e[2], lo[2]);
+				__m128i h0 = _mm_add_epi32(e[0], hi[0]), h1 = _mm_add_epi32(e[1], hi[1]), h2 = _mm_add_epi32(e[2], hi[2]);
+				for (int k = 0; k < 3; k++) e[k] = _mm_add_epi32(e[k], step[k]);
+				int covered = (~_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(l0, l1), l2)))) & 0xF;
+				covered |= ((~_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(h0, h1), h2)))) & 0xF) << 4;
+				int colMask = 0;
+				for (int c = 0; c < 4; c++)
+					if (x + c >= box.x0 && x + c <= box.x1) colMask |= colLanes[c];
+				covered &= rowMask & colMask;
+				if (!covered) continue;
+				//运算顺序与raster_lanes4相同
+				__m128 b0 = _mm_mul_ps(_mm_cvtepi32_ps(l0), inv), b1 = _mm_mul_ps(_mm_cvtepi32_ps(l1), inv), b2 = _mm_mul_ps(_mm_cvtepi32_ps(l2), inv);
+				_mm_store_ps(q.bc0, b0);
+				_mm_storeu_ps(q.bc1, b1);
+				_mm_storeu_ps(q.bc2, b2);
+				_mm_storeu_ps(q.z, _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, z0), _mm_mul_ps(b1, z1)), _mm_mul_ps(b2, z2)));
+				b0 = _mm_mul_ps(_mm_cvtepi32_ps(h0), inv);
+				b1 = _mm_mul_ps(_mm_cvtepi32_ps(h1), inv);
+				b2 = _mm_mul_ps(_mm_cvtepi32_ps(h2), inv);
+				_mm_storeu_ps(q.bc0 + 4, b0);
+				_mm_storeu_ps(q.bc1 + 4, b1);
+				_mm_storeu_ps(q.bc2 + 4, b2);
+				_mm_storeu_ps(q.z + 4, _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, z0), _mm_mul_ps(b1, z1)), _mm_mul_ps(b2, z2)));
+				q.x = x;
+				q.y = y;
+				q.mask = covered;
+				fn(static_cast<const RasterQuad&>(q));
+			}
+			continue;
+		}
+#endif
+		//标量路径，与raster_interpolate的运算相同
+		for (int x = qx0; x <= box.x1; x += 4) {
+			int64_t e0[RASTER_BLOCK], e1[RASTER_BLOCK], e2[RASTER_BLOCK];
+			int covered = 0;
+			for (int i = 0; i < RASTER_BLOCK; i++) {
+				int64_t px = x + laneX[i], py = y + laneY[i];
+				e0[i] = s.A[0] * px + s.B[0] * py + s.C[0];
+				e1[i] = s.A[1] * px + s.B[1] * py + s.C[1];
+				e2[i] = s.A[2] * px + s.B[2] * py + s.C[2];
+				if (px >= box.x0 && px <= box.x1 && (e0[i] | e1[i] | e2[i]) >= 0) covered |= 1 << i;
+			}
+			covered &= rowMask;
+			if (!covered) continue;
+			for (int i = 0; i < RASTER_BLOCK; i++) {
+				q.bc0[i] = static_cast<float>(e0[i]) * s.invArea;
+				q.bc1[i] = static_cast<float>(e1[i]) * s.invArea;
+				q.bc2[i] = static_cast<float>(e2[i]) * s.invArea;
+				q.z[i] = s.z[0] * q.bc0[i] + s.z[1] * q.bc1[i] + s.z[2] * q.bc2[i];
+			}
+			q.x = x;
+			q.y = y;
+			q.mask = covered;
+			fn(static_cast<const RasterQuad&>(q));
+		}
+	}
+}
+
+//透视正确插值的三角形建立
+//透视除法之后在屏幕空间线性变化的是1/w和(属性/w)，不是属性本身，直接按屏幕空间的重心坐标插值纹理坐标，
+//离相机远近不同的部分纹理会被拉扯、随相机移动而"游动"。每个三角形建立一次1/w、b1/w、b2/w的平面方程
+//(b为屏幕空间的重心坐标，原点为包围盒左上角)，光栅化时对通过深度测试的块按像素偏移求三个平面的值，
+//相除得到透视正确的重心坐标，所有属性都按它插值；深度在透视除法之后本来就是屏幕空间线性的，仍用RasterBlock::z
+struct PerspectiveSetup {
+	int x0, y0;            //平面方程的原点
+	float plane[3][3];     //1/w、b1/w、b2/w在原点处的值，对x、对y的偏导
+};
+
+//w为三个顶点的裁剪空间w(裁剪之后都大于0)
+void setup_perspective(const EdgeSetup& s, const float* w, PerspectiveSetup& p);
+
+//像素(x+dx[i], y+dy[i])的透视正确重心坐标，第i个值写入b0[i]、b1[i]、b2[i]，RASTER_BLOCK个像素
+//每个像素都从平面方程的原点按(整数)偏移求值，结果与块的划分(分块渲染、Hi-Z遍历的块从不同的x开始)无关
+inline void perspective_bary_lanes(const PerspectiveSetup& p, int x, int y, const float* dx, const float* dy,
+                                   float* b0, float* b1, float* b2) {
+	float ox = (float)(x - p.x0), oy = (float)(y - p.y0);
+	const float* w = p.plane[0];
+	const float* u = p.plane[1];
+	const float* v = p.plane[2];
+#if RASTER_SSE2
+	for (int i = 0; i < RASTER_BLOCK; i += 4) {
+		__m128 lx = _mm_add_ps(_mm_set1_ps(ox), _mm_loadu_ps(dx + i));
+		__m128 ly = _mm_add_ps(_mm_set1_ps(oy), _mm_loadu_ps(dy + i));
+		__m128 iw = _mm_add_ps(_mm_set1_ps(w[0]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[1]), lx), _mm_mul_ps(_mm_set1_ps(w[2]), ly)));
+		__m128 pu = _mm_add_ps(_mm_set1_ps(u[0]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(u[1]), lx), _mm_mul_ps(_mm_set1_ps(u[2]), ly)));
+		__m128 pv = _mm_add_ps(_mm_set1_ps(v[0]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(v[1]), lx), _mm_mul_ps(_mm_set1_ps(v[2]), ly)));
+		__m128 r = _mm_div_ps(_mm_set1_ps(1.f), iw);
+		__m128 c1 = _mm_mul_ps(pu, r), c2 = _mm_mul_ps(pv, r);
+		_mm_storeu_ps(b1 + i, c1);
+		_mm_storeu_ps(b2 + i, c2);
+		_mm_storeu_ps(b0 + i, _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.f), c1), c2));
+	}
+#else
+	for (int i = 0; i < RASTER_BLOCK; i++) {
+		float lx = ox + dx[i], ly = oy + dy[i];
+		float r = 1.f / (w[0] + (w[1] * lx + w[2] * ly));
+		b1[i] = (u[0] + (u[1] * lx + u[2] * ly)) * r;
+		b2[i] = (v[0] + (v[1] * lx + v[2] * ly)) * r;
+		b0[i] = 1.f - b1[i] - b2[i];
+	}
+#endif
+}
+
+//一个光栅化块(从(x,y)开始的一行像素)的透视正确重心坐标
+inline void perspective_bary(const PerspectiveSetup& p, int x, int y, float* b0, float* b1, float* b2) {
+	static const float dx[RASTER_BLOCK] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	static const float dy[RASTER_BLOCK] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	perspective_bary_lanes(p, x, y, dx, dy, b0, b1, b2);
+}
+
+//quad包各通道(包括辅助通道)的透视正确重心坐标
+inline void perspective_bary(const PerspectiveSetup& p, const RasterQuad& q, float* b0, float* b1, float* b2) {
+	static const float dx[RASTER_BLOCK] = { 0, 1, 0, 1, 2, 3, 2, 3 };
+	static const float dy[RASTER_BLOCK] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+	perspective_bary_lanes(p, q.x, q.y, dx, dy, b0, b1, b2);
+}
+
+//只写深度的光栅化：box内被覆盖且通过深度测试的像素写入深度，不输出重心坐标、不回调，用于z预pass和阴影图
+//深度的算法和运算顺序与rasterize相同，结果逐位一致；depth指向深度缓冲中(0,0)的位置，pitch为一行的元素数
+//只写box内的像素(分块渲染时可以并行)，返回写入的像素数
+int rasterize_depth(const EdgeSetup& s, const TileRect& box, float* depth, int pitch);
+
+//块深度测试：返回被覆盖且深度大于zrow[i]的像素掩码(zbuffer中越大越近)，zrow指向zbuffer中(blk.x, blk.y)的位置
+inline int depth_test(const RasterBlock& blk, const float* zrow) {
+#if RASTER_SSE2
+	if (blk.count == RASTER_BLOCK) {
+		int lo = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(zrow),     _mm_loadu_ps(blk.z)));
+		int hi = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(zrow + 4), _mm_loadu_ps(blk.z + 4)));
+		return (lo | (hi << 4)) & blk.mask;
+	}
+#endif
+	int pass = 0;
+	for (int i = 0; i < blk.count; i++)
+		if (zrow[i] < blk.z[i]) pass |= 1 << i;
+	return pass & blk.mask;
+}
+
+#endif //__RASTERIZER_H__
@@ -0,0 +1,96 @@
+#ifndef __RENDERSTATS_H__
+#define __RENDERSTATS_H__
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include "threadpool.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//渲染统计计数，都是一帧内的累计值
+struct RenderCounters {
+	long long faces;                 //模型的面片(包括整簇剔除的)
+	long long facesCulled;           //面片光照强度<=0被剔除的面片
+	long long facesMeshletCulled;    //随所在的簇整簇剔除(视锥或法线锥)、没有进入三角形装配的面片
+	long long facesClipped;          //需要在齐次空间裁剪的面片(包括完全在外侧被丢掉的)
+	long long triangles;             //送去光栅化的(子)三角形
+	long long trianglesRejected;     //退化或完全在屏幕外，建立阶段就被丢掉的三角形
+	long long bboxPixels;            //光栅化遍历的包围盒像素
+	long long coveredPixels;         //其中被三角形覆盖的像素
+	long long depthPass;             //通过深度测试的像素
+	long long depthFail;             //没通过深度测试的像素
+	long long fragmentsShaded;       //调用片元着色(采样纹理/fragment())的次数
+	long long fragmentsDiscarded;    //片元着色器丢弃的片元
+
+	RenderCounters();
+	void clear();
+	RenderCounters& operator+=(const RenderCounters& c);
+
+	//一个光栅化块：mask为覆盖掩码，pass为通过深度测试的掩码
+	void block(int mask, int pass);
+};
+
+//渲染统计：默认不收集，渲染路径拿到非空的RenderStats指针时才计数
+//每个线程写自己的计数器(按ThreadPool::thread_index()索引，各占一个cache行，不需要原子操作)，
+//end_frame时合并成一帧的结果；另外按像素记录片元着色次数(overdraw)，用于计算被覆盖掉的片元和输出热度图
+//按像素的计数没有加锁，只适用于串行渲染或者分块渲染(每个线程只写自己块内的像素)
+class RenderStats {
+private:
+	//相邻两个线程的计数器之间隔开至少一个cache行
+	struct Slot {
+		RenderCounters c;
+		char pad[64];
+	};
+	std::vector<Slot> slots_;
+	int width_, height_;
+	std::vector<uint16_t> shaded_;   //每个像素写入颜色的次数
+	RenderCounters frame_;           //end_frame合并的结果
+	long long shadedPixels_;         //至少写过一次颜色的像素
+	int maxOverdraw_;
+
+public:
+	//nthreads为可能参与渲染的线程数(线程编号必须小于它)，width、height为帧的大小
+	RenderStats(int nthreads, int width, int height);
+
+	void begin_frame();              //计数和overdraw清零
+	void end_frame();                //合并各线程的计数
+
+	RenderCounters& local() { return slots_[ThreadPool::thread_index()].c; }
+	//(x,y)处写入了一个片元的颜色(丢弃的片元不算)
+	void shade(int x, int y) { uint16_t& n = shaded_[(size_t)y * width_ + x]; if (n != UINT16_MAX) n++; }
+
+	const RenderCounters& frame() const { return frame_; }
+	long long shaded_pixels() const { return shadedPixels_; }
+	long long fragments_written() const { return frame_.fragmentsShaded - frame_.fragmentsDiscarded; }
+	long long fragments_overwritten() const { return fragments_written() - shadedPixels_; }   //着色后又被覆盖掉的片元
+	double overdraw() const { return shadedPixels_ ? (double)fragments_written() / shadedPixels_ : 0; }
+	int max_overdraw() const { return maxOverdraw_; }
+	int overdraw_at(int x, int y) const { return shaded_[(size_t)y * width_ + x]; }
+
+	//输出一帧的统计
+	void report(std::ostream& out, const char* name) const;
+	//写overdraw热度图：没有着色的像素为黑色，写入1、2、3、4、5次及以上依次为蓝、青、绿、黄、红色
+	//与其他输出一样上下翻转，图中的上方就是屏幕上方
+	bool write_heatmap(const char* filename) const;
+};
+
+//掩码中1的个数
+inline int stats_popcount(int mask) {
+#if defined(_MSC_VER)
+	return (int)__popcnt((unsigned int)mask);
+#else
+	return __builtin_popcount((unsigned int)mask);
+#endif
+}
+
+inline void RenderCounters::block(int mask, int pass) {
+	int covered = stats_popcount(mask), passed = stats_popcount(pass);
+	coveredPixels += covered;
+	depthPass += passed;
+	depthFail += covered - passed;
+}
+
+#endif //__RENDERSTATS_H__
@@ -0,0 +1,31 @@
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+//阴影图：从光源方向只光栅化深度(rasterize_depth)得到的float深度缓冲，与zbuffer一样越大越近(越靠近光源)
+//着色时把片元变换到光源的屏幕空间，用PCF(百分比邻近过滤)在周围(2r+1)x(2r+1)个texel上比较深度，
+//返回被照亮的比例，阴影边缘不再是锯齿状的硬边
+class ShadowMap {
+private:
+	int size_;
+	std::vector<float> depth_;
+
+public:
+	explicit ShadowMap(int size);
+
+	int size() const { return size_; }
+	float* data() { return &depth_[0]; }
+	const float* data() const { return &depth_[0]; }
+	void clear();                    //清为负无穷(没有遮挡)
+
+	//光源屏幕空间中(x,y)处深度为z的点被照亮的比例(0..1)
+	//z + bias不小于texel中的深度就算照亮，bias用来避免表面自己遮挡自己(shadow acne)；阴影图以外的texel都算照亮
+	float pcf(float x, float y, float z, float bias, int radius = 1) const;
+
+	//深度可视化(近处亮)，只有负无穷的texel为黑色；与其他输出一样上下翻转
+	bool write_tga_file(const char* filename) const;
+};
+
+#endif //__SHADOWMAP_H__
@@ -0,0 +1,20 @@
+#ifndef __SPAN_H__
+#define __SPAN_H__
+
+#include <cstddef>
+
+//只读视图：指向连续内存的指针和元素个数，不拥有也不复制数据(相当于C++20的std::span)
+template <class T>
+struct Span {
+	const T* ptr;
+	int len;
+	Span() : ptr(NULL), len(0) {}
+	Span(const T* p, int n) : ptr(p), len(n) {}
+	const T& operator[](const int i) const { return ptr[i]; }
+	int size() const { return len; }
+	const T* data() const { return ptr; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + len; }
+};
+
+#endif //__SPAN_H__
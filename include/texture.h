@@ -0,0 +1,57 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include <cstdint>
+#include "geometry.h"
+#include "tgaimage.h"
+
+//纹理过滤方式
+enum TextureFilter {
+	FILTER_NEAREST,     //最近点
+	FILTER_BILINEAR,    //在最接近的一层内双线性插值
+	FILTER_TRILINEAR    //相邻两层各做一次双线性，再按LOD的小数部分插值
+};
+
+//采样用的纹理
+//加载时由TGAImage生成：每个texel统一扩展为4字节(BGRA顺序，与TGAColor相同，灰度图只用第一个字节)，
+//并逐级2x2平均生成mip链直到1x1。每一层按8x8的块存放，块内按Morton(Z)顺序排列，
+//双线性的2x2邻域和相邻几行的texel多数落在同一个256字节的块内，缩小绘制时不再每次采样都换cache行
+//过滤采样时纹理坐标超出[0,1]的部分夹到边缘
+class Texture {
+private:
+	struct Level {
+		int width, height;
+		int tilesX;                    //每行的块数
+		std::vector<uint32_t> texels;  //按块存放，块内Morton顺序
+	};
+	std::vector<Level> levels_;
+	int bytespp_;
+
+	static uint32_t fetch(const Level& l, int x, int y);   //x、y必须在范围内
+	Vec4f bilinear(int level, float u, float v) const;
+
+public:
+	Texture();
+	void build(TGAImage& image, bool mipmaps = true);   //image的第y行对应v=y/height
+	void clear();
+
+	bool empty() const;
+	int width(int level = 0) const;
+	int height(int level = 0) const;
+	int levels() const;
+	int bytespp() const;
+
+	//与TGAImage::get相同：(x,y)超出范围时返回全0
+	TGAColor texel(int x, int y, int level = 0) const;
+	//最近点采样，与TGAImage::get(u*width, v*height)的结果相同
+	TGAColor nearest(Vec2f uv) const;
+
+	//由屏幕上向右、向下移动一个像素时纹理坐标的变化量计算LOD(第0层texel与像素之比的log2)
+	float lod(const Vec2f& duvdx, const Vec2f& duvdy) const;
+	//按给定LOD采样，返回BGRA四个通道(0..255)；最近点和双线性使用最接近的一层
+	Vec4f sample(Vec2f uv, TextureFilter filter, float lod = 0) const;
+	Vec4f sample(Vec2f uv, const Vec2f& duvdx, const Vec2f& duvdy, TextureFilter filter) const;
+};
+
+#endif //__TEXTURE_H__
@@ -3,6 +3,9 @@
 
 #include <fstream>
 
+class MappedFile;
+class ThreadPool;
+
 #pragma pack(push,1)
 struct TGA_Header {
     char idlength;
@@ -69,9 +72,13 @@ protected:
     int width;
     int height;
     int bytespp;
+    MappedFile* mapping;   // data指向这个文件的写时复制映射时不为NULL，否则data由new[]分配
 
+    bool   load_rle_data(const unsigned char *p, const unsigned char *end, bool reversed);
     bool   load_rle_data(std::ifstream &in);
     bool unload_rle_data(std::ofstream &out);
+    unsigned char *encode_rle_rows(int y0, int y1, unsigned char *out) const;
+    void release();
 public:
     enum Format {
         GRAYSCALE=1, RGB=3, RGBA=4
@@ -80,8 +87,15 @@ public:
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage &img);
-    bool read_tga_file(const char *filename);
-    bool write_tga_file(const char *filename, bool rle=true);
+    // 整个文件映射进内存后解码；flip为true时得到上下翻转的结果(等价于读完再flip_vertically，但不需要多一遍拷贝)
+    // 未压缩且行顺序正好符合要求的文件不拷贝像素，直接使用映射的内存
+    bool read_tga_file(const char *filename, bool flip=false);
+    bool read_tga_file_stream(const char *filename);   // 原来逐像素读ifstream的实现，用于对比
+    bool mapped() const;
+    // 整个文件先在内存中拼好，一次写出；RLE的包不跨行，大图按水平条带并行编码后拼接
+    // pool为空且图像足够大时临时创建线程池
+    bool write_tga_file(const char *filename, bool rle=true, ThreadPool *pool=NULL);
+    bool write_tga_file_stream(const char *filename, bool rle=true);   // 原来逐包写ofstream的实现，用于对比
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
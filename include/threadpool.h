@@ -0,0 +1,37 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//线程池：固定数量的工作线程从任务队列中取任务执行
+//线程编号：调用线程(非池内线程)为0，工作线程为1..size()-1，可用来索引每线程的数据
+class ThreadPool {
+private:
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()> > tasks_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stop_;
+
+	void workerLoop(int index);
+
+public:
+	ThreadPool(int nthreads = 0);    //nthreads包含调用线程，0表示使用硬件线程数
+	~ThreadPool();
+
+	int size() const;                //参与并行的线程数(工作线程数+1)
+	void enqueue(std::function<void()> task);   //提交一个异步任务
+
+	//并行执行fn(i, thread)，i取[0,n)，调用线程也参与执行，返回时所有i都已完成
+	void parallel_for(int n, const std::function<void(int, int)>& fn);
+
+	static int thread_index();       //当前线程的编号
+	static int hardware_threads();   //硬件线程数(至少为1)
+};
+
+#endif //__THREADPOOL_H__
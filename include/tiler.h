@@ -0,0 +1,40 @@
+#ifndef __TILER_H__
+#define __TILER_H__
+
+#include <vector>
+#include <functional>
+#include "geometry.h"
+#include "threadpool.h"
+
+//屏幕上的矩形区域(闭区间)，用于把光栅化限制在某个分块或视口内
+struct TileRect {
+	int x0, y0, x1, y1;
+	TileRect() : x0(0), y0(0), x1(-1), y1(-1) {}
+	TileRect(int _x0, int _y0, int _x1, int _y1) : x0(_x0), y0(_y0), x1(_x1), y1(_y1) {}
+	bool empty() const { return x0 > x1 || y0 > y1; }
+};
+
+//分块器：把屏幕坐标下的三角形按包围盒分到 tileSize x tileSize 的屏幕块中
+//渲染时每个线程领取整块，按提交顺序光栅化块内的三角形，只写该块内的像素和zbuffer，所以像素循环里不需要加锁，结果与串行一致
+class TileBinner {
+private:
+	int width_, height_, tileSize_;
+	int tilesX_, tilesY_;
+	std::vector<std::vector<int> > bins_;   //每个块内的三角形编号(按提交顺序)
+
+public:
+	TileBinner(int width, int height, int tileSize = 64);
+
+	void clear();
+	void bin(int tri, const Vec3f* pts);    //把编号为tri的三角形加入它的包围盒覆盖到的块
+
+	int ntiles() const;
+	int tile_size() const;
+	TileRect tile_rect(int tile) const;
+	const std::vector<int>& tile_triangles(int tile) const;
+
+	//并行渲染所有非空块，raster(tri, rect, thread)负责把三角形tri限制在rect内光栅化
+	void render(ThreadPool& pool, const std::function<void(int, const TileRect&, int)>& raster) const;
+};
+
+#endif //__TILER_H__
@@ -0,0 +1,41 @@
+#ifndef __VERTEXSTAGE_H__
+#define __VERTEXSTAGE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "threadpool.h"
+
+//顶点处理阶段(post-transform cache)
+//每帧把模型的每个不同顶点只变换一次，结果存在连续的数组里，三角形装配时按顶点索引取用，
+//相邻面片共享的顶点不再重复变换，也不再为每个顶点构造Matrix
+class VertexStage {
+private:
+	float mvp_[16];        //预先乘好的模型-视图-投影矩阵，行主序
+	float scale_[4];       //视口变换：透视除法之后 屏幕坐标 = ndc*scale + offset
+	float offset_[4];
+	std::vector<Vec4f> clip_;
+	std::vector<Vec3f> screen_;
+
+public:
+	VertexStage();
+
+	//mvp为行主序的4x4矩阵；viewport为视口变换矩阵(只用到对角线和第四列)
+	void set_transform(const float* mvp, const float* viewport);
+
+	//变换n个顶点，pool非空时分块并行
+	void process(const Vec3f* verts, int n, ThreadPool* pool = NULL);
+	//只变换mask[i]非0的顶点，其余顶点的结果保持原样、不可使用；
+	//用于meshlet剔除之后只处理可见簇的顶点，连续的一段顶点合成一次批量变换
+	void process(const Vec3f* verts, int n, const unsigned char* mask);
+
+	int size() const;
+	const Vec4f& clip(int i) const;       //裁剪空间坐标
+	const Vec3f& screen(int i) const;     //透视除法和视口变换之后的屏幕坐标，w<=0时无意义(这样的三角形一定要裁剪)
+};
+
+//批量变换内核：clip[i] = mvp*(v,1)，screen[i] = clip.xyz/clip.w*scale + offset
+//运算顺序与Matrix的乘法相同，结果逐位一致
+void transform_vertices(const float* mvp, const float* scale, const float* offset,
+                        const Vec3f* in, int n, Vec4f* clip, Vec3f* screen);
+
+#endif //__VERTEXSTAGE_H__
@@ -0,0 +1,82 @@
+#ifndef __VISBUFFER_H__
+#define __VISBUFFER_H__
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "tiler.h"
+#include "threadpool.h"
+
+//可见性缓冲(延迟着色)
+//第一阶段只光栅化深度、三角形编号和重心坐标，不做任何着色；
+//第二阶段每个屏幕像素只调用一次片元着色器，被后来的三角形覆盖掉的片元不再付出纹理采样等着色开销
+class VisibilityBuffer {
+private:
+	int width_, height_;
+	std::vector<float> depth_;
+	std::vector<int> triangle_;   //像素上可见的三角形编号，-1表示没有
+	std::vector<Vec3f> bary_;     //相对于该三角形的重心坐标
+	std::atomic<long long> depthPasses_;   //第一阶段通过深度测试的片元数，即直接着色时会着色的次数
+
+public:
+	VisibilityBuffer(int width, int height);
+
+	int width() const;
+	int height() const;
+	void clear();
+
+	//第一阶段：光栅化屏幕空间三角形pts，编号为id(例如面片序号)，限制在clip内
+	//bary非空时pts是裁剪得到的子三角形，bary[j]为其顶点相对于原三角形的重心坐标，缓冲中存的是相对于原三角形的重心坐标
+	//w非空时为pts三个顶点的裁剪空间w，缓冲中存透视正确的重心坐标(见setup_perspective)
+	void rasterize(int id, const Vec3f* pts, const TileRect& clip, const Vec3f* bary = NULL, const float* w = NULL);
+
+	int triangle(int x, int y) const;
+	Vec3f bary(int x, int y) const;
+	float depth(int x, int y) const;
+
+	long long depth_passes() const;
+	long long covered_pixels() const;     //有可见三角形的像素数，即第二阶段的着色次数
+
+	//第二阶段：并行着色，S需要提供vertex(iface, nthvert)和fragment(bary, color)(IShader的接口)
+	//每个线程使用proto的一份副本，着色前先调用vertex得到像素所属三角形的varying
+	//fragment返回的discard在这里无法再让后面的片元显露出来，被丢弃的像素保持image原来的颜色
+	template <class S>
+	void shade(const S& proto, TGAImage& image, ThreadPool& pool) const;
+};
+
+template <class S>
+void VisibilityBuffer::shade(const S& proto, TGAImage& image, ThreadPool& pool) const {
+	//按8x8块着色，块内像素按三角形编号排序后成组着色，每个三角形在每个块里只调用一次vertex
+	//(逐行扫描时每跨过一次三角形边界就要重新调用vertex，小三角形多时比着色本身还贵)
+	const int T = 8;
+	int tilesX = (width_ + T - 1) / T, tilesY = (height_ + T - 1) / T;
+	pool.parallel_for(tilesY, [&](int ty, int) {
+		S shader = proto;
+		TGAColor color;
+		long long keys[T * T];
+		for (int tx = 0; tx < tilesX; tx++) {
+			int n = 0;
+			for (int y = ty * T; y < std::min(height_, (ty + 1) * T); y++)
+				for (int x = tx * T; x < std::min(width_, (tx + 1) * T); x++) {
+					int id = triangle_[x + y * width_];
+					if (id >= 0) keys[n++] = ((long long)id << 32) | (x + y * width_);
+				}
+			std::sort(keys, keys + n);
+			int current = -1;
+			for (int k = 0; k < n; k++) {
+				int id = (int)(keys[k] >> 32);
+				int idx = (int)(keys[k] & 0xffffffff);
+				if (id != current) {
+					for (int j = 0; j < 3; j++) shader.vertex(id, j);
+					current = id;
+				}
+				if (!shader.fragment(bary_[idx], color))
+					image.set(idx % width_, idx / width_, color);
+			}
+		}
+	});
+}
+
+#endif //__VISBUFFER_H__
@@ -3,134 +3,135 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <memory>
 
 #include "tgaimage.h"   //tga画图库
 #include "model.h"      //模型类，主要实现模型的读取
 #include "geometry.h"   //几何库，主要定义了Vec2和Vec3类型
+#include "tiler.h"      //屏幕分块，用于多线程分块渲染
+#include "rasterizer.h" //边函数光栅化核心
+#include "hiz.h"        //层次z缓冲
+#include "clipper.h"    //齐次空间裁剪
+#include "threadpool.h" //线程池
+#include "visbuffer.h"  //可见性缓冲(延迟着色)
+#include "vertexstage.h" //顶点处理阶段
+#include "objparser.h"  //OBJ文件解析
+#include "meshcache.h"  //网格二进制缓存
+#include "texture.h"    //mip链纹理与过滤采样
+#include "framebuffer.h" //帧缓冲
+#include "framewriter.h" //后台写帧线程
+#include "batch.h"      //批量渲染任务
+#include "renderstats.h" //渲染统计
+#include "meshlet.h"    //三角形簇剔除
+#include "bvh.h"        //光线投射用的BVH
+#include "shadowmap.h"  //阴影图
+#include "pipeline.h"   //默认场景、变换矩阵和三角形的裁剪投影(与性能测试共用)
+
+
+//统计堆分配次数(替换全局operator new)，用来检查渲染循环里是否还有堆分配，只在测试时打开(cmake -DCOUNT_HEAP_ALLOCATIONS=ON)
+//按线程计数：线程池里后台加载纹理等的分配不会算到渲染线程上
+#ifdef COUNT_HEAP_ALLOCATIONS
+thread_local long long heap_allocations = 0;
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+//本线程到目前为止的堆分配次数，没有打开统计时返回-1
+long long heap_allocation_count() {
+#ifdef COUNT_HEAP_ALLOCATIONS
+    return heap_allocations;
+#else
+    return -1;
+#endif
+}
 
+//输出frames帧内的堆分配次数(before为开始前的heap_allocation_count())
+void print_heap_allocations(long long before, int frames) {
+    if (before < 0) std::cout << "heap allocations not counted (configure with -DCOUNT_HEAP_ALLOCATIONS=ON)";
+    else std::cout << (double)(heap_allocation_count() - before) / frames << " heap allocations/frame";
+}
 
 //定义颜色
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red   = TGAColor(255, 0,   0,   255);
 const TGAColor green = TGAColor(0,   255, 0,   255);
 
-//定义宽度高度深度
-const int width  = 800;
-const int height = 800;
-const int depth  = 255;
-
-
 //初始化模型
 //Model * model = new Model("../obj/diablo3_pose/diablo3_pose.obj");
 Model * model = new Model("../obj/african_head/african_head.obj");
 
 //创建深度缓冲矩阵
 float *zbuffer = new float[width*height];
+//zbuffer上的层次z缓冲，用于在逐像素计算之前剔除被挡住的块
+HiZBuffer hiz(zbuffer, width, height);
+//顶点处理阶段的输出缓冲，每帧重复使用，不再分配内存
+VertexStage vertex_stage;
+//渲染统计，为空时不统计(渲染路径上只多一次指针判断)
+RenderStats* render_stats = NULL;
+//meshlet剔除：打开时assemble_perspective先按簇做视锥和法线锥剔除，只变换、装配可见簇的顶点和面片
+bool meshlet_culling = true;
+//簇的法线锥剔除方式(MeshletConeTest的组合)：默认按光照方向剔除，与逐面片的光照强度剔除一致，画面不变；
+//渲染路径不做逐面片背面剔除，近平面切进模型时背面是看得见的，加上MESHLET_CONE_VIEW会改变画面(test_meshlets会报告)
+int meshlet_cone = MESHLET_CONE_DIRECTION;
+MeshletCullStats meshlet_stats;          //最近一帧的剔除统计
+//每帧重复使用的可见簇序号和面片/顶点标记
+std::vector<int> meshlet_visible;
+std::vector<unsigned char> face_visible, vertex_visible;
 void clearzbuffer(){
     for (int i = width*height; i--; zbuffer[i] = -std::numeric_limits<float>::max());  //(-∞)
+    hiz.clear();
 }
-
-
-//位置信息
-Vec3f light_dir = Vec3f(0, 0, -1).normalize();      //光源位置  光照负方向 即光源相对于物体的位置
-Vec3f cameraPos(1, 0.5, 1.5);         //相机位置
-Vec3f centerPos(0, 0, 0);             //中心点位置
-Vec3f        up(0, 1, 0);             //指向上方向的向量
-
-
-
-//四阶列向量
-Matrix local2homo(Vec3f v) {
-    Matrix m(4, 1);
-    m[0][0] = v.x;
-    m[1][0] = v.y;
-    m[2][0] = v.z;
-    m[3][0] = 1.0f;
-    return m;
-}
-
-//降维
-Vec3f homo2vertices(Matrix m) {
-    return Vec3f(m[0][0], m[1][0], m[2][0]);
-}
-
-//模型变换矩阵
-Matrix modelMatrix() {
-    return Matrix::identity(4);   //模型坐标已经是NDC坐标([-1, 1]范围内),因此无需变换，用单位矩阵代替
+//不是背景色(全0)的像素数
+int lit_pixels(TGAImage& image) {
+    int bpp = image.get_bytespp(), n = 0;
+    const unsigned char* p = image.buffer();
+    for (int i = image.get_width() * image.get_height(); i--; p += bpp) {
+        bool lit = false;
+        for (int k = 0; k < bpp; k++) lit = lit || p[k];
+        n += lit;
+    }
+    return n;
 }
-
-//视图变换矩阵
-Matrix viewMatrix() {
-    return Matrix::identity(4);
+//深度缓冲中画过的像素数
+int covered_pixels(){
+    int n = 0;
+    for (int i = width*height; i--; ) n += zbuffer[i] != -std::numeric_limits<float>::max();
+    return n;
 }
 
-//透视投影变换矩阵
-Matrix projectionMatrix() {
-    Matrix projection = Matrix::identity(4);
-    //projection[3][2] = -1.0f / (cameraPos - centerPos).norm()；
-    projection[3][2] = -1.0f / cameraPos.z;
-    return projection;
-}
 
-//透视除法（前三个分量都除以第四个分量 即第四维归一）
-Matrix projectionDivision(Matrix m) {
-    m[0][0] = m[0][0] / m[3][0];
-    m[1][0] = m[1][0] / m[3][0];
-    m[2][0] = m[2][0] / m[3][0];
-    m[3][0] = 1.0f;
-    return m;
-}
+//位置信息(相机位置等见pipeline.h)
+Vec3f light_dir = lightDir;      //光源位置  光照负方向 即光源相对于物体的位置
 
-//视口变换矩阵     //将[-1,1]^2中的点变换到以(x,y)为原点，w,h为宽与高的屏幕区域内
-Matrix viewportMatrix(int x, int y, int w, int h) {
-    Matrix m = Matrix::identity(4);
-    m[0][3] = x + w / 2.f;
-    m[1][3] = y + h / 2.f;
-    m[2][3] = depth / 2.f;
+//裁剪：视口外每边留4096像素的保护带
+ClipParams clipParams = ClipParams::guard_band(width, height, 4096);
 
-    m[0][0] = w / 2.f;
-    m[1][1] = h / 2.f;
-    m[2][2] = depth / 2.f;
-    return m;
+Vec3f clip2screen(const Vec4f& v) {
+    return clip2screen(v, viewport_);
 }
 
-
-//摄像机变换矩阵    
-//https://zhuanlan.zhihu.com/p/400791821   
-//https://www.zhihu.com/question/447781866/answer/1859618164 
-//https://blog.csdn.net/qq960885333/article/details/8448036
-//更改摄像机视角=更改物体位置和角度，操作为互逆矩阵
-//摄像机变换是先旋转再平移，所以物体需要先平移后旋转，且都是逆矩阵
-Matrix cameraMatrix(Vec3f camera, Vec3f center, Vec3f up) {
-    //计算出z，根据z和up算出x，再算出y
-    Vec3f z = (camera - center).normalize();
-    Vec3f x = (up ^ z).normalize();
-    Vec3f y = (z ^ x).normalize();
-    Matrix rotation = Matrix::identity(4);
-    Matrix translation = Matrix::identity(4);
-    //***矩阵的第四列是用于平移的,需要将物体平移-camera***
-    for (int i = 0; i < 3; i++) {
-        translation[i][3] = -camera[i];
-    }
-    //正交矩阵的逆 = 正交矩阵的转置
-    for (int i = 0; i < 3; i++) {
-        rotation[0][i] = x[i];
-        rotation[1][i] = y[i];
-        rotation[2][i] = z[i];
-    }
-    //这样乘法的效果是先平移物体，再旋转
-    Matrix res = rotation * translation;
-    return res;
+//全局的裁剪参数和视口(width x height)
+int clip_project(const Vec4f* clip, Vec3f* screen, Vec3f* bary, bool& clipped, const Vec3f* projected = NULL) {
+    return clip_project(clipParams, viewport_, clip, screen, bary, clipped, projected);
 }
 
-//mvp变换和视口变换
-Matrix model_ = modelMatrix();
-Matrix view_ = viewMatrix();
-Matrix projection_ = projectionMatrix();
-//Matrix viewport_ = viewportMatrix(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
-Matrix viewport_ = viewportMatrix(0, 0, width, height);
-Matrix camera_ = cameraMatrix(cameraPos, centerPos, up);
-
 
 
 //画线算法
@@ -225,6 +226,7 @@ void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage &image, TGAColor color) {
 
 //计算重心坐标函数  
 //(利用叉乘判断是否在三角形内部)
+//光栅化已改为rasterizer.h中的增量边函数，这里保留逐像素的写法作为对照
 Vec3f barycentric(Vec3f *pts, Vec3f P) {
    //计算向量[AB,AC,PA]
     Vec3f AB(pts[1].x - pts[0].x, pts[1].y - pts[0].y, pts[1].z - pts[0].z);
@@ -248,28 +250,12 @@ Vec3f barycentric(Vec3f *pts, Vec3f P) {
 //包围盒平面着色
 void Rasterization(Vec3f* pts, TGAImage& image, const TGAColor& color)
 {
-    //包围盒
-    Vec2f bboxMin(image.get_width() - 1, image.get_height() - 1);   //图片的右下角(像素的范围从0开始，而宽度从1开始)
-    Vec2f bboxMax(0, 0);  //左上角
-    //计算三角形的包围盒
-    bboxMin.x = std::min({ bboxMin.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMin.y = std::min({ bboxMin.y, pts[0].y, pts[1].y, pts[2].y });
-    bboxMax.x = std::max({ bboxMax.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMax.y = std::max({ bboxMax.y, pts[0].y, pts[1].y, pts[2].y });
-
-    Vec3f P;
-    //遍历包围盒内的所有像素，根据重心坐标判断是否在三角形内部，如果在，就绘制这个像素，否则就忽略它
-    for (P.x = bboxMin.x;  P.x <= bboxMax.x; P.x++)
-    {
-        for (P.y = bboxMin.y; P.y <= bboxMax.y; P.y++)
-        {
-            Vec3f baryCoord = barycentric(pts, P);
-            if (baryCoord.x < 0 || baryCoord.y < 0 || baryCoord.z < 0)
-                continue;
-            image.set(P.x, P.y, color);
-        }
-    }
-   
+    //边函数光栅化，包围盒限制在图片内，逐块得到覆盖掩码
+    TileRect screen(0, 0, image.get_width() - 1, image.get_height() - 1);
+    rasterize(pts, screen, [&](const RasterBlock& blk) {
+        for (int mask = blk.mask; mask; mask &= mask - 1)
+            image.set(blk.x + raster_lowest_bit(mask), blk.y, color);
+    });
 }
 
 //世界坐标转屏幕坐标函数（视口变换）
@@ -279,81 +265,156 @@ Vec3f World2Screen(Vec3f v) {
 
 
 //绘制zbuffer三角形(坐标数组，zbuffer指针，tga指针，颜色)
+void zbuffer_triangle(Vec3f *pts, float *zbuffer, TGAImage &image, TGAColor color, const TileRect &clip) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    if (stats) stats->triangles++;
+    //逐行按块遍历box，覆盖、深度都以向量形式给出，深度测试也按块进行；acceptAll时整块一定通过深度测试
+    auto raster = [&](const TileRect& box, bool acceptAll) {
+        bool wrote = false;
+        if (stats) stats->bboxPixels += (long long)(box.x1 - box.x0 + 1) * (box.y1 - box.y0 + 1);
+        rasterize(s, box, [&](const RasterBlock& blk) {
+            float* zrow = zbuffer + blk.x + blk.y * width;
+            int mask = acceptAll ? blk.mask : depth_test(blk, zrow);
+            wrote |= mask != 0;
+            if (stats) {
+                stats->block(blk.mask, mask);
+                stats->fragmentsShaded += stats_popcount(mask);
+            }
+            for (; mask; mask &= mask - 1) {
+                int i = raster_lowest_bit(mask);
+                zrow[i] = blk.z[i];
+                image.set(blk.x + i, blk.y, color);
+                if (stats) render_stats->shade(blk.x + i, blk.y);
+            }
+        });
+        return wrote;
+    };
+    //层次z缓冲只跟踪全局zbuffer
+    if (hiz.enabled() && zbuffer == hiz.depth()) hiz.traverse(s, raster);
+    else raster(s.box, false);
+}
+
 void zbuffer_triangle(Vec3f *pts, float *zbuffer, TGAImage &image, TGAColor color) {
+    zbuffer_triangle(pts, zbuffer, image, color, TileRect(0, 0, image.get_width() - 1, image.get_height() - 1));
+}
 
-   //包围盒
-    Vec2f bboxMin(image.get_width() - 1, image.get_height() - 1);   //图片的右下角(像素的范围从0开始，而宽度从1开始)
-    Vec2f bboxMax(0, 0);  //左上角
 
-    //计算三角形的包围盒
-    bboxMin.x = std::min({ bboxMin.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMin.y = std::min({ bboxMin.y, pts[0].y, pts[1].y, pts[2].y });
-    bboxMax.x = std::max({ bboxMax.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMax.y = std::max({ bboxMax.y, pts[0].y, pts[1].y, pts[2].y });
 
 
-    Vec3f P;
-    //遍历包围盒内的所有像素，根据重心坐标判断是否在三角形内部，如果在，就绘制这个像素，否则就忽略它
-    for (P.x = bboxMin.x;  P.x <= bboxMax.x; P.x++)
-    {
-        for (P.y = bboxMin.y; P.y <= bboxMax.y; P.y++)
-        {
-            Vec3f baryCoord = barycentric(pts, P);
-            if (baryCoord.x < 0 || baryCoord.y < 0 || baryCoord.z < 0)
-                continue;
-            //计算zbuffer，并且每个顶点的z值乘上对应的质心坐标分量
-            P.z = pts[0].z * baryCoord.x + pts[1].z * baryCoord.y + pts[2].z * baryCoord.z;
-                
-            if (zbuffer[static_cast<int>(P.x+P.y*width)] < P.z) {   //将像素点的坐标转换为整数，以便在深度缓冲中进行索引。
-                zbuffer[static_cast<int>(P.x+P.y*width)] = P.z;
-                image.set(P.x, P.y, color);
-            }
-        }
+//绘制zbuffer三角形+纹理贴图(漫反射纹理)(坐标数组，纹理数组，zbuffer指针，tga指针，颜色)
+//w非空时为三个顶点的裁剪空间w，纹理坐标透视正确地插值；为空时按屏幕空间的重心坐标插值
+void zbuffer_texture_triangle(Vec3f *pts, Vec2f* uvs, float *zbuffer, TGAImage &image, float intensity, const TileRect &clip, const float* w = NULL) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
     }
+    if (stats) stats->triangles++;
+    PerspectiveSetup persp;
+    if (w) setup_perspective(s, w, persp);
+    auto raster = [&](const TileRect& box, bool acceptAll) {
+        bool wrote = false;
+        if (stats) stats->bboxPixels += (long long)(box.x1 - box.x0 + 1) * (box.y1 - box.y0 + 1);
+        rasterize(s, box, [&](const RasterBlock& blk) {
+            float* zrow = zbuffer + blk.x + blk.y * width;
+            int mask = acceptAll ? blk.mask : depth_test(blk, zrow);
+            wrote |= mask != 0;
+            if (stats) {
+                stats->block(blk.mask, mask);
+                stats->fragmentsShaded += stats_popcount(mask);
+            }
+            if (!mask) return;
+            const float *bc0 = blk.bc0, *bc1 = blk.bc1, *bc2 = blk.bc2;
+            float pc[3][RASTER_BLOCK];
+            if (w) {
+                perspective_bary(persp, blk.x, blk.y, pc[0], pc[1], pc[2]);
+                bc0 = pc[0], bc1 = pc[1], bc2 = pc[2];
+            }
+            //只对通过深度测试的像素计算纹理坐标并采样
+            for (; mask; mask &= mask - 1) {
+                int i = raster_lowest_bit(mask);
+                Vec2f uvP = uvs[0]*bc0[i] + uvs[1]*bc1[i] + uvs[2]*bc2[i];
+                zrow[i] = blk.z[i];
+                TGAColor color = model->diffuse(uvP) * intensity;
+                image.set(blk.x + i, blk.y, color);
+                if (stats) render_stats->shade(blk.x + i, blk.y);
+            }
+        });
+        return wrote;
+    };
+    if (hiz.enabled() && zbuffer == hiz.depth()) hiz.traverse(s, raster);
+    else raster(s.box, false);
 }
 
+void zbuffer_texture_triangle(Vec3f *pts, Vec2f* uvs, float *zbuffer, TGAImage &image, float intensity, const float* w = NULL) {
+    zbuffer_texture_triangle(pts, uvs, zbuffer, image, intensity, TileRect(0, 0, image.get_width() - 1, image.get_height() - 1), w);
+}
 
 
+//同上，写入帧缓冲：每个8像素块按行指针访问颜色和深度，不经过TGAImage::set
+void framebuffer_texture_triangle(Vec3f *pts, Vec2f* uvs, Framebuffer &fb, float intensity, const float* w = NULL) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, TileRect(0, 0, fb.width() - 1, fb.height() - 1), s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    TileRect box = fb.aligned(s.box);
+    if (stats) {
+        stats->triangles++;
+        stats->bboxPixels += (long long)(box.x1 - box.x0 + 1) * (box.y1 - box.y0 + 1);
+    }
+    PerspectiveSetup persp;
+    if (w) setup_perspective(s, w, persp);
+    rasterize(s, box, [&](const RasterBlock& blk) {
+        float* zrow = fb.depth(blk.x, blk.y);
+        uint32_t* crow = fb.color(blk.x, blk.y);
+        int mask = depth_test(blk, zrow);
+        if (stats) {
+            stats->block(blk.mask, mask);
+            stats->fragmentsShaded += stats_popcount(mask);
+        }
+        if (!mask) return;
+        const float *bc0 = blk.bc0, *bc1 = blk.bc1, *bc2 = blk.bc2;
+        float pc[3][RASTER_BLOCK];
+        if (w) {
+            perspective_bary(persp, blk.x, blk.y, pc[0], pc[1], pc[2]);
+            bc0 = pc[0], bc1 = pc[1], bc2 = pc[2];
+        }
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            Vec2f uvP = uvs[0]*bc0[i] + uvs[1]*bc1[i] + uvs[2]*bc2[i];
+            zrow[i] = blk.z[i];
+            crow[i] = Framebuffer::pack(model->diffuse(uvP) * intensity);
+            if (stats) render_stats->shade(blk.x + i, blk.y);
+        }
+    });
+}
 
-//绘制zbuffer三角形+纹理贴图(漫反射纹理)(坐标数组，纹理数组，zbuffer指针，tga指针，颜色)
-void zbuffer_texture_triangle(Vec3f *pts, Vec2f* uvs, float *zbuffer, TGAImage &image, float intensity) {
-
-    // 包围盒
-    Vec2f bboxMin(image.get_width() - 1, image.get_height() - 1);   //图片的右下角(像素的范围从0开始，而宽度从1开始)
-    Vec2f bboxMax(0, 0);  //左上角
-
-    //计算三角形的包围盒
-    bboxMin.x = std::min({ bboxMin.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMin.y = std::min({ bboxMin.y, pts[0].y, pts[1].y, pts[2].y });
-    bboxMax.x = std::max({ bboxMax.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMax.y = std::max({ bboxMax.y, pts[0].y, pts[1].y, pts[2].y });
 
-    Vec3f P;
-    //遍历包围盒内的所有像素，根据重心坐标判断是否在三角形内部，如果在，就绘制这个像素，否则就忽略它    
-    for (P.x = bboxMin.x; P.x <= bboxMax.x; P.x++)
-    {
-        for (P.y = bboxMin.y; P.y <= bboxMax.y; P.y++)
-        {
-            Vec2f uvP;
-            Vec3f baryCoord = barycentric(pts, P);
-            if (baryCoord.x < 0 || baryCoord.y < 0 || baryCoord.z < 0)
-                continue;
-            //计算zbuffer，每个顶点的z值乘上对应的质心坐标分量  
-            P.z = pts[0].z*baryCoord.x + pts[1].z*baryCoord.y + pts[2].z*baryCoord.z;
-                
-            //计算纹理坐标
-            uvP = uvs[0]*baryCoord.x + uvs[1]*baryCoord.y + uvs[2]*baryCoord.z;
-
-            if (zbuffer[static_cast<int>(P.x+P.y*width)] < P.z) {   //将像素点的坐标转换为整数，以便在深度缓冲中进行索引。
-                zbuffer[static_cast<int>(P.x+P.y*width)] = P.z;
-                TGAColor color = model->diffuse(uvP) * intensity;
-                image.set(P.x, P.y, color);
-            }
-        }
+//只写深度的三角形：z预pass和阴影图用，不采样纹理、不写颜色、不插值任何属性
+//depth为每行pitch个元素的深度缓冲(越大越近)，深度与zbuffer_texture_triangle写入的逐位一致；不维护层次z缓冲
+void depth_triangle(Vec3f *pts, float *depth, int pitch, const TileRect &clip) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    int written = rasterize_depth(s, s.box, depth, pitch);
+    if (stats) {
+        stats->triangles++;
+        stats->bboxPixels += (long long)(s.box.x1 - s.box.x0 + 1) * (s.box.y1 - s.box.y0 + 1);
+        stats->depthPass += written;
     }
 }
 
-
 /***********************************以下为测试代码**************************************************/
 
 
@@ -376,7 +437,7 @@ void test_line_model(){
     TGAImage  image(width, height, TGAImage::RGB);
 
     for (int i = 0; i < model->nfaces(); i++) {
-        std::vector<int> face = model->face(i); //创建face数组用于保存一个face的三个顶点坐标
+        Span<int> face = model->face(i); //创建face数组用于保存一个face的三个顶点坐标
         for (int j = 0; j < 3; j++) { //每次取出face数组中的两个点画线
             Vec3f v0 = model->vert(face[j]);
             Vec3f v1 = model->vert(face[(j + 1) % 3]);
@@ -424,7 +485,7 @@ void test_triangle_model(){
   
     TGAImage image(width, height, TGAImage::RGB);
     for (int i = 0; i < model->nfaces(); i++) {    //对于每个三角形
-        std::vector<int> face = model->face(i);    //face存储一个面的三个顶点
+        Span<int> face = model->face(i);    //face存储一个面的三个顶点
         Vec3f screen_coords[3];  //屏幕坐标
         Vec3f world_coords[3];   //空间坐标
         for (int j = 0; j < 3; j++) {    //对于三角形的每个顶点
@@ -459,7 +520,7 @@ void test_zbuffer_model(){
     clearzbuffer();
     TGAImage image(width, height, TGAImage::RGB);
     for (int i = 0; i < model->nfaces(); i++) {    //对于每个三角形
-        std::vector<int> face = model->face(i);    //face存储一个面的三个顶点
+        Span<int> face = model->face(i);    //face存储一个面的三个顶点
         Vec3f screen_coords[3];  //屏幕坐标
         Vec3f world_coords[3];   //空间坐标
         for (int j = 0; j < 3; j++) {    //对于三角形的每个顶点
@@ -492,7 +553,7 @@ void test_zbuffer_texture_model(){
 
     TGAImage image(width, height, TGAImage::RGB);
     for (int i = 0; i < model->nfaces(); i++) {    //对于每个三角形
-        std::vector<int> face = model->face(i);    //face存储一个面的三个顶点
+        Span<int> face = model->face(i);    //face存储一个面的三个顶点
         Vec3f screen_coords[3];  //屏幕坐标
         Vec3f world_coords[3];   //空间坐标
         for (int j = 0; j < 3; j++) {    //对于三角形的每个顶点
@@ -522,36 +583,225 @@ void test_zbuffer_texture_model(){
 
 
 
-//Perspective projection/Moving the camera 透视投影与相机移动
-void test_perspective_projection(){
-
-    clearzbuffer();
+//透视投影的三角形装配：先变换到裁剪空间，在齐次空间裁剪(近平面和保护带)之后再做透视除法和视口变换
+//每个顶点只在顶点处理阶段变换一次，三角形装配时按索引取变换结果
+//对每个(裁剪后的)子三角形调用fn(screen_coords, uvs, intensity, w)，w为三个顶点的裁剪空间w，用于透视正确插值
+template <class TriangleFn>
+void assemble_perspective(const mat<4, 4>& camera, const mat<4, 4>& projection, TriangleFn&& fn) {
+    float mvp[16], viewport[16];
+    matrix2floats(projection * view_ * model_ * camera, mvp);
+    matrix2floats(viewport_, viewport);
+    Span<Vec3f> verts = model->verts();
+    VertexStage& vertices = vertex_stage;
+    vertices.set_transform(mvp, viewport);
+
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    if (stats) stats->faces += model->nfaces();
+    //整簇剔除：法线锥按meshlet_cone判断(光照方向和/或视点)；
+    //面片仍按原来的顺序装配，深度相同时的先后与不剔除时一样
+    const unsigned char* faceMask = NULL;
+    if (meshlet_culling) {
+        const MeshletData& meshlets = model->meshlets();
+        MeshletCuller culler(mvp, viewport, width, height, clipParams.nearW);
+        meshlet_stats.clear();
+        culler.cull(meshlets, meshlet_visible, meshlet_cone, light_dir, &meshlet_stats);
+        face_visible.assign(model->nfaces(), 0);
+        vertex_visible.assign(verts.size(), 0);
+        for (int m : meshlet_visible) {
+            const Meshlet& ml = meshlets.meshlets[m];
+            for (int k = ml.firstFace; k < ml.firstFace + ml.faceCount; k++) face_visible[meshlets.faces[k]] = 1;
+            for (int k = ml.firstVertex; k < ml.firstVertex + ml.vertexCount; k++) vertex_visible[meshlets.vertices[k]] = 1;
+        }
+        vertices.process(verts.data(), verts.size(), vertex_visible.data());
+        faceMask = face_visible.data();
+        if (stats) stats->facesMeshletCulled += meshlet_stats.facesCulled;
+    } else {
+        vertices.process(verts.data(), verts.size());
+    }
 
-    TGAImage image(width, height, TGAImage::RGB);
     for (int i = 0; i < model->nfaces(); i++)
     {
-        std::vector<int> face = model->face(i);   //获取模型的第i个面片
-        Vec3f screen_coords[3];    //存贮第i个面片三个顶点的屏幕坐标
+        if (faceMask && !faceMask[i]) continue;
+        Span<int> face = model->face(i);   //获取模型的第i个面片
+        Vec4f clip_coords[3];      //存贮第i个面片三个顶点的裁剪空间坐标
+        Vec3f projected[3];        //以及屏幕坐标
         Vec3f world_coords[3];     //存储第i个面片三个顶点的世界坐标
         for (int j = 0; j < 3; j++)
         {
-            world_coords[j] = model->vert(face[j]);
-            //Vec3f final_matrix = homo2vertices(viewport_ * projectionDivision(projection_ * view_ * model_ * local2homo(world_coords[j])));
-            Vec3f final_matrix= homo2vertices(viewport_  * projectionDivision(projection_ * view_ *  model_ * camera_ * local2homo(world_coords[j])));
-            screen_coords[j] = {static_cast<int>(final_matrix.x), static_cast<int>(final_matrix.y), static_cast<int>(final_matrix.z)};
-            
+            world_coords[j] = verts[face[j]];
+            clip_coords[j] = vertices.clip(face[j]);
+            projected[j] = vertices.screen(face[j]);
         }
 
         Vec3f normal = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
         normal.normalize();
         float intensity = normal * light_dir;
-        if (intensity > 0)
-        {
-            Vec2f uv[3];
-            for (int j = 0; j < 3; j++) uv[j] = model->uv(i, j);
-            zbuffer_texture_triangle(screen_coords, uv, zbuffer, image, intensity);
+        if (intensity <= 0) {
+            if (stats) stats->facesCulled++;
+            continue;
+        }
+
+        Vec2f uv[3];
+        for (int j = 0; j < 3; j++) uv[j] = model->uv(i, j);
+
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped, projected);
+        if (stats && clipped) stats->facesClipped++;
+        for (int k = 0; k < ntris; k++) {
+            Vec2f sub_uv[3];
+            float sub_w[3];
+            for (int j = 0; j < 3; j++) {
+                Vec3f& v = screen_coords[k * 3 + j];
+                v = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), static_cast<int>(v.z));
+                //裁剪产生的新顶点的uv和w由它相对于原三角形的重心坐标(裁剪空间中的)插值得到
+                Vec3f& b = bary[k * 3 + j];
+                sub_uv[j] = uv[0] * b.x + uv[1] * b.y + uv[2] * b.z;
+                sub_w[j] = clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z;
+            }
+            fn(&screen_coords[k * 3], sub_uv, intensity, sub_w);
         }
     }
+}
+
+//透视投影渲染到TGAImage和全局zbuffer
+void render_perspective(const mat<4, 4>& camera, TGAImage &image, const mat<4, 4>& projection = projection_) {
+    assemble_perspective(camera, projection, [&](Vec3f* pts, Vec2f* uvs, float intensity, const float* w) {
+        zbuffer_texture_triangle(pts, uvs, zbuffer, image, intensity, w);
+    });
+}
+
+//透视投影渲染到帧缓冲(颜色和深度都在fb中)
+void render_perspective(const mat<4, 4>& camera, Framebuffer &fb, const mat<4, 4>& projection = projection_) {
+    assemble_perspective(camera, projection, [&](Vec3f* pts, Vec2f* uvs, float intensity, const float* w) {
+        framebuffer_texture_triangle(pts, uvs, fb, intensity, w);
+    });
+}
+
+//批量渲染的一个任务：按任务给出的相机、光照、分辨率和着色方式把mesh画到fb中
+//不使用全局的模型、zbuffer和顶点处理阶段(都换成参数或局部变量)，可以在多个线程中同时调用
+//着色方式：flat      面片光照强度的白色
+//          texture   漫反射纹理*面片光照强度，与render_perspective相同
+//          gouraud   顶点法线的光照强度在三角形内插值
+//          normalmap 按法线贴图逐像素计算光照，乘漫反射纹理
+//flat和texture与render_perspective一样跳过面片光照强度<=0的三角形，另两种交给深度测试
+//透视系数按相机到中心的距离取(与转台动画相同)，相机在cameraPos时与projection_略有不同
+bool render_job(const RenderJob& job, Model& mesh, Framebuffer& fb, std::string& error) {
+    enum Shading { FLAT, TEXTURE, GOURAUD, NORMALMAP } shading;
+    if (job.shader == "flat") shading = FLAT;
+    else if (job.shader == "texture") shading = TEXTURE;
+    else if (job.shader == "gouraud") shading = GOURAUD;
+    else if (job.shader == "normalmap") shading = NORMALMAP;
+    else {
+        error = "unknown shader " + job.shader;
+        return false;
+    }
+    if (mesh.nfaces() == 0) {
+        error = "empty model " + job.model;
+        return false;
+    }
+    if (shading == GOURAUD && mesh.normals().size() == 0) {
+        error = job.model + " has no vertex normals";
+        return false;
+    }
+
+    Vec3f light = job.light;
+    light.normalize();
+    //投影不区分宽高比，视口取居中的正方形，非正方形的输出不会被拉伸
+    int side = std::min(job.width, job.height);
+    mat<4, 4> viewport = viewportMatrix((job.width - side) / 2, (job.height - side) / 2, side, side);
+    mat<4, 4> projection = projectionMatrix(-1.0f / (job.eye - job.center).norm());
+    ClipParams params = ClipParams::guard_band(job.width, job.height, 4096);
+    float mvp[16], vp[16];
+    matrix2floats(projection * view_ * model_ * cameraMatrix(job.eye, job.center, job.up), mvp);
+    matrix2floats(viewport, vp);
+    Span<Vec3f> verts = mesh.verts();
+    VertexStage vertices;
+    vertices.set_transform(mvp, vp);
+    vertices.process(verts.data(), verts.size());
+    TileRect screen(0, 0, fb.width() - 1, fb.height() - 1);
+
+    for (int i = 0; i < mesh.nfaces(); i++) {
+        Span<int> face = mesh.face(i);
+        Vec4f clip_coords[3];
+        Vec3f projected[3];
+        Vec3f world_coords[3];
+        for (int j = 0; j < 3; j++) {
+            world_coords[j] = verts[face[j]];
+            clip_coords[j] = vertices.clip(face[j]);
+            projected[j] = vertices.screen(face[j]);
+        }
+        Vec3f normal = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
+        normal.normalize();
+        float intensity = normal * light;
+        if ((shading == FLAT || shading == TEXTURE) && intensity <= 0) continue;
+
+        Vec2f uv[3];
+        float vertex_intensity[3];
+        for (int j = 0; j < 3; j++) {
+            uv[j] = mesh.uv(i, j);
+            //顶点法线朝外，光照方向是光线前进的方向
+            vertex_intensity[j] = shading == GOURAUD ? std::max(0.f, -(mesh.normal(i, j) * light)) : 0;
+        }
+
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(params, viewport, clip_coords, screen_coords, bary, clipped, projected);
+        for (int k = 0; k < ntris; k++) {
+            Vec3f* pts = &screen_coords[k * 3];
+            Vec2f sub_uv[3];
+            Vec3f sub_intensity;
+            float sub_w[3];
+            for (int j = 0; j < 3; j++) {
+                pts[j] = Vec3f(static_cast<int>(pts[j].x), static_cast<int>(pts[j].y), static_cast<int>(pts[j].z));
+                const Vec3f& b = bary[k * 3 + j];
+                sub_uv[j] = uv[0] * b.x + uv[1] * b.y + uv[2] * b.z;
+                sub_intensity[j] = vertex_intensity[0] * b.x + vertex_intensity[1] * b.y + vertex_intensity[2] * b.z;
+                sub_w[j] = clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z;
+            }
+            EdgeSetup s;
+            if (!setup_triangle(pts, screen, s)) continue;
+            //flat以外的着色方式按透视正确的重心坐标插值
+            PerspectiveSetup persp;
+            if (shading != FLAT) setup_perspective(s, sub_w, persp);
+            rasterize(s, fb.aligned(s.box), [&](const RasterBlock& blk) {
+                float* zrow = fb.depth(blk.x, blk.y);
+                uint32_t* crow = fb.color(blk.x, blk.y);
+                int mask = depth_test(blk, zrow);
+                if (!mask) return;
+                float bc[3][RASTER_BLOCK];
+                if (shading != FLAT) perspective_bary(persp, blk.x, blk.y, bc[0], bc[1], bc[2]);
+                for (; mask; mask &= mask - 1) {
+                    int p = raster_lowest_bit(mask);
+                    TGAColor color;
+                    if (shading == FLAT) {
+                        color = white * intensity;
+                    } else if (shading == GOURAUD) {
+                        color = white * (sub_intensity * Vec3f(bc[0][p], bc[1][p], bc[2][p]));
+                    } else {
+                        Vec2f uvP = sub_uv[0] * bc[0][p] + sub_uv[1] * bc[1][p] + sub_uv[2] * bc[2][p];
+                        float li = shading == TEXTURE ? intensity : std::max(0.f, -(mesh.normal(uvP) * light));
+                        color = mesh.diffuse(uvP) * li;
+                    }
+                    zrow[p] = blk.z[p];
+                    crow[p] = Framebuffer::pack(color);
+                }
+            });
+        }
+    }
+    return true;
+}
+
+
+//Perspective projection/Moving the camera 透视投影与相机移动
+void test_perspective_projection(){
+
+    clearzbuffer();
+
+    TGAImage image(width, height, TGAImage::RGB);
+    render_perspective(camera_, image);
 
 
     image.flip_vertically();
@@ -562,59 +812,223 @@ void test_perspective_projection(){
 
 
 
+//相机靠近模型时的裁剪测试
+//统计不裁剪(直接透视除法、包围盒不截取)和裁剪后(截取到屏幕)光栅化需要遍历的包围盒像素数，并渲染裁剪后的结果
+void test_clipping() {
+    Vec3f closePos(0.1f, 0.05f, 0.2f);
+    mat<4, 4> camera = cameraMatrix(closePos, centerPos, up);
+    mat<4, 4> projection = projectionMatrix(-1.0f / (closePos - centerPos).norm());
+    mat<4, 4> mvp = projection * view_ * model_ * camera;
+
+    long double naive_pixels = 0;
+    long long clipped_pixels = 0;
+    int behind = 0, clipped_tris = 0, culled = 0;
+    for (int i = 0; i < model->nfaces(); i++) {
+        Vec4f clip_coords[3];
+        for (int j = 0; j < 3; j++) clip_coords[j] = homo2vec4(mvp * local2homo(model->vert(i, j)));
+
+        //不裁剪：原来的做法，直接除以w，包围盒也不截取
+        float minx = 1e30f, miny = 1e30f, maxx = -1e30f, maxy = -1e30f;
+        for (int j = 0; j < 3; j++) {
+            if (clip_coords[j].w <= 0) behind++;
+            Vec3f v = clip2screen(clip_coords[j]);
+            minx = std::min(minx, v.x); maxx = std::max(maxx, v.x);
+            miny = std::min(miny, v.y); maxy = std::max(maxy, v.y);
+        }
+        naive_pixels += ((long double)maxx - minx + 1) * ((long double)maxy - miny + 1);
+
+        //裁剪之后，包围盒截取到屏幕
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped);
+        if (clipped) clipped_tris++;
+        if (ntris == 0) culled++;
+        for (int k = 0; k < ntris; k++) {
+            EdgeSetup setup;
+            if (setup_triangle(&screen_coords[k * 3], TileRect(0, 0, width - 1, height - 1), setup))
+                clipped_pixels += (long long)(setup.box.x1 - setup.box.x0 + 1) * (setup.box.y1 - setup.box.y0 + 1);
+        }
+    }
+    std::cout << "clipping (camera close to mesh): " << behind << " vertices behind the eye, " << clipped_tris
+              << " triangles clipped, " << culled << " culled" << std::endl;
+    std::cout << "  bbox pixels without clipping " << (double)naive_pixels << ", with clipping " << clipped_pixels << std::endl;
+
+    clearzbuffer();
+    TGAImage image(width, height, TGAImage::RGB);
+    auto start = std::chrono::steady_clock::now();
+    render_perspective(camera, image, projection);
+    std::cout << "  render " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+    image.flip_vertically();
+    image.write_tga_file("clip_close_camera.tga");
+
+    //相机离模型3和5个单位时整个模型都应该画出来(回归：曾经的远平面z >= -w在这两个距离上把模型全部裁掉)
+    const float distances[] = { 3, 5 };
+    for (float d : distances) {
+        Vec3f farPos(0, 0, d);
+        clearzbuffer();
+        image.clear();
+        render_perspective(cameraMatrix(farPos, centerPos, up), image, projectionMatrix(-1.0f / (farPos - centerPos).norm()));
+        int covered = covered_pixels();
+        std::cout << "  camera at distance " << d << ": " << covered << " pixels covered" << (covered ? "" : " (EMPTY FRAME)") << std::endl;
+        if (d == distances[0]) {
+            image.flip_vertically();
+            image.write_tga_file("clip_far_camera.tga");
+        }
+    }
+}
+
+
+
+
 // //Lesson 6: Shader
 class IShader {
 
 public:
-    virtual Vec3f vertex(int iface, int nthvert) = 0;        //面片和顶点
+    virtual Vec4f vertex(int iface, int nthvert) = 0;        //面片和顶点，返回裁剪空间坐标(透视除法和视口变换在裁剪之后进行)
     virtual bool fragment(Vec3f barycoord, TGAColor &color) = 0;   //片元和颜色
     void Shader(Vec3f *pts, IShader &shader, TGAImage &image, TGAImage &zbufferImage);
+    //bary非空时，pts是裁剪得到的子三角形，bary[j]为其顶点相对于原三角形的重心坐标，传给fragment的是相对于原三角形的重心坐标
+    //w非空时为pts三个顶点的裁剪空间w，传给fragment的是透视正确的重心坐标
+    void Shader(Vec3f *pts, IShader &shader, TGAImage &image, TGAImage &zbufferImage, const TileRect &clip, const Vec3f *bary = NULL, const float *w = NULL);
 
 };
 
 
 
-void IShader::Shader(Vec3f *pts, IShader &shader, TGAImage &image, TGAImage & zbuffer_image) {
-    // 包围盒
-    Vec2f bboxMin(image.get_width() - 1, image.get_height() - 1);   //图片的右下角(像素的范围从0开始，而宽度从1开始)
-    Vec2f bboxMax(0, 0);  //左上角
-
-    //计算三角形的包围盒
-    bboxMin.x = std::min({ bboxMin.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMin.y = std::min({ bboxMin.y, pts[0].y, pts[1].y, pts[2].y });
-    bboxMax.x = std::max({ bboxMax.x, pts[0].x, pts[1].x, pts[2].x });
-    bboxMax.y = std::max({ bboxMax.y, pts[0].y, pts[1].y, pts[2].y });
+void IShader::Shader(Vec3f *pts, IShader &shader, TGAImage &image, TGAImage &zbuffer_image) {
+    Shader(pts, shader, image, zbuffer_image, TileRect(0, 0, image.get_width() - 1, image.get_height() - 1));
+}
 
-    Vec3f P;
+//光栅化+深度测试+片元着色的内循环，按着色器类型实例化
+//ShaderT为具体的着色器类(声明为final，或者fragment不是虚函数)时fragment直接调用，可以内联到循环里；
+//ShaderT为IShader时每个片元一次虚函数调用，即IShader::Shader(任意着色器都能用的动态分派路径)
+template <class ShaderT>
+void shade_triangle(Vec3f *pts, ShaderT &shader, TGAImage &image, TGAImage &zbuffer_image, const TileRect &clip, const Vec3f *bary = NULL, const float *w = NULL) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    if (stats) {
+        stats->triangles++;
+        stats->bboxPixels += (long long)(s.box.x1 - s.box.x0 + 1) * (s.box.y1 - s.box.y0 + 1);
+    }
+    PerspectiveSetup persp;
+    if (w) setup_perspective(s, w, persp);
     TGAColor color;
-    //遍历包围盒内的所有像素，根据重心坐标判断是否在三角形内部，如果在，就绘制这个像素，否则就忽略它
-    for (P.x = bboxMin.x; P.x <= bboxMax.x; P.x++) {
-        for (P.y = bboxMin.y; P.y <= bboxMax.y; P.y++) {
-            Vec3f baryCoord = barycentric(pts, P);
-            
-            float z_P = pts[0].z*baryCoord.x + pts[1].z*baryCoord.y + pts[2].z*baryCoord.z;   //计算当前像素的深度值
-            int frag_depth = std::max(0, std::min(255, static_cast<int>(z_P+.5)));  //将深度值转换为 0-255之间的整数
-           
-            //如果当前像素的深度值小于zbuffer中该像素的深度值，则更新该像素的深度值和颜色值，否则跳过
-            if (baryCoord.x < 0 || baryCoord.y < 0 || baryCoord.z < 0 || zbuffer_image.get(P.x, P.y)[0] > frag_depth) 
+    rasterize(s, [&](const RasterBlock& blk) {
+        const float *bc0 = blk.bc0, *bc1 = blk.bc1, *bc2 = blk.bc2;
+        float pc[3][RASTER_BLOCK];
+        if (w) {
+            perspective_bary(persp, blk.x, blk.y, pc[0], pc[1], pc[2]);
+            bc0 = pc[0], bc1 = pc[1], bc2 = pc[2];
+        }
+        int pass = 0;
+        for (int mask = blk.mask; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            int x = blk.x + i;
+            int frag_depth = std::max(0, std::min(255, static_cast<int>(blk.z[i]+.5)));  //将深度值转换为 0-255之间的整数
+
+            //如果当前像素的深度值小于zbuffer中该像素的深度值，则跳过
+            if (zbuffer_image.get(x, blk.y)[0] > frag_depth)
                 continue;
+            pass |= 1 << i;
 
             //调用片元着色器计算当前像素颜色
-            bool discard = shader.fragment(baryCoord, color);
+            Vec3f bc(bc0[i], bc1[i], bc2[i]);
+            if (bary) bc = bary[0] * bc.x + bary[1] * bc.y + bary[2] * bc.z;
+            bool discard = shader.fragment(bc, color);
             if (!discard) {
-                //zbufferImage
-                zbuffer_image.set(P.x, P.y, TGAColor(frag_depth));
-                image.set(P.x, P.y, color);
+                zbuffer_image.set(x, blk.y, TGAColor(frag_depth));
+                image.set(x, blk.y, color);
+                if (stats) render_stats->shade(x, blk.y);
+            } else if (stats) {
+                stats->fragmentsDiscarded++;
             }
         }
+        if (stats) {
+            stats->block(blk.mask, pass);
+            stats->fragmentsShaded += stats_popcount(pass);
+        }
+    });
+}
+
+void IShader::Shader(Vec3f *pts, IShader &shader, TGAImage &image, TGAImage &zbuffer_image, const TileRect &clip, const Vec3f *bary, const float *w) {
+    shade_triangle<IShader>(pts, shader, image, zbuffer_image, clip, bary, w);
+}
+
+//按2x2 quad组成的包着色：ShaderT需要提供 int fragment_packet(const RasterQuad& q, int mask, TGAColor* colors)，
+//一次算出mask中各通道的颜色写入colors[通道]，返回丢弃的通道掩码；q中8个通道的重心坐标已换算成相对于原三角形的(w非空时为透视正确的)，
+//没被覆盖的辅助通道也有值，可以用quad_ddx/quad_ddy求导数。深度测试和写入与shade_triangle相同，结果逐字节一致
+//zbuffer_image必须是GRAYSCALE格式
+template <class ShaderT>
+void shade_triangle_quads(Vec3f *pts, ShaderT &shader, TGAImage &image, TGAImage &zbuffer_image, const TileRect &clip, const Vec3f *bary = NULL, const float *w = NULL) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    if (stats) {
+        stats->triangles++;
+        stats->bboxPixels += (long long)(s.box.x1 - s.box.x0 + 1) * (s.box.y1 - s.box.y0 + 1);
     }
+    //深度(灰度)和颜色都按行指针直接读写，不经过TGAImage::get/set；包内的通道都在clip以内
+    unsigned char* zbuf = zbuffer_image.buffer();
+    unsigned char* cbuf = image.buffer();
+    const int zpitch = zbuffer_image.get_width(), cpitch = image.get_width(), cbpp = image.get_bytespp();
+    PerspectiveSetup persp;
+    if (w) setup_perspective(s, w, persp);
+    RasterQuad packet;
+    TGAColor colors[RASTER_BLOCK];
+    int frag_depth[RASTER_BLOCK];
+    rasterize_quads(s, s.box, [&](const RasterQuad& q) {
+        for (int i = 0; i < RASTER_BLOCK; i++)
+            frag_depth[i] = std::max(0, std::min(255, static_cast<int>(q.z[i]+.5)));
+        int pass = 0;
+        for (int mask = q.mask; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            if (zbuf[q.px(i) + q.py(i) * zpitch] <= frag_depth[i]) pass |= 1 << i;
+        }
+        if (stats) {
+            stats->coveredPixels += stats_popcount(q.mask);
+            stats->depthPass += stats_popcount(pass);
+            stats->depthFail += stats_popcount(q.mask) - stats_popcount(pass);
+            stats->fragmentsShaded += stats_popcount(pass);
+        }
+        if (!pass) return;
+
+        const RasterQuad* in = &q;
+        if (bary || w) {
+            packet = q;
+            if (w) perspective_bary(persp, q, packet.bc0, packet.bc1, packet.bc2);
+            for (int i = 0; bary && i < RASTER_BLOCK; i++) {
+                Vec3f bc = bary[0] * packet.bc0[i] + bary[1] * packet.bc1[i] + bary[2] * packet.bc2[i];
+                packet.bc0[i] = bc.x;
+                packet.bc1[i] = bc.y;
+                packet.bc2[i] = bc.z;
+            }
+            in = &packet;
+        }
+        int discard = shader.fragment_packet(*in, pass, colors);
+        if (stats) stats->fragmentsDiscarded += stats_popcount(pass & discard);
+        for (int mask = pass & ~discard; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            int x = q.px(i), y = q.py(i);
+            zbuf[x + y * zpitch] = (unsigned char)frag_depth[i];
+            memcpy(cbuf + (x + y * cpitch) * cbpp, colors[i].bgra, cbpp);
+            if (stats) render_stats->shade(x, y);
+        }
+    });
 }
 
 
 
 
-//高洛德着色器
-class GouraudShader : public IShader {
+//高洛德着色器(final：按具体类型调用时vertex和fragment都是静态分派)
+class GouraudShader final : public IShader {
 public:
    
     //根据传入的质心坐标，颜色，以及varying_intensity计算出当前像素的颜色
@@ -633,14 +1047,31 @@ public:
         return false;                              
     }
 
+    //packet着色：8个通道的光照强度插值和分级都是同样的逐通道算术，编译器可以向量化，结果与fragment相同
+    int fragment_packet(const RasterQuad& q, int mask, TGAColor* colors) {
+        float level[RASTER_BLOCK];
+        for (int i = 0; i < RASTER_BLOCK; i++) {
+            float intensity = varying_intensity.x * q.bc0[i] + varying_intensity.y * q.bc1[i] + varying_intensity.z * q.bc2[i];
+            level[i] = intensity > .85 ? 1 : intensity > .60 ? .80 : intensity > .45 ? .60 :
+                       intensity > .30 ? .45 : intensity > .15 ? .30 : 0;
+        }
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            colors[i] = TGAColor(255, 255, 255) * level[i];
+        }
+        return 0;
+    }
+
     
     //接受两个变量，(面序号，顶点序号)
-    virtual Vec3f vertex(int iface, int nthvert) {     //重写虚函数
+    virtual Vec4f vertex(int iface, int nthvert) {     //重写虚函数
+        //顶点处理阶段已经变换过的话直接按顶点索引取结果
+        if (transformed) return transformed->clip(model->face(iface)[nthvert]);
+
         //根据面序号和顶点序号读取模型对应顶点，并扩展为4维 
         Vec3f gl_Vertex = model->vert(iface, nthvert);   //模型顶点
-        //变换顶点坐标到屏幕坐标（视角矩阵*投影矩阵*变换矩阵*v）
-        Matrix vertex = viewport_  * projectionDivision(projection_ * view_ *  model_ * local2homo(gl_Vertex));
-        Vec3f result = homo2vertices(vertex);
+        //变换顶点坐标到裁剪空间（投影矩阵*视角矩阵*变换矩阵*v），裁剪之后再做透视除法和视口变换
+        Vec4f result = homo2vec4(projection_ * view_ *  model_ * local2homo(gl_Vertex));
 
         //计算光照强度（顶点法向量*光照方向）
         // Vec3f normal = proj<3>(embed<4>(model->normal(iface, nthvert))).normalize();
@@ -651,10 +1082,15 @@ public:
 
 
 public:
+    GouraudShader(const VertexStage* vertices = NULL) : transformed(vertices) {}
+
     //顶点着色器会将数据写入varying_intensity
     //片元着色器从varying_intensity中读取数据
     Vec3f varying_intensity; 
 
+    //顶点处理阶段的结果(变换矩阵为projection_*view_*model_)，为空时逐个顶点变换
+    const VertexStage* transformed;
+
 };
 
 
@@ -665,22 +1101,47 @@ void test_shader() {
     TGAImage         image(width, height, TGAImage::RGB);
     TGAImage zbuffer_image(width, height, TGAImage::GRAYSCALE);
 
+    //顶点处理阶段：每个顶点只变换一次
+    float mvp[16], viewport[16];
+    matrix2floats(projection_ * view_ * model_, mvp);
+    matrix2floats(viewport_, viewport);
+    Span<Vec3f> verts = model->verts();
+    VertexStage& vertices = vertex_stage;
+    vertices.set_transform(mvp, viewport);
+    vertices.process(verts.data(), verts.size());
+
     //实例化高洛德着色
-    GouraudShader gouraud_shader;
+    GouraudShader gouraud_shader(&vertices);
 
+    TileRect screen(0, 0, width - 1, height - 1);
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    if (stats) stats->faces += model->nfaces();
     for (int i=0; i<model->nfaces(); i++) {     //对于每个三角形
-        Vec3f screen_coords[3];
+        Span<int> face = model->face(i);
+        Vec4f clip_coords[3];
+        Vec3f projected[3];
         for (int j=0; j<3; j++) {
-            //通过顶点着色器读取模型顶点
-            //变换顶点坐标到屏幕坐标（视角矩阵*投影矩阵*变换矩阵*v） ***其实并不是真正的屏幕坐标，因为没有除以最后一个分量
-            //计算光照强度
-            screen_coords[j].x = static_cast<int>(gouraud_shader.vertex(i, j).x);
-            screen_coords[j].y = static_cast<int>(gouraud_shader.vertex(i, j).y);
-            screen_coords[j].z = gouraud_shader.vertex(i, j).z;
+            //通过顶点着色器取顶点的裁剪空间坐标，同时计算光照强度
+            clip_coords[j] = gouraud_shader.vertex(i, j);
+            projected[j] = vertices.screen(face[j]);
+        }
+        //裁剪，不需要裁剪的三角形直接使用顶点处理阶段算好的屏幕坐标
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped, projected);
+        if (stats && clipped) stats->facesClipped++;
+        for (int k = 0; k < ntris; k++) {
+            float w[3];
+            for (int j = 0; j < 3; j++) {
+                Vec3f& v = screen_coords[k * 3 + j];
+                v = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), v.z);
+                Vec3f& b = bary[k * 3 + j];
+                w[j] = clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z;
+            }
+            //绘制三角形，按GouraudShader实例化的内循环通过片元着色器对三角形着色
+            shade_triangle(&screen_coords[k * 3], gouraud_shader, image, zbuffer_image, screen, clipped ? &bary[k * 3] : NULL, w);
         }
-        //遍历完3个顶点，一个三角形光栅化完成
-        //绘制三角形，triangle内部通过片元着色器对三角形着色
-        gouraud_shader.Shader(screen_coords, gouraud_shader, image, zbuffer_image);
     }
 
     image.flip_vertically();
@@ -692,6 +1153,1922 @@ void test_shader() {
 
 
 
+//分块多线程渲染测试
+//三条渲染路径(zbuffer_triangle / zbuffer_texture_triangle / IShader::Shader)分别先串行渲染一遍作为参照，
+//再用不同线程数分块渲染，逐字节比较结果并输出加速比
+void test_tile_render() {
+    //准备三角形，与test_zbuffer_texture_model、test_shader中的做法相同
+    std::vector<Vec3f> pts;            //每3个为一个三角形的屏幕坐标
+    std::vector<Vec2f> uvs;
+    std::vector<float> intensities;
+    for (int i = 0; i < model->nfaces(); i++) {
+        Span<int> face = model->face(i);
+        Vec3f screen_coords[3];
+        Vec3f world_coords[3];
+        for (int j = 0; j < 3; j++) {
+            world_coords[j] = model->vert(face[j]);
+            screen_coords[j] = World2Screen(world_coords[j]);
+        }
+        Vec3f n = ((world_coords[2] - world_coords[0])^(world_coords[1] - world_coords[0]));
+        n.normalize();
+        float intensity = n * light_dir;
+        if (intensity > 0) {
+            for (int j = 0; j < 3; j++) {
+                pts.push_back(screen_coords[j]);
+                uvs.push_back(model->uv(i, j));
+            }
+            intensities.push_back(intensity);
+        }
+    }
+
+    //着色器路径：分块渲染时三角形不再按顶点着色器的顺序立即光栅化，所以每个三角形保存一份着色器(varying)
+    std::vector<Vec3f> shader_pts;
+    std::vector<Vec3f> shader_bary;
+    std::vector<float> shader_w;
+    std::vector<GouraudShader> shaders;
+    for (int i = 0; i < model->nfaces(); i++) {
+        GouraudShader gouraud_shader;
+        Vec4f clip_coords[3];
+        for (int j = 0; j < 3; j++) clip_coords[j] = gouraud_shader.vertex(i, j);
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped);
+        for (int k = 0; k < ntris * 3; k++) {
+            Vec3f& v = screen_coords[k];
+            shader_pts.push_back(Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), v.z));
+            shader_bary.push_back(bary[k]);
+            shader_w.push_back(clip_coords[0].w * bary[k].x + clip_coords[1].w * bary[k].y + clip_coords[2].w * bary[k].z);
+            if (k % 3 == 0) shaders.push_back(gouraud_shader);
+        }
+    }
+
+    TGAImage image(width, height, TGAImage::RGB);
+    TGAImage zbuffer_image(width, height, TGAImage::GRAYSCALE);
+    const char* names[3] = { "zbuffer", "texture", "shader" };
+
+    for (int path = 0; path < 3; path++) {
+        std::vector<Vec3f>& tri_pts = (path == 2 ? shader_pts : pts);
+        int ntris = (int)tri_pts.size() / 3;
+
+        auto clear = [&]() {
+            clearzbuffer();
+            image.clear();
+            zbuffer_image.clear();
+        };
+        auto raster = [&](int t, const TileRect& rect) {
+            float intensity = (path == 2 ? 0.f : intensities[t]);
+            if (path == 0)
+                zbuffer_triangle(&tri_pts[t * 3], zbuffer, image, TGAColor(intensity * 255, intensity * 255, intensity * 255, 255), rect);
+            else if (path == 1)
+                zbuffer_texture_triangle(&tri_pts[t * 3], &uvs[t * 3], zbuffer, image, intensity, rect);
+            else
+                shaders[t].Shader(&tri_pts[t * 3], shaders[t], image, zbuffer_image, rect, &shader_bary[t * 3], &shader_w[t * 3]);
+        };
+
+        //串行参照
+        const int repeats = 3;
+        double serial_ms = 1e30;
+        for (int r = 0; r < repeats; r++) {
+            clear();
+            auto start = std::chrono::steady_clock::now();
+            TileRect screen(0, 0, width - 1, height - 1);
+            for (int t = 0; t < ntris; t++) raster(t, screen);
+            serial_ms = std::min(serial_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        TGAImage reference = image;
+        TGAImage reference_depth = zbuffer_image;
+        std::vector<float> reference_z(zbuffer, zbuffer + width * height);
+        std::cout << "tile render [" << names[path] << "] " << ntris << " triangles, serial " << serial_ms << " ms" << std::endl;
+
+        //不同线程数的分块渲染
+        //至少测到4个线程，单核机器上也能检查多线程结果是否一致
+        int max_threads = std::max(4, ThreadPool::hardware_threads());
+        std::vector<int> thread_counts;
+        for (int n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+        thread_counts.push_back(max_threads);
+        for (size_t k = 0; k < thread_counts.size(); k++) {
+            ThreadPool pool(thread_counts[k]);
+            TileBinner binner(width, height, 64);
+            double tiled_ms = 1e30;
+            for (int r = 0; r < repeats; r++) {
+                clear();
+                auto start = std::chrono::steady_clock::now();
+                binner.clear();
+                for (int t = 0; t < ntris; t++) binner.bin(t, &tri_pts[t * 3]);
+                binner.render(pool, [&](int t, const TileRect& rect, int) { raster(t, rect); });
+                tiled_ms = std::min(tiled_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            int nbytes = width * height * image.get_bytespp();
+            bool identical = !memcmp(image.buffer(), reference.buffer(), nbytes)
+                          && !memcmp(zbuffer_image.buffer(), reference_depth.buffer(), width * height)
+                          && !memcmp(zbuffer, &reference_z[0], width * height * sizeof(float));
+            std::cout << "  threads " << thread_counts[k] << ": " << tiled_ms << " ms, speedup " << serial_ms / tiled_ms
+                      << "x, " << (identical ? "identical" : "MISMATCH") << std::endl;
+        }
+
+        if (path == 1) {
+            image.flip_vertically();
+            image.write_tga_file("tile_render.tga");
+        }
+    }
+}
+
+
+
+
+
+//层次z缓冲测试：同一场景分别关闭/打开层次z缓冲渲染，比较结果并输出剔除掉的像素数
+void test_hiz() {
+    Model body("../obj/boggie/body.obj");   //自遮挡较多的模型
+    const char* names[2] = { "african_head (texture)", "boggie body (zbuffer)" };
+
+    for (int m = 0; m < 2; m++) {
+        Model* mesh = (m == 0 ? model : &body);
+        std::vector<Vec3f> pts;
+        std::vector<Vec2f> uvs;
+        std::vector<float> intensities;
+        for (int i = 0; i < mesh->nfaces(); i++) {
+            Vec3f world_coords[3];
+            for (int j = 0; j < 3; j++) {
+                world_coords[j] = mesh->vert(i, j);
+                pts.push_back(World2Screen(world_coords[j]));
+                uvs.push_back(mesh->uv(i, j));
+            }
+            Vec3f n = ((world_coords[2] - world_coords[0])^(world_coords[1] - world_coords[0]));
+            n.normalize();
+            intensities.push_back(n * light_dir);
+        }
+
+        TGAImage images[2] = { TGAImage(width, height, TGAImage::RGB), TGAImage(width, height, TGAImage::RGB) };
+        double ms[2];
+        for (int enabled = 0; enabled < 2; enabled++) {
+            hiz.set_enabled(enabled == 1);
+            hiz.reset_counters();
+            clearzbuffer();
+            auto start = std::chrono::steady_clock::now();
+            for (int t = 0; t < (int)intensities.size(); t++) {
+                float intensity = intensities[t];
+                if (intensity <= 0) continue;
+                if (m == 0)
+                    zbuffer_texture_triangle(&pts[t * 3], &uvs[t * 3], zbuffer, images[enabled], intensity);
+                else
+                    zbuffer_triangle(&pts[t * 3], zbuffer, images[enabled], TGAColor(intensity * 255, intensity * 255, intensity * 255, 255));
+            }
+            ms[enabled] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        bool identical = !memcmp(images[0].buffer(), images[1].buffer(), width * height * images[0].get_bytespp());
+        std::cout << "hiz [" << names[m] << "] off " << ms[0] << " ms, on " << ms[1] << " ms, "
+                  << (identical ? "identical" : "MISMATCH") << std::endl;
+        std::cout << "  skipped pixels " << hiz.skipped_pixels() << ", rejected 8x8 tiles " << hiz.rejected_tiles()
+                  << ", rejected triangles " << hiz.rejected_triangles() << std::endl;
+    }
+    hiz.set_enabled(false);
+}
+
+
+
+
+//纹理着色器：漫反射纹理*面片光照强度，与render_perspective中zbuffer_texture_triangle的结果相同
+class TextureShader : public IShader {
+public:
+    mat<4, 4> mvp;             //模型到裁剪空间的变换
+    Vec2f varying_uv[3];       //三个顶点的纹理坐标
+    Vec3f world_coords[3];
+    float intensity;           //面片光照强度，在第三个顶点处计算
+
+    TextureShader(const mat<4, 4>& m) : mvp(m), intensity(0) {}
+
+    virtual Vec4f vertex(int iface, int nthvert) {
+        world_coords[nthvert] = model->vert(iface, nthvert);
+        varying_uv[nthvert] = model->uv(iface, nthvert);
+        if (nthvert == 2) {
+            Vec3f normal = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
+            normal.normalize();
+            intensity = normal * light_dir;
+        }
+        return homo2vec4(mvp * local2homo(world_coords[nthvert]));
+    }
+
+    virtual bool fragment(Vec3f barycoord, TGAColor &color) {
+        Vec2f uv = varying_uv[0] * barycoord.x + varying_uv[1] * barycoord.y + varying_uv[2] * barycoord.z;
+        color = model->diffuse(uv) * intensity;
+        return false;
+    }
+};
+
+
+//纹理着色器的packet版本：用quad内纹理坐标的差分(屏幕空间导数)选mip层做三线性过滤，缩小绘制时不再走样；
+//逐像素的fragment没有导数可用，只能在第0层双线性采样
+class MipTextureShader final : public TextureShader {
+    static TGAColor texel_color(const Vec4f& c) {
+        return TGAColor((unsigned char)(c.z + 0.5f), (unsigned char)(c.y + 0.5f), (unsigned char)(c.x + 0.5f));
+    }
+
+public:
+    MipTextureShader(const mat<4, 4>& m) : TextureShader(m), fixedLod(-1) {}
+
+    //>= 0时逐像素和按包着色都在这个mip层级上三线性采样，两者的结果应该逐字节相同，用来检查包着色的通道和重心坐标
+    float fixedLod;
+
+    virtual bool fragment(Vec3f barycoord, TGAColor &color) {
+        Vec2f uv = varying_uv[0] * barycoord.x + varying_uv[1] * barycoord.y + varying_uv[2] * barycoord.z;
+        if (fixedLod >= 0) color = texel_color(model->diffuse_map().sample(uv, FILTER_TRILINEAR, fixedLod)) * intensity;
+        else color = texel_color(model->diffuse_map().sample(uv, FILTER_BILINEAR, 0)) * intensity;
+        return false;
+    }
+
+    int fragment_packet(const RasterQuad& q, int mask, TGAColor* colors) {
+        float u[RASTER_BLOCK], v[RASTER_BLOCK];
+        for (int i = 0; i < RASTER_BLOCK; i++) {
+            u[i] = varying_uv[0].x * q.bc0[i] + varying_uv[1].x * q.bc1[i] + varying_uv[2].x * q.bc2[i];
+            v[i] = varying_uv[0].y * q.bc0[i] + varying_uv[1].y * q.bc1[i] + varying_uv[2].y * q.bc2[i];
+        }
+        const Texture& texture = model->diffuse_map();
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            if (fixedLod >= 0) {
+                colors[i] = texel_color(texture.sample(Vec2f(u[i], v[i]), FILTER_TRILINEAR, fixedLod)) * intensity;
+                continue;
+            }
+            Vec2f duvdx(quad_ddx(u, i), quad_ddx(v, i)), duvdy(quad_ddy(u, i), quad_ddy(v, i));
+            colors[i] = texel_color(texture.sample(Vec2f(u[i], v[i]), duvdx, duvdy, FILTER_TRILINEAR)) * intensity;
+        }
+        return 0;
+    }
+};
+
+
+
+
+//可见性缓冲测试：与render_perspective同一场景，先分块光栅化出三角形编号和重心坐标，再每个像素只着色一次
+//与直接着色的结果比较，并输出两个阶段的耗时和省掉的重复着色(overdraw)倍数
+void test_visibility_buffer() {
+    TextureShader shader(projection_ * view_ * model_ * camera_);
+
+    //顶点阶段和裁剪，子三角形记下所属面片和相对于面片的重心坐标
+    std::vector<Vec3f> pts;
+    std::vector<Vec3f> bary;
+    std::vector<float> ws;
+    std::vector<int> faces;
+    for (int i = 0; i < model->nfaces(); i++) {
+        Vec4f clip_coords[3];
+        for (int j = 0; j < 3; j++) clip_coords[j] = shader.vertex(i, j);
+        if (shader.intensity <= 0) continue;
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f sub_bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, sub_bary, clipped);
+        for (int k = 0; k < ntris * 3; k++) {
+            Vec3f& v = screen_coords[k];
+            Vec3f& b = sub_bary[k];
+            pts.push_back(Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), static_cast<int>(v.z)));
+            bary.push_back(b);
+            ws.push_back(clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z);
+            if (k % 3 == 0) faces.push_back(i);
+        }
+    }
+    int ntris = (int)faces.size();
+
+    //直接着色作为参照
+    clearzbuffer();
+    TGAImage reference(width, height, TGAImage::RGB);
+    auto start = std::chrono::steady_clock::now();
+    render_perspective(camera_, reference);
+    double forward_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ThreadPool pool(ThreadPool::hardware_threads());
+    TileBinner binner(width, height, 64);
+    VisibilityBuffer vb(width, height);
+    TGAImage image(width, height, TGAImage::RGB);
+
+    start = std::chrono::steady_clock::now();
+    vb.clear();
+    binner.clear();
+    for (int t = 0; t < ntris; t++) binner.bin(t, &pts[t * 3]);
+    binner.render(pool, [&](int t, const TileRect& rect, int) { vb.rasterize(faces[t], &pts[t * 3], rect, &bary[t * 3], &ws[t * 3]); });
+    auto mid = std::chrono::steady_clock::now();
+    vb.shade(shader, image, pool);
+    auto end = std::chrono::steady_clock::now();
+    double raster_ms = std::chrono::duration<double, std::milli>(mid - start).count();
+    double shade_ms = std::chrono::duration<double, std::milli>(end - mid).count();
+
+    long long passes = vb.depth_passes(), shaded = vb.covered_pixels();
+    int nbytes = width * height * image.get_bytespp();
+    int diff = 0;
+    for (int k = 0; k < nbytes; k++) diff += image.buffer()[k] != reference.buffer()[k];
+    std::cout << "visibility buffer (" << pool.size() << " threads): forward " << forward_ms << " ms, visibility "
+              << raster_ms << " + " << shade_ms << " ms, " << diff << " bytes differ from forward" << std::endl;
+    std::cout << "  fragments passing depth test " << passes << ", shaded pixels " << shaded
+              << ", overdraw factor " << (shaded ? (double)passes / shaded : 0.) << std::endl;
+
+    image.flip_vertically();
+    image.write_tga_file("visibility_buffer.tga");
+}
+
+
+
+
+//定长矩阵测试：把变换链 viewport*透视除法(projection*view*model*camera*v) 分别用原来的Matrix(堆分配)和mat<4,4>计算，
+//比较结果和耗时，并检查求逆
+Matrix toMatrix(const mat<4, 4>& m) {
+    Matrix r(4, 4);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            r[i][j] = m[i][j];
+    return r;
+}
+
+void test_matrix() {
+    Matrix model_m = toMatrix(model_), view_m = toMatrix(view_), projection_m = toMatrix(projection_);
+    Matrix viewport_m = toMatrix(viewport_), camera_m = toMatrix(camera_);
+    int nverts = model->nverts();
+
+    std::vector<Vec3f> reference(nverts);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nverts; i++) {
+        Vec3f v = model->vert(i);
+        Matrix h(4, 1);
+        h[0][0] = v.x; h[1][0] = v.y; h[2][0] = v.z; h[3][0] = 1.0f;
+        Matrix p = projection_m * view_m * model_m * camera_m * h;
+        for (int k = 0; k < 3; k++) p[k][0] = p[k][0] / p[3][0];
+        p[3][0] = 1.0f;
+        Matrix r = viewport_m * p;
+        reference[i] = Vec3f(r[0][0], r[1][0], r[2][0]);
+    }
+    double matrix_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<Vec3f> result(nverts);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nverts; i++)
+        result[i] = homo2vertices(viewport_ * projectionDivision(projection_ * view_ * model_ * camera_ * local2homo(model->vert(i))));
+    double mat_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    //原来的Matrix相机矩阵(Vec3f::normalize和std::sqrt)与constexpr构造的相机矩阵是否一致
+    Vec3f z = (cameraPos - centerPos).normalize();
+    Vec3f x = (Vec3f(up) ^ z).normalize();
+    Vec3f y = (z ^ x).normalize();
+    Matrix rotation = Matrix::identity(4), translation = Matrix::identity(4);
+    for (int i = 0; i < 3; i++) {
+        translation[i][3] = -Vec3f(cameraPos)[i];
+        rotation[0][i] = x[i];
+        rotation[1][i] = y[i];
+        rotation[2][i] = z[i];
+    }
+    Matrix camera_ref = rotation * translation;
+    int camera_mismatch = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) camera_mismatch += camera_ref[i][j] != camera_[i][j];
+
+    int mismatches = 0;
+    for (int i = 0; i < nverts; i++) mismatches += memcmp(&reference[i], &result[i], sizeof(Vec3f)) != 0;
+    std::cout << "matrix: " << nverts << " vertices, Matrix " << matrix_ms << " ms, mat<4,4> " << mat_ms << " ms, speedup "
+              << matrix_ms / mat_ms << "x, " << (mismatches || camera_mismatch ? "MISMATCH" : "identical") << std::endl;
+
+    //求逆：M*M^-1与单位矩阵的最大误差
+    mat<4, 4> mvp = viewport_ * projection_ * view_ * model_ * camera_;
+    mat<4, 4> product = mvp * mvp.inverse();
+    float err = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) err = std::max(err, std::abs(product[i][j] - (i == j)));
+    std::cout << "  inverse: max |M*inv(M) - I| = " << err << std::endl;
+}
+
+
+
+
+//透视正确插值测试：相机靠近模型(与test_clipping的近景相同)，三角形装配一次存下来，
+//分别按屏幕空间的重心坐标(仿射)和按1/w平面方程得到的透视正确重心坐标插值纹理坐标，比较耗时和不同的像素数
+void test_perspective_correct() {
+    Vec3f closePos(0.1f, 0.05f, 0.2f);
+    mat<4, 4> camera = cameraMatrix(closePos, centerPos, up);
+    mat<4, 4> projection = projectionMatrix(-1.0f / (closePos - centerPos).norm());
+    struct Tri { Vec3f pts[3]; Vec2f uvs[3]; float w[3]; float intensity; };
+    std::vector<Tri> tris;
+    assemble_perspective(camera, projection, [&](Vec3f* pts, Vec2f* uvs, float intensity, const float* w) {
+        Tri t;
+        for (int j = 0; j < 3; j++) { t.pts[j] = pts[j]; t.uvs[j] = uvs[j]; t.w[j] = w[j]; }
+        t.intensity = intensity;
+        tris.push_back(t);
+    });
+    model->wait_textures();
+
+    const char* names[2] = { "affine", "perspective-correct" };
+    TGAImage images[2] = { TGAImage(width, height, TGAImage::RGB), TGAImage(width, height, TGAImage::RGB) };
+    double ms[2] = { 1e30, 1e30 };
+    for (int r = 0; r < 5; r++) {
+        for (int m = 0; m < 2; m++) {
+            clearzbuffer();
+            images[m].clear();
+            auto start = std::chrono::steady_clock::now();
+            for (Tri& t : tris) zbuffer_texture_triangle(t.pts, t.uvs, zbuffer, images[m], t.intensity, m == 0 ? NULL : t.w);
+            ms[m] = std::min(ms[m], std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    int diff = 0, covered = 0;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            TGAColor a = images[0].get(x, y), b = images[1].get(x, y);
+            diff += memcmp(a.bgra, b.bgra, 3) != 0;
+            covered += zbuffer[x + y * width] > -std::numeric_limits<float>::max();
+        }
+    std::cout << "perspective-correct interpolation (camera close to mesh, " << tris.size() << " triangles): "
+              << names[0] << " " << ms[0] << " ms, " << names[1] << " " << ms[1] << " ms (" << ms[1] / ms[0] << "x)" << std::endl;
+    std::cout << "  " << diff << " of " << covered << " covered pixels differ" << std::endl;
+    for (int m = 0; m < 2; m++) {
+        images[m].flip_vertically();
+        images[m].write_tga_file(m == 0 ? "perspective_affine.tga" : "perspective_correct.tga");
+    }
+}
+
+
+
+
+//test_shader中的三角形装配(顶点着色、裁剪、顶点坐标取整)，存下来供着色器的对比测试反复光栅化
+//vertices为顶点处理阶段(变换矩阵为projection_*view_*model_)，gouraud_shader按它取顶点
+//intensity为原面片三个顶点按顶点法线算的光照强度，着色前赋给GouraudShader::varying_intensity(子三角形的bary相对于原面片)
+struct ShaderTri { Vec3f pts[3]; Vec3f bary[3]; float w[3]; Vec3f intensity; bool clipped; };
+void assemble_shader_triangles(GouraudShader& gouraud_shader, VertexStage& vertices, std::vector<ShaderTri>& tris) {
+    float mvp[16], viewport[16];
+    matrix2floats(projection_ * view_ * model_, mvp);
+    matrix2floats(viewport_, viewport);
+    Span<Vec3f> verts = model->verts();
+    vertices.set_transform(mvp, viewport);
+    vertices.process(verts.data(), verts.size());
+    tris.clear();
+    for (int i = 0; i < model->nfaces(); i++) {
+        Span<int> face = model->face(i);
+        Vec4f clip_coords[3];
+        Vec3f projected[3];
+        Vec3f intensity;
+        for (int j = 0; j < 3; j++) {
+            clip_coords[j] = gouraud_shader.vertex(i, j);
+            projected[j] = vertices.screen(face[j]);
+            intensity[j] = std::max(0.f, -(model->normal(i, j) * light_dir));
+        }
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped, projected);
+        for (int k = 0; k < ntris; k++) {
+            ShaderTri t;
+            for (int j = 0; j < 3; j++) {
+                const Vec3f& v = screen_coords[k * 3 + j];
+                const Vec3f& b = bary[k * 3 + j];
+                t.pts[j] = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), v.z);
+                t.bary[j] = b;
+                t.w[j] = clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z;
+            }
+            t.intensity = intensity;
+            t.clipped = clipped;
+            tris.push_back(t);
+        }
+    }
+}
+
+
+
+
+//quad包着色测试：与test_shader同一组三角形(带逐顶点光照强度)，GouraudShader分别逐像素(shade_triangle)和按quad包(shade_triangle_quads)着色，
+//比较耗时并检查结果逐字节相同且画面不是全黑，给出包内被覆盖通道的比例；
+//再用MipTextureShader在128x128下渲染，逐像素只能在第0层双线性采样，按包着色时用quad导数选mip层做三线性过滤；
+//最后两条路径都固定在同一个mip层级上采样，按包着色的结果应该与逐像素的参照逐字节相同
+void test_quad_shading() {
+    GouraudShader gouraud_shader(&vertex_stage);
+    std::vector<ShaderTri> tris;
+    assemble_shader_triangles(gouraud_shader, vertex_stage, tris);
+
+    TGAImage images[2] = { TGAImage(width, height, TGAImage::RGB), TGAImage(width, height, TGAImage::RGB) };
+    TGAImage depths[2] = { TGAImage(width, height, TGAImage::GRAYSCALE), TGAImage(width, height, TGAImage::GRAYSCALE) };
+    TileRect screen(0, 0, width - 1, height - 1);
+    //两种方式交替计时，减少机器负载波动的影响
+    double ms[2] = { 1e30, 1e30 };
+    for (int r = 0; r < 7; r++) {
+        for (int m = 0; m < 2; m++) {
+            images[m].clear();
+            depths[m].clear();
+            auto start = std::chrono::steady_clock::now();
+            for (ShaderTri& t : tris) {
+                const Vec3f* bary = t.clipped ? t.bary : NULL;
+                gouraud_shader.varying_intensity = t.intensity;
+                if (m == 0) shade_triangle(t.pts, gouraud_shader, images[m], depths[m], screen, bary, t.w);
+                else shade_triangle_quads(t.pts, gouraud_shader, images[m], depths[m], screen, bary, t.w);
+            }
+            ms[m] = std::min(ms[m], std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    int lit = lit_pixels(images[1]);
+    bool identical = !memcmp(images[0].buffer(), images[1].buffer(), width * height * images[0].get_bytespp()) &&
+                     !memcmp(depths[0].buffer(), depths[1].buffer(), width * height * depths[0].get_bytespp());
+    long long packets = 0, lanes = 0;
+    for (ShaderTri& t : tris) {
+        EdgeSetup s;
+        if (!setup_triangle(t.pts, screen, s)) continue;
+        rasterize_quads(s, s.box, [&](const RasterQuad& q) {
+            packets++;
+            lanes += stats_popcount(q.mask);
+        });
+    }
+    std::cout << "quad shading [GouraudShader] per pixel " << ms[0] << " ms, 2x2 quad packets " << ms[1] << " ms ("
+              << ms[0] / ms[1] << "x), " << (identical ? "identical" : "MISMATCH") << ", " << lit << " lit pixels"
+              << (lit ? "" : " (EMPTY FRAME)") << "; " << packets << " packets, "
+              << 100.0 * lanes / (packets * RASTER_BLOCK) << "% of lanes covered" << std::endl;
+
+    //缩小绘制：按quad导数选mip层
+    const int size = 128;
+    mat<4, 4> viewport = viewportMatrix(0, 0, size, size);
+    ClipParams params = ClipParams::guard_band(size, size, 4096);
+    TileRect rect(0, 0, size - 1, size - 1);
+    MipTextureShader shader(projection_ * view_ * model_ * camera_);
+    model->wait_textures();
+    auto draw = [&](bool quads, TGAImage& image, TGAImage& depth) {
+        for (int i = 0; i < model->nfaces(); i++) {
+            Vec4f clip_coords[3];
+            for (int j = 0; j < 3; j++) clip_coords[j] = shader.vertex(i, j);
+            if (shader.intensity <= 0) continue;
+            Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+            Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+            bool clipped;
+            int ntris = clip_project(params, viewport, clip_coords, screen_coords, bary, clipped);
+            for (int k = 0; k < ntris; k++) {
+                float w[3];
+                for (int j = 0; j < 3; j++) {
+                    Vec3f& v = screen_coords[k * 3 + j];
+                    v = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), v.z);
+                    Vec3f& c = bary[k * 3 + j];
+                    w[j] = clip_coords[0].w * c.x + clip_coords[1].w * c.y + clip_coords[2].w * c.z;
+                }
+                const Vec3f* b = clipped ? &bary[k * 3] : NULL;
+                if (!quads) shade_triangle(&screen_coords[k * 3], shader, image, depth, rect, b, w);
+                else shade_triangle_quads(&screen_coords[k * 3], shader, image, depth, rect, b, w);
+            }
+        }
+    };
+    for (int m = 0; m < 2; m++) {
+        TGAImage image(size, size, TGAImage::RGB), depth(size, size, TGAImage::GRAYSCALE);
+        auto start = std::chrono::steady_clock::now();
+        draw(m == 1, image, depth);
+        double t = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << size << "x" << size << " MipTextureShader " << (m == 0 ? "per pixel (bilinear, level 0) " : "quads (trilinear, quad derivatives) ")
+                  << t << " ms" << std::endl;
+        image.flip_vertically();
+        image.write_tga_file(m == 0 ? "quad_bilinear_128.tga" : "quad_trilinear_128.tga");
+    }
+
+    //固定在1.5层(第1、2层之间三线性)：每个通道的uv和逐像素的参照应该完全一样
+    shader.fixedLod = 1.5f;
+    TGAImage fixedImages[2] = { TGAImage(size, size, TGAImage::RGB), TGAImage(size, size, TGAImage::RGB) };
+    TGAImage fixedDepths[2] = { TGAImage(size, size, TGAImage::GRAYSCALE), TGAImage(size, size, TGAImage::GRAYSCALE) };
+    for (int m = 0; m < 2; m++) draw(m == 1, fixedImages[m], fixedDepths[m]);
+    int fixedLit = lit_pixels(fixedImages[1]);
+    bool fixedSame = !memcmp(fixedImages[0].buffer(), fixedImages[1].buffer(), size * size * fixedImages[0].get_bytespp()) &&
+                     !memcmp(fixedDepths[0].buffer(), fixedDepths[1].buffer(), size * size * fixedDepths[0].get_bytespp());
+    std::cout << "  " << size << "x" << size << " MipTextureShader at fixed lod " << shader.fixedLod << ": quads vs per pixel "
+              << (fixedSame ? "identical" : "MISMATCH") << ", " << fixedLit << " lit pixels" << (fixedLit ? "" : " (EMPTY FRAME)") << std::endl;
+}
+
+
+
+
+//着色器分派测试：与test_shader同一组三角形(带逐顶点光照强度)，分别通过IShader::Shader(每个片元一次虚函数调用)
+//和按GouraudShader实例化的shade_triangle(fragment内联)渲染，比较耗时，检查两者的颜色和深度图逐字节相同且画面不是全黑
+void test_shader_dispatch() {
+    GouraudShader gouraud_shader(&vertex_stage);
+    //三角形装配一次存下来，计时只包括光栅化和着色
+    std::vector<ShaderTri> tris;
+    assemble_shader_triangles(gouraud_shader, vertex_stage, tris);
+
+    const char* names[2] = { "virtual", "static" };
+    TGAImage images[2] = { TGAImage(width, height, TGAImage::RGB), TGAImage(width, height, TGAImage::RGB) };
+    TGAImage depths[2] = { TGAImage(width, height, TGAImage::GRAYSCALE), TGAImage(width, height, TGAImage::GRAYSCALE) };
+    TileRect screen(0, 0, width - 1, height - 1);
+    IShader& dynamic_shader = gouraud_shader;
+    //两种方式交替计时，减少机器负载波动的影响
+    double ms[2] = { 1e30, 1e30 };
+    for (int r = 0; r < 7; r++) {
+        for (int m = 0; m < 2; m++) {
+            images[m].clear();
+            depths[m].clear();
+            auto start = std::chrono::steady_clock::now();
+            for (ShaderTri& t : tris) {
+                const Vec3f* bary = t.clipped ? t.bary : NULL;
+                gouraud_shader.varying_intensity = t.intensity;
+                if (m == 0) dynamic_shader.Shader(t.pts, dynamic_shader, images[m], depths[m], screen, bary, t.w);
+                else shade_triangle(t.pts, gouraud_shader, images[m], depths[m], screen, bary, t.w);
+            }
+            ms[m] = std::min(ms[m], std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    int lit = lit_pixels(images[1]);
+    bool identical = !memcmp(images[0].buffer(), images[1].buffer(), width * height * images[0].get_bytespp()) &&
+                     !memcmp(depths[0].buffer(), depths[1].buffer(), width * height * depths[0].get_bytespp());
+    std::cout << "shader dispatch [GouraudShader] " << tris.size() << " triangles: " << names[0] << " " << ms[0] << " ms, "
+              << names[1] << " " << ms[1] << " ms (" << ms[0] / ms[1] << "x), " << (identical ? "identical" : "MISMATCH") << ", "
+              << lit << " lit pixels" << (lit ? "" : " (EMPTY FRAME)") << std::endl;
+}
+
+
+
+
+//阴影图的光源：平行光，相机放在centerPos沿toLight方向2个单位处看向centerPos，正交投影
+//x、y缩放0.8，z(相机空间中模型大致在-3..-1)映射到-0.5..0.5，整个模型([-1,1]^3)都在裁剪空间内
+mat<4, 4> lightMatrix(const Vec3f& toLight) {
+    Vec3f dir = toLight;
+    dir.normalize();
+    mat<4, 4> ortho = mat<4, 4>::identity();
+    ortho[0][0] = ortho[1][1] = 0.8f;
+    ortho[2][2] = 0.5f;
+    ortho[2][3] = 1.f;
+    return ortho * view_ * model_ * cameraMatrix(dir * 2.f, centerPos, up);
+}
+
+//阴影pass：从光源方向把模型的所有面片只画深度到sm中(不按光照剔除，背光的面片也会挡住别的面片)
+//顶点变换的结果留在stage中，着色时用来取顶点在阴影图中的坐标；屏幕坐标的z不取整，比相机pass的深度精确
+void render_shadow_map(const mat<4, 4>& light, ShadowMap& sm, VertexStage& stage) {
+    const int size = sm.size();
+    mat<4, 4> viewport = viewportMatrix(0, 0, size, size);
+    float mvp[16], vp[16];
+    matrix2floats(light, mvp);
+    matrix2floats(viewport, vp);
+    Span<Vec3f> verts = model->verts();
+    stage.set_transform(mvp, vp);
+    stage.process(verts.data(), verts.size());
+
+    ClipParams params = ClipParams::guard_band(size, size, 4096);
+    TileRect rect(0, 0, size - 1, size - 1);
+    sm.clear();
+    for (int i = 0; i < model->nfaces(); i++) {
+        Span<int> face = model->face(i);
+        Vec4f clip_coords[3];
+        Vec3f projected[3];
+        for (int j = 0; j < 3; j++) {
+            clip_coords[j] = stage.clip(face[j]);
+            projected[j] = stage.screen(face[j]);
+        }
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(params, viewport, clip_coords, screen_coords, bary, clipped, projected);
+        for (int k = 0; k < ntris; k++) depth_triangle(&screen_coords[k * 3], sm.data(), size, rect);
+    }
+}
+
+//阴影的环境光比例，以及比较深度时的偏移(阴影图的深度单位)：常数项加上随面片相对光线的斜率增大的一项，
+//斜率越大，相邻texel之间表面的深度差越大，PCF取到的邻近texel越容易误判成遮挡
+const float SHADOW_AMBIENT = 0.2f;
+float shadow_bias(float ndotl) {
+    float tangent = std::sqrt(std::max(0.f, 1 - ndotl * ndotl)) / std::max(ndotl, 0.1f);
+    return 0.05f + 0.3f * tangent;
+}
+
+//带阴影的纹理三角形：lpts为三个顶点在阴影图中的坐标，与uv一样按w(三个顶点的裁剪空间w)透视正确地插值
+//ndotl为面片朝外的单位法线与指向光源方向的点积，背光的面片只有环境光，受光的面片按PCF得到的照亮比例缩放漫反射
+void shadow_texture_triangle(Vec3f *pts, Vec2f* uvs, Vec3f* lpts, const float* w, float ndotl, const ShadowMap& sm, float *zbuffer, TGAImage &image) {
+    RenderCounters* stats = render_stats ? &render_stats->local() : NULL;
+    EdgeSetup s;
+    if (!setup_triangle(pts, TileRect(0, 0, image.get_width() - 1, image.get_height() - 1), s)) {
+        if (stats) stats->trianglesRejected++;
+        return;
+    }
+    if (stats) {
+        stats->triangles++;
+        stats->bboxPixels += (long long)(s.box.x1 - s.box.x0 + 1) * (s.box.y1 - s.box.y0 + 1);
+    }
+    float bias = shadow_bias(ndotl);
+    PerspectiveSetup persp;
+    setup_perspective(s, w, persp);
+    rasterize(s, [&](const RasterBlock& blk) {
+        float* zrow = zbuffer + blk.x + blk.y * width;
+        int mask = depth_test(blk, zrow);
+        if (stats) {
+            stats->block(blk.mask, mask);
+            stats->fragmentsShaded += stats_popcount(mask);
+        }
+        if (!mask) return;
+        float bc0[RASTER_BLOCK], bc1[RASTER_BLOCK], bc2[RASTER_BLOCK];
+        perspective_bary(persp, blk.x, blk.y, bc0, bc1, bc2);
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            Vec2f uvP = uvs[0]*bc0[i] + uvs[1]*bc1[i] + uvs[2]*bc2[i];
+            float lit = 0;
+            if (ndotl > 0) {
+                Vec3f l = lpts[0]*bc0[i] + lpts[1]*bc1[i] + lpts[2]*bc2[i];
+                lit = sm.pcf(l.x, l.y, l.z, bias);
+            }
+            zrow[i] = blk.z[i];
+            image.set(blk.x + i, blk.y, model->diffuse(uvP) * (SHADOW_AMBIENT + (1 - SHADOW_AMBIENT) * ndotl * lit));
+            if (stats) render_stats->shade(blk.x + i, blk.y);
+        }
+    });
+}
+
+//带阴影的透视投影渲染：光源方向为toLight，sm和lightStage为render_shadow_map的结果
+//相机pass不按光照剔除面片(背光面也可见)，可见性全部交给深度测试；顶点坐标与assemble_perspective一样取整
+void render_shadowed(const mat<4, 4>& camera, TGAImage &image, const Vec3f& toLight, const ShadowMap& sm,
+                     const VertexStage& lightStage, const mat<4, 4>& projection = projection_) {
+    float mvp[16], viewport[16];
+    matrix2floats(projection * view_ * model_ * camera, mvp);
+    matrix2floats(viewport_, viewport);
+    Span<Vec3f> verts = model->verts();
+    vertex_stage.set_transform(mvp, viewport);
+    vertex_stage.process(verts.data(), verts.size());
+    Vec3f dir = toLight;
+    dir.normalize();
+
+    for (int i = 0; i < model->nfaces(); i++) {
+        Span<int> face = model->face(i);
+        Vec4f clip_coords[3];
+        Vec3f projected[3], light_coords[3];
+        for (int j = 0; j < 3; j++) {
+            clip_coords[j] = vertex_stage.clip(face[j]);
+            projected[j] = vertex_stage.screen(face[j]);
+            light_coords[j] = lightStage.screen(face[j]);
+        }
+        Vec3f normal = (verts[face[1]] - verts[face[0]]) ^ (verts[face[2]] - verts[face[0]]);
+        normal.normalize();
+        float ndotl = normal * dir;
+
+        Vec2f uv[3];
+        for (int j = 0; j < 3; j++) uv[j] = model->uv(i, j);
+        Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+        Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+        bool clipped;
+        int ntris = clip_project(clip_coords, screen_coords, bary, clipped, projected);
+        for (int k = 0; k < ntris; k++) {
+            Vec2f sub_uv[3];
+            Vec3f sub_light[3];
+            float sub_w[3];
+            for (int j = 0; j < 3; j++) {
+                Vec3f& v = screen_coords[k * 3 + j];
+                v = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), static_cast<int>(v.z));
+                Vec3f& b = bary[k * 3 + j];
+                sub_uv[j] = uv[0] * b.x + uv[1] * b.y + uv[2] * b.z;
+                sub_light[j] = light_coords[0] * b.x + light_coords[1] * b.y + light_coords[2] * b.z;
+                sub_w[j] = clip_coords[0].w * b.x + clip_coords[1].w * b.y + clip_coords[2].w * b.z;
+            }
+            shadow_texture_triangle(&screen_coords[k * 3], sub_uv, sub_light, sub_w, ndotl, sm, zbuffer, image);
+        }
+    }
+}
+
+//只写深度的光栅化和阴影图测试：
+//先把render_perspective的三角形装配一次存下来，比较完整的着色pass(zbuffer_texture_triangle)和只写深度的pass(depth_triangle)的耗时，
+//两者的深度缓冲应该逐位相同；再从斜上方的平行光画1024x1024的阴影图，输出阴影pass的耗时和带PCF阴影的渲染结果
+void test_shadow() {
+    struct Tri { Vec3f pts[3]; Vec2f uvs[3]; float w[3]; float intensity; };
+    std::vector<Tri> tris;
+    assemble_perspective(camera_, projection_, [&](Vec3f* pts, Vec2f* uvs, float intensity, const float* w) {
+        Tri t;
+        for (int j = 0; j < 3; j++) { t.pts[j] = pts[j]; t.uvs[j] = uvs[j]; t.w[j] = w[j]; }
+        t.intensity = intensity;
+        tris.push_back(t);
+    });
+    model->wait_textures();
+
+    TGAImage image(width, height, TGAImage::RGB);
+    TileRect screen(0, 0, width - 1, height - 1);
+    std::vector<float> colorDepth;
+    double colorBest = 1e30, depthBest = 1e30;
+    for (int r = 0; r < 5; r++) {
+        image.clear();
+        clearzbuffer();
+        auto start = std::chrono::steady_clock::now();
+        for (Tri& t : tris) zbuffer_texture_triangle(t.pts, t.uvs, zbuffer, image, t.intensity, screen, t.w);
+        colorBest = std::min(colorBest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    colorDepth.assign(zbuffer, zbuffer + width * height);
+    for (int r = 0; r < 5; r++) {
+        clearzbuffer();
+        auto start = std::chrono::steady_clock::now();
+        for (Tri& t : tris) depth_triangle(t.pts, zbuffer, width, screen);
+        depthBest = std::min(depthBest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    bool same = !memcmp(colorDepth.data(), zbuffer, sizeof(float) * width * height);
+    std::cout << "depth-only pass: " << tris.size() << " triangles, color " << colorBest * 1000 << " ms, depth only "
+              << depthBest * 1000 << " ms (" << colorBest / depthBest << "x), depth buffers "
+              << (same ? "identical" : "DIFFERENT") << std::endl;
+
+    //阴影：光从左上前方照过来
+    Vec3f toLight(-1, 1, 1);
+    toLight.normalize();
+    mat<4, 4> light = lightMatrix(toLight);
+    ShadowMap sm(1024);
+    VertexStage lightStage;
+    double shadowBest = 1e30;
+    for (int r = 0; r < 5; r++) {
+        auto start = std::chrono::steady_clock::now();
+        render_shadow_map(light, sm, lightStage);
+        shadowBest = std::min(shadowBest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    image.clear();
+    clearzbuffer();
+    auto start = std::chrono::steady_clock::now();
+    render_shadowed(camera_, image, toLight, sm, lightStage);
+    double shadedMs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000;
+    std::cout << "shadow map " << sm.size() << "x" << sm.size() << ": " << model->nfaces() << " faces in "
+              << shadowBest * 1000 << " ms, shadowed camera pass (3x3 PCF) " << shadedMs << " ms" << std::endl;
+    image.flip_vertically();
+    image.write_tga_file("shadow.tga");
+    sm.write_tga_file("shadowmap.tga");
+}
+
+
+
+
+//光线投射的相机：与光栅化使用同一套相机(cameraMatrix)、投影和视口矩阵
+//M = 视口*投影*视图*模型*相机 把模型空间变到屏幕，透视投影的视点是M的逆矩阵把(0,0,1,0)映射到的点
+//(x=y=w=0)，屏幕上(x,y)的光线从视点指向(x,y,0)逆变换得到的点；正交投影时光线互相平行，沿深度减小(变远)的方向
+struct CameraRays {
+    mat<4, 4> inv;
+    vec<4> depthRow;     //M的第三行，求屏幕深度
+    bool perspective;
+    Vec3f eye, forward;
+
+    CameraRays(const mat<4, 4>& camera, const mat<4, 4>& projection = projection_, const mat<4, 4>& viewport = viewport_) {
+        mat<4, 4> m = viewport * projection * view_ * model_ * camera;
+        inv = m.inverse();
+        depthRow = m[2];
+        vec<4> e = inv * vec<4>{ { 0, 0, 1, 0 } };
+        Vec3f d(e[0], e[1], e[2]);
+        perspective = std::fabs(e[3]) > 1e-6f * d.norm();
+        eye = perspective ? d * (1.f / e[3]) : Vec3f(0, 0, 0);
+        if (depthRow[0] * d.x + depthRow[1] * d.y + depthRow[2] * d.z > 0) d = d * -1.f;
+        forward = d.norm() > 0 ? d * (1.f / d.norm()) : Vec3f(0, 0, -1);
+    }
+
+    Ray ray(float x, float y) const {
+        vec<4> q = inv * vec<4>{ { x, y, 0, 1 } };
+        Vec3f p = Vec3f(q[0], q[1], q[2]) * (1.f / q[3]);
+        if (!perspective) return Ray(p - forward * 1e3f, forward);
+        //q.w < 0 时p在视点背后，光线反过来
+        Vec3f dir = q[3] > 0 ? p - eye : eye - p;
+        return Ray(eye, dir * (1.f / dir.norm()));
+    }
+
+    //穿过像素(x,y)中心的光线，像素覆盖屏幕上[x,x+1]x[y,y+1]
+    Ray pixel(int x, int y) const {
+        return ray(x + 0.5f, y + 0.5f);
+    }
+};
+
+//光线投射的场景：一个或多个模型，每个模型一棵BVH
+struct RaycastPart {
+    const Bvh* bvh;
+    Model* mesh;
+};
+
+//在所有部件中求最近交点(剔除背对光线的面片)，返回击中的部件序号，-1表示没有击中
+int raycast_closest(const std::vector<RaycastPart>& parts, const Ray& ray, RayHit& hit) {
+    int part = -1;
+    for (int p = 0; p < (int)parts.size(); p++)
+        if (parts[p].bvh->intersect(ray, hit, true)) part = p;
+    return part;
+}
+
+//拾取：屏幕像素(x,y)上可见的面片，不需要光栅化
+int raycast_pick(const std::vector<RaycastPart>& parts, const CameraRays& rays, int x, int y, RayHit& hit) {
+    hit = RayHit();
+    return raycast_closest(parts, rays.pixel(x, y), hit);
+}
+
+//光线投射渲染：每个像素一条主光线，击中点按漫反射纹理*面片光照强度着色(与render_perspective相同，
+//纹理坐标按真实的重心坐标插值)；shadows为true时再向光源发一条阴影光线，被挡住的点只保留环境光
+//按行并行，pool为空时串行；返回发出的光线数
+long long render_raycast(const std::vector<RaycastPart>& parts, const mat<4, 4>& camera, TGAImage& image,
+                         const mat<4, 4>& projection = projection_, ThreadPool* pool = NULL, bool shadows = false) {
+    CameraRays rays(camera, projection);
+    Vec3f toLight = light_dir * -1.f;   //面片朝外的法线与它同向时被照亮
+    const float ambient = 0.3f;
+    int w = image.get_width(), h = image.get_height();
+    std::vector<long long> counts(pool ? pool->size() : 1, 0);
+    auto row = [&](int y, int thread) {
+        long long n = 0;
+        for (int x = 0; x < w; x++) {
+            Ray ray = rays.pixel(x, y);
+            RayHit hit;
+            int p = raycast_closest(parts, ray, hit);
+            n++;
+            if (p < 0) continue;
+            Model& mesh = *parts[p].mesh;
+            Span<int> face = mesh.face(hit.face);
+            Vec3f v0 = mesh.vert(face[0]), v1 = mesh.vert(face[1]), v2 = mesh.vert(face[2]);
+            Vec3f normal = (v2 - v0) ^ (v1 - v0);
+            normal.normalize();
+            float intensity = normal * light_dir;
+            if (shadows && intensity > 0) {
+                //起点沿朝外的法线离开表面一点，避免击中自己
+                Vec3f pos = ray.org + ray.dir * hit.t - normal * 1e-3f;
+                n++;
+                for (const RaycastPart& q : parts) {
+                    if (q.bvh->occluded(Ray(pos, toLight))) {
+                        intensity *= ambient;
+                        break;
+                    }
+                }
+            }
+            //没有漫反射纹理的模型(如boggie的身体)按白色着色
+            if (mesh.diffuse_map().empty()) {
+                image.set(x, y, white * intensity);
+                continue;
+            }
+            float b0 = 1 - hit.u - hit.v;
+            Vec2f uv = mesh.uv(hit.face, 0) * b0 + mesh.uv(hit.face, 1) * hit.u + mesh.uv(hit.face, 2) * hit.v;
+            image.set(x, y, mesh.diffuse(uv) * intensity);
+        }
+        counts[thread] += n;
+    };
+    if (pool) pool->parallel_for(h, row);
+    else for (int y = 0; y < h; y++) row(y, 0);
+    long long total = 0;
+    for (long long c : counts) total += c;
+    return total;
+}
+
+//光线投射测试：diablo3_pose和boggie(身体、头、眼睛三个模型)的BVH构建时间(串行和并行)，
+//主光线每核每秒的光线数，african_head与光栅化结果的覆盖一致程度，以及拾取
+void test_raycast() {
+    ThreadPool pool(ThreadPool::hardware_threads());
+    struct Scene { const char* name; std::vector<const char*> files; };
+    Scene scenes[2] = { { "diablo3_pose", { "../obj/diablo3_pose/diablo3_pose.obj" } },
+                        { "boggie", { "../obj/boggie/body.obj", "../obj/boggie/head.obj", "../obj/boggie/eyes.obj" } } };
+    for (const Scene& scene : scenes) {
+        std::vector<std::unique_ptr<Model> > meshes;
+        std::vector<Bvh> bvhs(scene.files.size());
+        std::vector<RaycastPart> parts;
+        int faces = 0, nodes = 0, depthMax = 0;
+        double serial_ms = 0, parallel_ms = 0;
+        for (size_t i = 0; i < scene.files.size(); i++) {
+            meshes.emplace_back(new Model(scene.files[i]));
+            Model& mesh = *meshes.back();
+            mesh.wait_textures();   //纹理在后台解码，等它完成后再计时
+            bvhs[i].build(mesh.verts(), mesh.vert_indices());
+            serial_ms += bvhs[i].build_stats().ms;
+            bvhs[i].build(mesh.verts(), mesh.vert_indices(), &pool);
+            parallel_ms += bvhs[i].build_stats().ms;
+            faces += mesh.nfaces();
+            nodes += bvhs[i].build_stats().nodes;
+            depthMax = std::max(depthMax, bvhs[i].build_stats().maxDepth);
+        }
+        for (size_t i = 0; i < scene.files.size(); i++) parts.push_back(RaycastPart{ &bvhs[i], meshes[i].get() });
+
+        //把场景的包围球缩放平移到原点处，用默认相机拍摄时大致占满画面
+        Vec3f lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+        for (const std::unique_ptr<Model>& mesh : meshes) {
+            for (const Vec3f& v : mesh->verts()) {
+                lo = Vec3f(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+                hi = Vec3f(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+            }
+        }
+        Vec3f center = (lo + hi) * 0.5f;
+        float radius = (hi - lo).norm() * 0.5f;
+        mat<4, 4> fit = mat<4, 4>::identity();
+        for (int i = 0; i < 3; i++) {
+            fit[i][i] = 1.6f / radius;
+            fit[i][3] = -center[i] * 1.6f / radius;
+        }
+        mat<4, 4> camera = camera_ * fit;
+
+        TGAImage image(width, height, TGAImage::RGB);
+        render_raycast(parts, camera, image, projection_, &pool);   //预热
+        double best = 1e30;
+        long long rays = 0;
+        for (int r = 0; r < 3; r++) {
+            image.clear();
+            auto start = std::chrono::steady_clock::now();
+            rays = render_raycast(parts, camera, image, projection_, &pool);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::cout << "raycast [" << scene.name << "] " << faces << " faces, BVH build " << serial_ms << " ms serial / "
+                  << parallel_ms << " ms with " << pool.size() << " threads, " << nodes << " 4-wide nodes, depth " << depthMax
+                  << "; " << rays << " primary rays in " << best * 1000 << " ms, "
+                  << rays / best / pool.size() / 1e6 << " Mrays/s/core" << std::endl;
+        image.flip_vertically();
+        image.write_tga_file((std::string("raycast_") + scene.name + ".tga").c_str());
+    }
+
+    //默认模型：与光栅化的结果比较哪些像素被覆盖，并渲染带阴影的版本
+    Bvh bvh;
+    bvh.build(model->verts(), model->vert_indices(), &pool);
+    std::vector<RaycastPart> parts(1, RaycastPart{ &bvh, model });
+    TGAImage raster(width, height, TGAImage::RGB), traced(width, height, TGAImage::RGB);
+    clearzbuffer();
+    render_perspective(camera_, raster);
+    render_raycast(parts, camera_, traced, projection_, &pool);
+    CameraRays rays(camera_);
+    RayHit hit;
+    int covered = 0, agree = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool a = zbuffer[x + y * width] != -std::numeric_limits<float>::max();
+            bool b = raycast_pick(parts, rays, x, y, hit) >= 0;
+            covered += a;
+            agree += a == b;
+        }
+    }
+    std::cout << "  african_head: raster covers " << covered << " pixels, ray cast agrees on "
+              << 100.0 * agree / (width * height) << "% of pixels" << std::endl;
+    TGAImage shadowed(width, height, TGAImage::RGB);
+    long long total = render_raycast(parts, camera_, shadowed, projection_, &pool, true);
+    std::cout << "  with shadow rays: " << total << " rays" << std::endl;
+    shadowed.flip_vertically();
+    shadowed.write_tga_file("raycast_shadows.tga");
+
+    int part = raycast_pick(parts, rays, width / 2, height / 2, hit);
+    std::cout << "  pick (" << width / 2 << ", " << height / 2 << "): " << (part < 0 ? -1 : hit.face) << " at t " << hit.t << std::endl;
+}
+
+
+
+
+//meshlet剔除测试：各模型建簇的结果，默认相机、近景相机和3个单位外的远景相机下整簇剔除的比例(视锥/按光照方向的法线锥)，
+//作为对照也给出按视点的法线锥能剔除的比例；再比较render_perspective关闭和打开剔除时的耗时，两者的结果应该逐字节相同，
+//默认相机下画出了的模型，换成其它相机也不能一个像素都没画(远景相机检查整簇剔除和裁剪没有多出远平面)
+void test_meshlets() {
+    const char* files[] = { "../obj/african_head/african_head.obj", "../obj/diablo3_pose/diablo3_pose.obj",
+                            "../obj/boggie/body.obj", "../obj/boggie/head.obj", "../obj/boggie/eyes.obj", "../obj/floor/floor.obj" };
+    Vec3f closePos(0.1f, 0.05f, 0.2f), farPos(2, 1, 2);
+    struct View { const char* name; mat<4, 4> camera; mat<4, 4> projection; };
+    View views[3] = { { "default", camera_, projection_ },
+                      { "close-up", cameraMatrix(closePos, centerPos, up), projectionMatrix(-1.0f / (closePos - centerPos).norm()) },
+                      { "far", cameraMatrix(farPos, centerPos, up), projectionMatrix(-1.0f / (farPos - centerPos).norm()) } };
+    TGAImage culled(width, height, TGAImage::RGB), reference(width, height, TGAImage::RGB);
+    float viewport[16];
+    matrix2floats(viewport_, viewport);
+    auto percent = [](long long a, long long b) { return b ? 100.0 * a / b : 0.0; };
+
+    Model* saved = model;
+    bool savedCulling = meshlet_culling;
+    for (const char* file : files) {
+        Model mesh(file);
+        const MeshletData& meshlets = mesh.meshlets();
+        int nmeshlets = (int)meshlets.meshlets.size(), cones = 0;
+        for (const Meshlet& m : meshlets.meshlets) cones += m.coneSin < 1;
+        std::cout << "meshlets [" << file << "] " << mesh.nfaces() << " faces in " << nmeshlets << " meshlets, avg "
+                  << (nmeshlets ? (double)mesh.nfaces() / nmeshlets : 0) << " faces / "
+                  << (nmeshlets ? (double)meshlets.vertices.size() / nmeshlets : 0) << " vertices, "
+                  << percent(cones, nmeshlets) << "% with a usable normal cone" << std::endl;
+
+        model = &mesh;
+        int defaultCovered = 0;
+        for (const View& v : views) {
+            float mvp[16];
+            matrix2floats(v.projection * view_ * model_ * v.camera, mvp);
+            MeshletCuller culler(mvp, viewport, width, height, clipParams.nearW);
+            std::vector<int> visible;
+            MeshletCullStats eye, light;
+            culler.cull(meshlets, visible, MESHLET_CONE_VIEW, light_dir, &eye);
+            culler.cull(meshlets, visible, MESHLET_CONE_DIRECTION, light_dir, &light);
+
+            //关闭和打开剔除各渲染几帧，取最快的一帧
+            auto best_ms = [&](bool on, TGAImage& image) {
+                meshlet_culling = on;
+                double best = 1e30;
+                for (int r = 0; r < 3; r++) {
+                    image.clear();
+                    clearzbuffer();
+                    auto start = std::chrono::steady_clock::now();
+                    render_perspective(v.camera, image, v.projection);
+                    best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                }
+                return best;
+            };
+            best_ms(true, culled);   //纹理加载完成、缓冲扩容
+            double off_ms = best_ms(false, reference);
+            double on_ms = best_ms(true, culled);
+            const MeshletCullStats& c = meshlet_stats;
+            bool same = memcmp(culled.buffer(), reference.buffer(), (size_t)width * height * 3) == 0;
+            int covered = covered_pixels();
+            if (&v == &views[0]) defaultCovered = covered;
+            bool empty = covered == 0 && defaultCovered > 0;
+            std::cout << "  " << v.name << ": meshlets culled " << percent(c.frustumCulled, c.meshlets) << "% frustum + "
+                      << percent(c.coneCulled, c.meshlets) << "% cone, faces culled " << percent(c.facesCulled, c.faces)
+                      << "% (view cone alone " << percent(eye.coneCulled, eye.meshlets) << "%, light cone alone "
+                      << percent(light.coneCulled, light.meshlets) << "% of meshlets); render "
+                      << off_ms << " ms -> " << on_ms << " ms, " << (same ? "identical" : "DIFFERENT") << ", "
+                      << covered << " pixels covered" << (empty ? " (EMPTY FRAME)" : "") << std::endl;
+        }
+    }
+    model = saved;
+    meshlet_culling = savedCulling;
+}
+
+
+
+
+//渲染统计测试：打开统计后重新运行test_perspective_projection和test_shader，输出每帧的统计和overdraw热度图；
+//同一组三角形分别串行和4线程分块渲染，检查各线程计数合并后的覆盖、深度测试和着色数与串行相同；
+//最后比较render_perspective在统计关闭和打开时的耗时
+void test_render_stats() {
+    const int nthreads = std::max(4, ThreadPool::hardware_threads());
+    RenderStats stats(nthreads, width, height);
+    render_stats = &stats;
+
+    stats.begin_frame();
+    test_perspective_projection();
+    stats.end_frame();
+    stats.report(std::cout, "perspective_projection");
+    stats.write_heatmap("overdraw_perspective.tga");
+
+    stats.begin_frame();
+    test_shader();
+    stats.end_frame();
+    stats.report(std::cout, "shader");
+    stats.write_heatmap("overdraw_shader.tga");
+
+    //装配好的三角形，串行和分块渲染共用
+    render_stats = NULL;
+    std::vector<Vec3f> pts;
+    std::vector<Vec2f> uvs;
+    std::vector<float> intensities;
+    assemble_perspective(camera_, projection_, [&](Vec3f* p, Vec2f* uv, float intensity, const float*) {
+        for (int j = 0; j < 3; j++) {
+            pts.push_back(p[j]);
+            uvs.push_back(uv[j]);
+        }
+        intensities.push_back(intensity);
+    });
+    int ntris = (int)intensities.size();
+    TGAImage image(width, height, TGAImage::RGB);
+    render_stats = &stats;
+
+    clearzbuffer();
+    stats.begin_frame();
+    for (int t = 0; t < ntris; t++) zbuffer_texture_triangle(&pts[t * 3], &uvs[t * 3], zbuffer, image, intensities[t]);
+    stats.end_frame();
+    RenderCounters serial = stats.frame();
+    long long serial_overwritten = stats.fragments_overwritten();
+
+    ThreadPool pool(nthreads);
+    TileBinner binner(width, height, 64);
+    for (int t = 0; t < ntris; t++) binner.bin(t, &pts[t * 3]);
+    clearzbuffer();
+    stats.begin_frame();
+    binner.render(pool, [&](int t, const TileRect& rect, int) {
+        zbuffer_texture_triangle(&pts[t * 3], &uvs[t * 3], zbuffer, image, intensities[t], rect);
+    });
+    stats.end_frame();
+    const RenderCounters& tiled = stats.frame();
+    bool same = tiled.bboxPixels == serial.bboxPixels && tiled.coveredPixels == serial.coveredPixels
+             && tiled.depthPass == serial.depthPass && tiled.depthFail == serial.depthFail
+             && tiled.fragmentsShaded == serial.fragmentsShaded && stats.fragments_overwritten() == serial_overwritten;
+    std::cout << "  " << nthreads << " threads tiled: " << tiled.triangles << " triangle/tile pairs for " << ntris << " triangles, merged counters "
+              << (same ? "match serial" : "MISMATCH") << std::endl;
+
+    //统计的开销
+    auto best_ms = [&](RenderStats* s) {
+        render_stats = s;
+        double best = 1e30;
+        for (int r = 0; r < 5; r++) {
+            clearzbuffer();
+            if (s) s->begin_frame();
+            auto start = std::chrono::steady_clock::now();
+            render_perspective(camera_, image);
+            if (s) s->end_frame();
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    };
+    double off_ms = best_ms(NULL);
+    double on_ms = best_ms(&stats);
+    render_stats = NULL;
+    std::cout << "  render_perspective: stats off " << off_ms << " ms, on " << on_ms << " ms (including end_frame)" << std::endl;
+}
+
+
+
+//批量渲染测试：african_head和diablo3_pose在几种相机、光照、分辨率和着色方式下共8个任务，
+//分别用只有调用线程的线程池和多个线程执行(各用一个新的模型缓存)，检查两次写出的文件逐字节相同、
+//每个模型只加载了一次；再用已经加载好模型的缓存执行一遍，输出每个任务的耗时和总吞吐量
+void test_batch() {
+    const char* jobfile = "batch_jobs.txt";
+    {
+        std::ofstream out(jobfile);
+        out << "# tinyrenderer batch jobs\n"
+            << "model=../obj/african_head/african_head.obj output=batch_0.tga\n"
+            << "model=../obj/diablo3_pose/diablo3_pose.obj output=batch_1.tga shader=texture\n"
+            << "model=../obj/african_head/african_head.obj output=batch_2.tga shader=gouraud eye=-1,0.3,2 size=640x480\n"
+            << "model=../obj/diablo3_pose/diablo3_pose.obj output=batch_3.tga shader=normalmap light=-1,-1,-1 size=1024x768\n"
+            << "model=../obj/african_head/african_head.obj output=batch_4.tga shader=flat eye=0,0,3 size=400x400\n"
+            << "model=../obj/diablo3_pose/diablo3_pose.obj output=batch_5.tga shader=gouraud eye=2,1,2 light=0,-1,-1\n"
+            << "model=../obj/african_head/african_head.obj output=batch_6.tga shader=normalmap eye=1,0,1 size=512x512  # close-up\n"
+            << "model=../obj/diablo3_pose/diablo3_pose.obj output=batch_7.tga shader=flat eye=0,0.5,-2 light=0,0,1 size=300x600\n";
+    }
+    std::vector<RenderJob> jobs;
+    std::string error;
+    if (!parse_job_file(jobfile, jobs, error)) {
+        std::cout << "batch: " << error << std::endl;
+        return;
+    }
+    remove(jobfile);
+
+    auto slurp = [](const std::string& name) {
+        std::ifstream in(name.c_str(), std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    auto count_ok = [](const std::vector<JobResult>& results) {
+        int ok = 0;
+        for (const JobResult& r : results) ok += r.ok;
+        return ok;
+    };
+    int nthreads = std::max(2, ThreadPool::hardware_threads());
+    std::vector<JobResult> results;
+
+    ModelCache serial_cache;
+    ThreadPool serial_pool(1);
+    double serial_ms = run_batch(jobs, serial_cache, serial_pool, render_job, results);
+    int serial_ok = count_ok(results);
+    std::vector<std::string> files;
+    for (const RenderJob& job : jobs) files.push_back(slurp(job.output));
+    //每个任务的画面里都要有模型：串行和并行的结果相同不能说明画对了，整个模型被裁掉时两边都是黑的
+    std::vector<int> lit(jobs.size(), 0);
+    int empty = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        TGAImage image;
+        if (image.read_tga_file(jobs[i].output.c_str())) lit[i] = lit_pixels(image);
+        empty += lit[i] == 0;
+    }
+
+    ModelCache cache;
+    ThreadPool pool(nthreads);
+    double parallel_ms = run_batch(jobs, cache, pool, render_job, results);
+    int parallel_ok = count_ok(results);
+    bool identical = serial_ok == (int)jobs.size() && parallel_ok == (int)jobs.size();
+    for (size_t i = 0; i < jobs.size(); i++) identical = identical && !files[i].empty() && files[i] == slurp(jobs[i].output);
+
+    double warm_ms = run_batch(jobs, cache, pool, render_job, results);
+    for (const RenderJob& job : jobs) remove(job.output.c_str());
+
+    std::cout << "batch " << jobs.size() << " jobs: 1 thread " << serial_ms << " ms (" << serial_cache.loads() << " model loads), "
+              << nthreads << " threads " << parallel_ms << " ms (" << cache.loads() << " model loads), "
+              << (identical ? "identical" : "MISMATCH") << std::endl;
+    std::cout << "  lit pixels per job:";
+    for (size_t i = 0; i < jobs.size(); i++) std::cout << " " << lit[i];
+    if (empty) std::cout << " (" << empty << " EMPTY FRAMES)";
+    std::cout << std::endl;
+    std::cout << "  warm cache, " << nthreads << " threads (model loads still " << cache.loads() << "):" << std::endl;
+    print_batch_report(std::cout, jobs, results, warm_ms);
+}
+
+
+
+//转台动画：相机在cameraPos的高度上绕centerPos转一圈，渲染nframes帧，写成 prefix000.tga、prefix001.tga ...
+//pipelined为true时交给FrameWriter在后台线程写文件(双缓冲，渲染第k帧时写第k-1帧)，否则每帧渲染、翻转、写文件依次进行
+//(只有一个硬件线程时FrameWriter不启动写线程，与依次进行相同)
+//返回每秒帧数(包括等待最后一帧写完)，failed为写文件失败的帧数
+double render_turntable(int nframes, const char* prefix, bool pipelined, int& failed) {
+    const float pi = 3.14159265f;
+    Vec3f offset = cameraPos - centerPos;
+    float radius = std::sqrt(offset.x * offset.x + offset.z * offset.z);
+    float start_angle = std::atan2(offset.x, offset.z);
+    auto frame_name = [prefix](int k) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s%03d.tga", prefix, k);
+        return std::string(name);
+    };
+    auto orbit = [&](int k, mat<4, 4>& camera, mat<4, 4>& projection) {
+        float angle = start_angle + 2 * pi * k / nframes;
+        Vec3f pos(centerPos.x + radius * std::sin(angle), cameraPos.y, centerPos.z + radius * std::cos(angle));
+        camera = cameraMatrix(pos, centerPos, up);
+        projection = projectionMatrix(-1.0f / (pos - centerPos).norm());
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    mat<4, 4> camera, projection;
+    if (pipelined) {
+        FrameWriter writer(width, height, 2);
+        for (int k = 0; k < nframes; k++) {
+            orbit(k, camera, projection);
+            Framebuffer& fb = writer.acquire();
+            fb.clear();
+            render_perspective(camera, fb, projection);
+            writer.submit(fb, frame_name(k));
+        }
+        writer.finish();
+        failed = writer.failed();
+    } else {
+        Framebuffer fb(width, height);
+        TGAImage image(width, height, TGAImage::RGB);
+        failed = 0;
+        for (int k = 0; k < nframes; k++) {
+            orbit(k, camera, projection);
+            fb.clear();
+            render_perspective(camera, fb, projection);
+            fb.to_image(image, true);
+            if (!image.write_tga_file(frame_name(k).c_str())) failed++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nframes / seconds;
+}
+
+//转台测试：同样的12帧分别依次渲染写出和流水线写出，两种方式交替运行3次取最高帧率，检查写出的文件逐字节相同
+//后台写线程只有在有空闲核的时候才能和渲染重叠，单核机器上两者应该持平
+void test_turntable() {
+    const int nframes = 12;
+    auto slurp = [](const std::string& name) {
+        std::ifstream in(name.c_str(), std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    double serial_fps = 0, pipelined_fps = 0;
+    int failed = 0;
+    for (int r = 0; r < 3; r++) {
+        int f;
+        serial_fps = std::max(serial_fps, render_turntable(nframes, "turntable_serial_", false, f));
+        failed += f;
+        pipelined_fps = std::max(pipelined_fps, render_turntable(nframes, "turntable_", true, f));
+        failed += f;
+    }
+    bool identical = failed == 0;
+    for (int k = 0; k < nframes; k++) {
+        char a[64], b[64];
+        snprintf(a, sizeof(a), "turntable_serial_%03d.tga", k);
+        snprintf(b, sizeof(b), "turntable_%03d.tga", k);
+        std::string da = slurp(a);
+        identical = identical && !da.empty() && da == slurp(b);
+        remove(a);
+        remove(b);
+    }
+    std::cout << "turntable " << nframes << " frames: serial " << serial_fps << " fps, pipelined " << pipelined_fps
+              << " fps (" << ThreadPool::hardware_threads() << " hardware threads), " << (identical ? "identical" : "MISMATCH");
+    if (failed) std::cout << ", " << failed << " frames failed to write";
+    std::cout << std::endl;
+}
+
+
+
+
+//帧缓冲测试：同一帧分别渲染到TGAImage+zbuffer、LINEAR和TILED布局的RGBA8帧缓冲，比较耗时(含清除)，
+//检查转换成TGAImage后与原来的结果逐字节相同；另外检查RGBA32F格式按块拆分的span写入和转换
+void test_framebuffer() {
+    auto ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const int reps = 5;
+    TGAImage reference(width, height, TGAImage::RGB);
+    double image_ms = 1e30;
+    for (int r = 0; r < reps; r++) {
+        auto start = std::chrono::steady_clock::now();
+        clearzbuffer();
+        reference.clear();
+        render_perspective(camera_, reference);
+        image_ms = std::min(image_ms, ms(start));
+    }
+    std::cout << "framebuffer: TGAImage + zbuffer " << image_ms << " ms" << std::endl;
+
+    const char* names[2] = { "linear", "tiled" };
+    for (int layout = 0; layout < 2; layout++) {
+        Framebuffer fb(width, height, Framebuffer::RGBA8, layout ? Framebuffer::TILED : Framebuffer::LINEAR);
+        double fb_ms = 1e30, convert_ms = 1e30;
+        TGAImage image(width, height, TGAImage::RGB);
+        for (int r = 0; r < reps; r++) {
+            auto start = std::chrono::steady_clock::now();
+            fb.clear();
+            render_perspective(camera_, fb);
+            fb_ms = std::min(fb_ms, ms(start));
+            start = std::chrono::steady_clock::now();
+            fb.to_image(image);
+            convert_ms = std::min(convert_ms, ms(start));
+        }
+        bool identical = !memcmp(image.buffer(), reference.buffer(), width * height * 3);
+        std::cout << "  RGBA8 " << names[layout] << ": " << fb_ms << " ms, to_image " << convert_ms << " ms, "
+                  << (identical ? "identical" : "MISMATCH") << std::endl;
+        if (layout == 1) {
+            fb.to_image(image, true);
+            image.write_tga_file("framebuffer.tga");
+        }
+    }
+
+    //RGBA32F：每行写一段跨过多个块的渐变
+    Framebuffer ffb(37, 11, Framebuffer::RGBA32F, Framebuffer::TILED);
+    std::vector<float> span(37 * 4);
+    bool ok = true;
+    for (int y = 0; y < 11; y++) {
+        for (int x = 0; x < 37; x++)
+            for (int k = 0; k < 4; k++) span[x * 4 + k] = (float)((x * 7 + y * 13 + k * 50) % 256);
+        ffb.write_span(0, y, 37, &span[0]);
+    }
+    TGAImage fimage(37, 11, TGAImage::RGBA);
+    ffb.to_image(fimage);
+    for (int y = 0; y < 11; y++)
+        for (int x = 0; x < 37; x++)
+            for (int k = 0; k < 4; k++) ok = ok && fimage.buffer()[(y * 37 + x) * 4 + k] == (x * 7 + y * 13 + k * 50) % 256;
+    std::cout << "  RGBA32F tiled span writes: " << (ok ? "ok" : "MISMATCH") << std::endl;
+}
+
+
+
+
+//纹理采样测试：只做漫反射纹理采样的帧(与render_perspective同一场景)，在几种输出分辨率下比较
+//行优先TGAImage::get、分块Texture的最近点、第0层双线性、按屏幕空间导数选LOD的三线性四种采样的耗时，
+//以不采样纹理的同一帧为基准给出每次采样多花的时间
+//导数按三角形在屏幕上的仿射映射计算，每个三角形一次；同时输出128x128下最近点和三线性的结果以便对比缩小后的走样
+void test_texture_sampling() {
+    TGAImage rowMajor;
+    rowMajor.read_tga_file("../obj/african_head/african_head_diffuse.tga", true);
+    const Texture& texture = model->diffuse_map();
+    std::cout << "texture sampling: " << texture.width() << "x" << texture.height() << ", " << texture.levels() << " mip levels" << std::endl;
+
+    const char* modes[5] = { "untextured", "TGAImage::get", "nearest", "bilinear", "trilinear" };
+    const int sizes[5] = { 64, 128, 256, 512, 800 };
+    const int reps = 3;
+    float mvp[16], viewport[16];
+    matrix2floats(projection_ * view_ * model_ * camera_, mvp);
+    Span<Vec3f> verts = model->verts();
+    VertexStage vertices;
+    for (int si = 0; si < 5; si++) {
+        int size = sizes[si];
+        matrix2floats(viewportMatrix(0, 0, size, size), viewport);
+        vertices.set_transform(mvp, viewport);
+        vertices.process(verts.data(), verts.size());
+        std::vector<float> depth(size * size);
+        TileRect clip(0, 0, size - 1, size - 1);
+        double best[5];
+        long long samples = 0;
+        for (int mode = 0; mode < 5; mode++) {
+            TGAImage image(size, size, TGAImage::RGB);
+            best[mode] = 1e30;
+            for (int r = 0; r < reps; r++) {
+                std::fill(depth.begin(), depth.end(), -std::numeric_limits<float>::max());
+                samples = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < model->nfaces(); i++) {
+                    Span<int> face = model->face(i);
+                    Vec3f world[3], pts[3];
+                    Vec2f uv[3];
+                    bool behind = false;
+                    for (int j = 0; j < 3; j++) {
+                        world[j] = verts[face[j]];
+                        pts[j] = vertices.screen(face[j]);
+                        uv[j] = model->uv(i, j);
+                        behind |= vertices.clip(face[j]).w <= 0;
+                    }
+                    Vec3f normal = (world[2] - world[0]) ^ (world[1] - world[0]);
+                    float intensity = normal.normalize() * light_dir;
+                    if (intensity <= 0 || behind) continue;
+                    //屏幕空间中纹理坐标对x、y的偏导
+                    Vec2f e1(pts[1].x - pts[0].x, pts[1].y - pts[0].y), e2(pts[2].x - pts[0].x, pts[2].y - pts[0].y);
+                    float det = e1.x * e2.y - e1.y * e2.x;
+                    if (std::fabs(det) < 1e-6f) continue;
+                    Vec2f duv1 = uv[1] - uv[0], duv2 = uv[2] - uv[0];
+                    Vec2f duvdx = duv1 * (e2.y / det) + duv2 * (-e1.y / det);
+                    Vec2f duvdy = duv1 * (-e2.x / det) + duv2 * (e1.x / det);
+                    float lod = texture.lod(duvdx, duvdy);
+                    rasterize(pts, clip, [&](const RasterBlock& blk) {
+                        float* zrow = &depth[blk.x + blk.y * size];
+                        for (int mask = depth_test(blk, zrow); mask; mask &= mask - 1) {
+                            int k = raster_lowest_bit(mask);
+                            zrow[k] = blk.z[k];
+                            Vec2f uvP = uv[0] * blk.bc0[k] + uv[1] * blk.bc1[k] + uv[2] * blk.bc2[k];
+                            TGAColor color = white;
+                            if (mode == 1) {
+                                color = rowMajor.get((int)(uvP.x * rowMajor.get_width()), (int)(uvP.y * rowMajor.get_height()));
+                            } else if (mode == 2) {
+                                color = texture.nearest(uvP);
+                            } else if (mode > 2) {
+                                Vec4f c = texture.sample(uvP, mode == 3 ? FILTER_BILINEAR : FILTER_TRILINEAR, mode == 3 ? 0.f : lod);
+                                color = TGAColor((unsigned char)(c.z + 0.5f), (unsigned char)(c.y + 0.5f), (unsigned char)(c.x + 0.5f));
+                            }
+                            image.set(blk.x + k, blk.y, color * intensity);
+                            samples++;
+                        }
+                    });
+                }
+                best[mode] = std::min(best[mode], std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            if (size == 128 && (mode == 2 || mode == 4)) {
+                image.flip_vertically();
+                image.write_tga_file(mode == 2 ? "texture_nearest_128.tga" : "texture_trilinear_128.tga");
+            }
+        }
+        std::cout << "  " << size << "x" << size << " (" << samples << " samples):";
+        std::cout << " " << modes[0] << " " << best[0] << " ms";
+        for (int mode = 1; mode < 5; mode++)
+            std::cout << ", " << modes[mode] << " " << best[mode] << " ms (+" << (best[mode] - best[0]) * 1e6 / std::max(1LL, samples) << " ns/sample)";
+        std::cout << std::endl;
+    }
+}
+
+
+
+
+//TGA编码测试：比较逐包写ofstream的旧实现、在内存中编码后一次写出的新实现(单线程和4线程按条带并行)的耗时和文件大小
+//检查新文件用新旧两种解码器读回都和原图逐像素相同，单线程和并行写出的文件逐字节相同
+void test_tga_encode() {
+    auto ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto same = [](TGAImage& a, TGAImage& b) {
+        unsigned long n = (unsigned long)a.get_width() * a.get_height() * a.get_bytespp();
+        return a.get_width() == b.get_width() && a.get_height() == b.get_height() && a.get_bytespp() == b.get_bytespp()
+            && !memcmp(a.buffer(), b.buffer(), n);
+    };
+    auto slurp = [](const char* name) {
+        std::ifstream in(name, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    const char* files[4] = { "visibility_buffer.tga", "../obj/african_head/african_head_diffuse.tga",
+                             "../obj/african_head/african_head_nm.tga", "../obj/african_head/african_head_spec.tga" };
+    const char* names[3] = { "tga_encode_stream.tga", "tga_encode_serial.tga", "tga_encode_parallel.tga" };
+    const int reps = 5;
+    ThreadPool serial(1), parallel(4);
+    for (int f = 0; f < 4; f++) {
+        TGAImage image;
+        image.read_tga_file(files[f]);
+        double best[3] = { 1e30, 1e30, 1e30 };
+        for (int r = 0; r < reps; r++) {
+            auto start = std::chrono::steady_clock::now();
+            image.write_tga_file_stream(names[0]);
+            best[0] = std::min(best[0], ms(start));
+            start = std::chrono::steady_clock::now();
+            image.write_tga_file(names[1], true, &serial);
+            best[1] = std::min(best[1], ms(start));
+            start = std::chrono::steady_clock::now();
+            image.write_tga_file(names[2], true, &parallel);
+            best[2] = std::min(best[2], ms(start));
+        }
+        TGAImage back, backStream;
+        back.read_tga_file(names[1]);
+        backStream.read_tga_file_stream(names[1]);
+        std::string bytes[3] = { slurp(names[0]), slurp(names[1]), slurp(names[2]) };
+        std::cout << "tga encode [" << files[f] << "] " << image.get_width() << "x" << image.get_height() << "/" << image.get_bytespp() * 8
+                  << ": stream " << best[0] << " ms (" << bytes[0].size() << " bytes), buffered " << best[1] << " ms ("
+                  << bytes[1].size() << " bytes), 4 bands " << best[2] << " ms, "
+                  << (same(image, back) && same(image, backStream) ? "round trip ok" : "ROUND TRIP MISMATCH") << ", "
+                  << (bytes[1] == bytes[2] ? "parallel identical" : "PARALLEL MISMATCH") << std::endl;
+    }
+    for (int k = 0; k < 3; k++) remove(names[k]);
+}
+
+
+
+
+//TGA解码测试：比较逐像素读ifstream的旧实现和映射整个文件后按包解码的新实现，按格式给出解码吞吐量(MB/s，按解码后的像素字节数算)
+//每次解码后都把像素读一遍，零拷贝映射的缺页开销也算在内；检查两种实现(以及翻转后)的像素逐字节相同
+//自带的纹理都是RLE压缩的，未压缩的格式用write_tga_file(..., false)另存一份来测
+void test_tga_decode() {
+    auto ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto touch = [](TGAImage& img) {
+        unsigned long sum = 0;
+        const unsigned char* p = img.buffer();
+        unsigned long n = (unsigned long)img.get_width() * img.get_height() * img.get_bytespp();
+        for (unsigned long i = 0; i < n; i += 64) sum += p[i];
+        return sum;
+    };
+    auto same = [](TGAImage& a, TGAImage& b) {
+        unsigned long n = (unsigned long)a.get_width() * a.get_height() * a.get_bytespp();
+        return a.get_width() == b.get_width() && a.get_height() == b.get_height() && a.get_bytespp() == b.get_bytespp()
+            && !memcmp(a.buffer(), b.buffer(), n);
+    };
+    const char* files[3] = { "../obj/african_head/african_head_diffuse.tga", "../obj/african_head/african_head_nm.tga",
+                             "../obj/african_head/african_head_spec.tga" };
+    const char* raw = "tga_decode_raw.tga";
+    const int reps = 5;
+    unsigned long checksum = 0;
+    for (int f = 0; f < 3; f++) {
+        for (int compressed = 1; compressed >= 0; compressed--) {
+            const char* name = files[f];
+            if (!compressed) {
+                TGAImage src;
+                src.read_tga_file(files[f]);
+                src.write_tga_file(raw, false);
+                name = raw;
+            }
+            //flip=0：和旧实现一样的行顺序；flip=1：Model使用的上下翻转的顺序
+            TGAImage reference, flipped, image;
+            double best[3] = { 1e30, 1e30, 1e30 };
+            bool identical = true, zeroCopy = false;
+            for (int r = 0; r < reps; r++) {
+                auto start = std::chrono::steady_clock::now();
+                reference.read_tga_file_stream(name);
+                checksum += touch(reference);
+                best[0] = std::min(best[0], ms(start));
+                start = std::chrono::steady_clock::now();
+                image.read_tga_file(name);
+                checksum += touch(image);
+                best[1] = std::min(best[1], ms(start));
+                zeroCopy = image.mapped();
+                start = std::chrono::steady_clock::now();
+                flipped.read_tga_file(name, true);
+                checksum += touch(flipped);
+                best[2] = std::min(best[2], ms(start));
+                identical = identical && same(reference, image);
+                reference.flip_vertically();
+                identical = identical && same(reference, flipped);
+            }
+            double mb = (double)image.get_width() * image.get_height() * image.get_bytespp() / (1 << 20);
+            std::cout << "tga decode [" << files[f] << "] " << (compressed ? "RLE" : "raw") << " " << image.get_bytespp() * 8 << "bpp: stream "
+                      << mb / best[0] * 1000 << " MB/s, mapped " << mb / best[1] * 1000 << " MB/s" << (zeroCopy ? " (zero-copy)" : "")
+                      << ", mapped+flip " << mb / best[2] * 1000 << " MB/s" << (flipped.mapped() ? " (zero-copy)" : "")
+                      << ", " << (identical ? "identical" : "MISMATCH") << std::endl;
+        }
+    }
+    remove(raw);
+    std::cout << "  (checksum " << checksum << ")" << std::endl;
+}
+
+
+
+
+//纹理异步加载测试：冷启动时Model构造函数返回的延迟，第一次采样的等待，以及全部纹理就绪的时间
+//"同步"用只有调用线程的线程池，任务在构造函数里依次执行，相当于原来的做法
+void test_texture_loading() {
+    auto ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const char* files[2] = { "../obj/african_head/african_head.obj", "../obj/diablo3_pose/diablo3_pose.obj" };
+    for (int f = 0; f < 2; f++) {
+        for (int async = 0; async < 2; async++) {
+            ThreadPool inline_pool(1);
+            auto start = std::chrono::steady_clock::now();
+            Model mesh(files[f], async ? NULL : &inline_pool);
+            double ctor_ms = ms(start);
+            bool ready = mesh.textures_ready();
+            mesh.diffuse(Vec2f(0.5f, 0.5f));   //第一次采样
+            double first_ms = ms(start);
+            mesh.wait_textures();
+            double all_ms = ms(start);
+            std::cout << "texture loading [" << files[f] << "] " << (async ? "async" : "sync ") << ": constructor returns after "
+                      << ctor_ms << " ms" << (ready ? " (textures ready)" : "") << ", first diffuse sample at " << first_ms
+                      << " ms, all textures at " << all_ms << " ms" << std::endl;
+        }
+    }
+}
+
+
+
+
+//网格二进制缓存测试：比较解析OBJ和映射缓存的耗时(只算几何数据，以及包含纹理的整个Model构造)，
+//检查缓存内容与解析结果逐字节相同，并检查OBJ改动之后缓存会失效重建
+void test_mesh_cache() {
+    auto ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const char* files[2] = { "../obj/african_head/african_head.obj", "../obj/diablo3_pose/diablo3_pose.obj" };
+    for (int f = 0; f < 2; f++) {
+        remove(mesh_cache_path(files[f]).c_str());
+
+        ObjData parsed;
+        auto start = std::chrono::steady_clock::now();
+        parse_obj_file(files[f], parsed);
+        double parse_ms = ms(start);
+        start = std::chrono::steady_clock::now();
+        bool written = write_mesh_cache(files[f], parsed);
+        double write_ms = ms(start);
+
+        MappedFile file;
+        MeshView view;
+        start = std::chrono::steady_clock::now();
+        bool opened = open_mesh_cache(files[f], file, view);
+        double open_ms = ms(start);
+        bool identical = opened
+            && view.verts.size() == (int)parsed.verts.size() && !memcmp(view.verts.data(), parsed.verts.data(), parsed.verts.size() * sizeof(Vec3f))
+            && view.uvs.size() == (int)parsed.uvs.size() && !memcmp(view.uvs.data(), parsed.uvs.data(), parsed.uvs.size() * sizeof(Vec2f))
+            && view.norms.size() == (int)parsed.norms.size() && !memcmp(view.norms.data(), parsed.norms.data(), parsed.norms.size() * sizeof(Vec3f))
+            && view.vertIdx.size() == (int)parsed.vertIdx.size() && !memcmp(view.vertIdx.data(), parsed.vertIdx.data(), parsed.vertIdx.size() * sizeof(int))
+            && view.uvIdx.size() == (int)parsed.uvIdx.size() && !memcmp(view.uvIdx.data(), parsed.uvIdx.data(), parsed.uvIdx.size() * sizeof(int))
+            && view.normIdx.size() == (int)parsed.normIdx.size() && !memcmp(view.normIdx.data(), parsed.normIdx.data(), parsed.normIdx.size() * sizeof(int));
+
+        start = std::chrono::steady_clock::now();
+        Model without(files[f], NULL, false);
+        without.wait_textures();
+        double model_parse_ms = ms(start);
+        start = std::chrono::steady_clock::now();
+        Model with(files[f]);
+        with.wait_textures();
+        double model_cache_ms = ms(start);
+
+        std::cout << "mesh cache [" << files[f] << "] parse " << parse_ms << " ms, write cache " << write_ms << " ms"
+                  << (written ? "" : " (FAILED)") << ", map cache " << open_ms << " ms, " << (identical ? "identical" : "MISMATCH") << std::endl;
+        std::cout << "  Model startup with textures: parse " << model_parse_ms << " ms, cache " << model_cache_ms << " ms"
+                  << (with.from_cache() ? "" : " (cache NOT used)") << std::endl;
+    }
+
+    //OBJ改动(大小和修改时间变化)之后缓存失效，Model重新解析并重写缓存
+    const char* copy = "mesh_cache_test.obj";
+    {
+        std::ifstream in(files[0], std::ios::binary);
+        std::ofstream out(copy, std::ios::binary);
+        out << in.rdbuf();
+    }
+    remove(mesh_cache_path(copy).c_str());
+    bool first = Model(copy).from_cache();
+    bool second = Model(copy).from_cache();
+    {
+        std::ofstream out(copy, std::ios::binary | std::ios::app);
+        out << "v 0 0 0\n";
+    }
+    Model changed(copy);
+    bool stale = changed.from_cache();
+    bool rebuilt = Model(copy).from_cache();
+    std::cout << "  cache invalidation: first load " << (first ? "cached" : "parsed") << ", second " << (second ? "cached" : "parsed")
+              << ", after editing the OBJ " << (stale ? "cached" : "parsed") << " (" << changed.nverts() << " vertices), then "
+              << (rebuilt ? "cached" : "parsed") << std::endl;
+    remove(mesh_cache_path(copy).c_str());
+    remove(copy);
+}
+
+
+
+
+//OBJ解析测试：新的解析器(内存映射+手写数字解析+并行分块)与原来的getline+istringstream逐个比较结果，输出MB/s
+void test_obj_loader() {
+    //快速浮点解析与strtof逐位比较
+    std::mt19937 rng(1);
+    int float_mismatches = 0;
+    const int nfloats = 200000;
+    for (int i = 0; i < nfloats; i++) {
+        char buf[64];
+        int mode = i % 3;
+        if (mode == 0) snprintf(buf, sizeof(buf), "%.*f", (int)(rng() % 8), (rng() % 2000000) / 1000.0 - 1000.0);
+        else if (mode == 1) snprintf(buf, sizeof(buf), "%.9g", std::ldexp((double)rng() / rng.max(), (int)(rng() % 40) - 20));
+        else snprintf(buf, sizeof(buf), "%de%d", (int)(rng() % 100000), (int)(rng() % 30) - 15);
+        float a = 0, b = strtof(buf, NULL);
+        parse_float(buf, buf + strlen(buf), a);
+        float_mismatches += memcmp(&a, &b, sizeof(float)) != 0;
+    }
+    std::cout << "obj loader: parse_float vs strtof on " << nfloats << " numbers, " << float_mismatches << " mismatches" << std::endl;
+
+    //各种面片写法和负索引
+    const char* forms = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 1 1\nvn 0 0 1\n"
+                        "f 1 2 3\nf 1//1 3//1 4//1\nf -4/-3/-1 -3/-2/-1 -2/-1/-1\nf 1/1 2/2 3/3 4/3\n";
+    ObjData d;
+    parse_obj(forms, strlen(forms), d);
+    const int expect_v[] = { 0, 1, 2, 0, 2, 3, 0, 1, 2, 0, 1, 2, 0, 2, 3 };
+    const int expect_t[] = { -1, -1, -1, -1, -1, -1, 0, 1, 2, 0, 1, 2, 0, 2, 2 };
+    const int expect_n[] = { -1, -1, -1, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, -1, -1 };
+    bool forms_ok = d.vertIdx.size() == 15;
+    for (int i = 0; forms_ok && i < 15; i++)
+        forms_ok = d.vertIdx[i] == expect_v[i] && d.uvIdx[i] == expect_t[i] && d.normIdx[i] == expect_n[i];
+    std::cout << "  face forms (f v, f v//vn, negative indices, polygon): " << (forms_ok ? "ok" : "WRONG") << std::endl;
+
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    //自带的模型：结果与原来的解析逐字节相同
+    const char* files[] = { "../obj/african_head/african_head.obj", "../obj/diablo3_pose/diablo3_pose.obj",
+                            "../obj/boggie/body.obj", "../obj/boggie/head.obj", "../obj/boggie/eyes.obj", "../obj/floor/floor.obj" };
+    std::string diablo_text;
+    for (int f = 0; f < 6; f++) {
+        std::ifstream in(files[f]);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        std::string text = ss.str();
+        if (f == 1) diablo_text = text;
+
+        ObjData reference, fast;
+        auto start = std::chrono::steady_clock::now();
+        std::ifstream legacy(files[f]);
+        parse_obj_stream(legacy, reference);
+        double legacy_s = seconds(start);
+        start = std::chrono::steady_clock::now();
+        parse_obj_file(files[f], fast);
+        double fast_s = seconds(start);
+        double mb = text.size() / 1e6;
+        std::cout << "  " << files[f] << ": istringstream " << mb / legacy_s << " MB/s, mmap+fast " << mb / fast_s << " MB/s, "
+                  << (fast.identical(reference) ? "identical" : "MISMATCH") << std::endl;
+    }
+
+    //大文件：diablo3_pose重复多次，按行分块并行解析
+    std::string big;
+    for (int i = 0; i < 24; i++) big += diablo_text;
+    double mb = big.size() / 1e6;
+    ObjData serial;
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool single(1);
+    parse_obj(big.data(), big.size(), serial, &single);
+    std::cout << "  " << mb << " MB in memory, serial " << mb / seconds(start) << " MB/s" << std::endl;
+    int max_threads = std::max(4, ThreadPool::hardware_threads());
+    for (int n = 2; n <= max_threads; n *= 2) {
+        ThreadPool pool(n);
+        ObjData parallel;
+        start = std::chrono::steady_clock::now();
+        parse_obj(big.data(), big.size(), parallel, &pool);
+        std::cout << "    threads " << n << ": " << mb / seconds(start) << " MB/s, "
+                  << (parallel.identical(serial) ? "identical" : "MISMATCH") << std::endl;
+    }
+}
+
+
+
+
+//模型数据布局测试：每帧的顶点处理、三角形装配、裁剪和光栅化过程中的堆分配次数(应该为0)和耗时
+void test_model_layout() {
+    Model diablo("../obj/diablo3_pose/diablo3_pose.obj");
+    model->wait_textures();
+    diablo.wait_textures();
+    const char* names[2] = { "african_head", "diablo3_pose" };
+    TGAImage image(width, height, TGAImage::RGB);
+    float mvp[16], viewport[16];
+    matrix2floats(projection_ * view_ * model_ * camera_, mvp);
+    matrix2floats(viewport_, viewport);
+
+    for (int m = 0; m < 2; m++) {
+        Model* mesh = (m == 0 ? model : &diablo);
+        //一帧：顶点处理阶段+按索引装配三角形+裁剪+zbuffer光栅化
+        auto frame = [&]() {
+            clearzbuffer();
+            vertex_stage.set_transform(mvp, viewport);
+            vertex_stage.process(mesh->verts().data(), mesh->nverts());
+            for (int i = 0; i < mesh->nfaces(); i++) {
+                Span<int> face = mesh->face(i);
+                Vec4f clip_coords[3];
+                Vec3f projected[3];
+                for (int j = 0; j < 3; j++) {
+                    clip_coords[j] = vertex_stage.clip(face[j]);
+                    projected[j] = vertex_stage.screen(face[j]);
+                }
+                Vec3f n = (mesh->vert(face[2]) - mesh->vert(face[0])) ^ (mesh->vert(face[1]) - mesh->vert(face[0]));
+                float intensity = n.normalize() * light_dir;
+                if (intensity <= 0) continue;
+                Vec3f screen_coords[3 * CLIP_MAX_TRIANGLES];
+                Vec3f bary[3 * CLIP_MAX_TRIANGLES];
+                bool clipped;
+                int ntris = clip_project(clip_coords, screen_coords, bary, clipped, projected);
+                for (int k = 0; k < ntris; k++) {
+                    for (int j = 0; j < 3; j++) {
+                        Vec3f& v = screen_coords[k * 3 + j];
+                        v = Vec3f(static_cast<int>(v.x), static_cast<int>(v.y), static_cast<int>(v.z));
+                    }
+                    zbuffer_triangle(&screen_coords[k * 3], zbuffer, image, TGAColor(intensity * 255, intensity * 255, intensity * 255, 255));
+                }
+            }
+        };
+        frame();   //第一帧时输出缓冲扩容
+
+        const int frames = 5;
+        long long before = heap_allocation_count();
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) frame();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        size_t bytes = mesh->verts().size() * sizeof(Vec3f) + mesh->uvs().size() * sizeof(Vec2f) + mesh->normals().size() * sizeof(Vec3f)
+                     + (mesh->vert_indices().size() + mesh->uv_indices().size() + mesh->normal_indices().size()) * sizeof(int);
+        std::cout << "model layout [" << names[m] << "] " << mesh->nfaces() << " triangles, " << bytes / 1024 << " KB of flat arrays, "
+                  << ms << " ms/frame, ";
+        print_heap_allocations(before, frames);
+        std::cout << std::endl;
+    }
+
+    //带纹理的透视渲染
+    render_perspective(camera_, image);
+    long long before = heap_allocation_count();
+    render_perspective(camera_, image);
+    std::cout << "  render_perspective: ";
+    print_heap_allocations(before, 1);
+    std::cout << std::endl;
+}
+
+
+
+
+//顶点处理阶段测试：原来的做法是每个面片的每个顶点都变换一次(共享顶点重复变换)，
+//顶点处理阶段对每个不同顶点只变换一次，比较两者的结果和耗时
+void test_vertex_stage() {
+    Model diablo("../obj/diablo3_pose/diablo3_pose.obj");
+    const char* names[2] = { "african_head", "diablo3_pose" };
+    mat<4, 4> mvp_matrix = projection_ * view_ * model_ * camera_;
+    float mvp[16], viewport[16];
+    matrix2floats(mvp_matrix, mvp);
+    matrix2floats(viewport_, viewport);
+
+    for (int m = 0; m < 2; m++) {
+        Model* mesh = (m == 0 ? model : &diablo);
+        int nfaces = mesh->nfaces();
+        Span<Vec3f> verts = mesh->verts();
+
+        //原来的做法
+        std::vector<Vec3f> reference(nfaces * 3);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nfaces; i++)
+            for (int j = 0; j < 3; j++)
+                reference[i * 3 + j] = clip2screen(homo2vec4(mvp_matrix * local2homo(mesh->vert(i, j))));
+        double face_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        VertexStage vertices;
+        vertices.set_transform(mvp, viewport);
+        const int repeats = 10;
+        double stage_ms = 1e30;
+        for (int r = 0; r < repeats; r++) {
+            start = std::chrono::steady_clock::now();
+            vertices.process(verts.data(), verts.size());
+            stage_ms = std::min(stage_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        int mismatches = 0;
+        for (int i = 0; i < nfaces; i++) {
+            Span<int> face = mesh->face(i);
+            for (int j = 0; j < 3; j++)
+                mismatches += memcmp(&vertices.screen(face[j]), &reference[i * 3 + j], sizeof(Vec3f)) != 0;
+        }
+        std::cout << "vertex stage [" << names[m] << "] " << nfaces * 3 << " face vertices one by one " << face_ms
+                  << " ms, " << verts.size() << " unique vertices in batch " << stage_ms << " ms, speedup "
+                  << face_ms / stage_ms << "x, " << (mismatches ? "MISMATCH" : "identical") << std::endl;
+    }
+}
+
+
 
 
 /**************************************以上为测试代码****************************************/
@@ -700,6 +3077,41 @@ void test_shader() {
 
 int main(int argc, char** argv){
 
+    //tinyrenderer turntable [帧数] [文件名前缀]：只渲染转台动画
+    if (argc > 1 && !strcmp(argv[1], "turntable")) {
+        int nframes = argc > 2 ? std::max(1, atoi(argv[2])) : 36;
+        const char* prefix = argc > 3 ? argv[3] : "turntable_";
+        int failed;
+        double fps = render_turntable(nframes, prefix, true, failed);
+        std::cout << "turntable: " << nframes << " frames, " << fps << " fps" << std::endl;
+        if (failed) std::cerr << "turntable: " << failed << " frames failed to write" << std::endl;
+        delete[] zbuffer;
+        delete model;
+        return failed ? 1 : 0;
+    }
+
+    //tinyrenderer batch <任务列表文件> [线程数]：执行批量渲染任务(格式见batch.h)
+    if (argc > 2 && !strcmp(argv[1], "batch")) {
+        std::vector<RenderJob> jobs;
+        std::string error;
+        if (!parse_job_file(argv[2], jobs, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        int nthreads = argc > 3 ? std::max(1, atoi(argv[3])) : ThreadPool::hardware_threads();
+        ModelCache cache;
+        ThreadPool pool(nthreads);
+        std::vector<JobResult> results;
+        double ms = run_batch(jobs, cache, pool, render_job, results);
+        std::cout << "batch: " << jobs.size() << " jobs, " << nthreads << " threads, " << cache.loads() << " model loads" << std::endl;
+        print_batch_report(std::cout, jobs, results, ms);
+        delete[] zbuffer;
+        delete model;
+        int failed = 0;
+        for (const JobResult& r : results) failed += !r.ok;
+        return failed ? 1 : 0;
+    }
+
     test_line();
     test_line_model();
     test_triangle();
@@ -707,7 +3119,30 @@ int main(int argc, char** argv){
     test_zbuffer_model();
     test_zbuffer_texture_model();
     test_perspective_projection();  
+    test_clipping();
     test_shader();
+    test_tile_render();
+    test_hiz();
+    test_visibility_buffer();
+    test_vertex_stage();
+    test_matrix();
+    test_model_layout();
+    test_obj_loader();
+    test_mesh_cache();
+    test_texture_loading();
+    test_tga_decode();
+    test_tga_encode();
+    test_texture_sampling();
+    test_framebuffer();
+    test_turntable();
+    test_batch();
+    test_render_stats();
+    test_meshlets();
+    test_raycast();
+    test_shadow();
+    test_shader_dispatch();
+    test_quad_shading();
+    test_perspective_correct();
 
     delete[] zbuffer;   
     delete model;
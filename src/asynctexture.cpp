@@ -0,0 +1,74 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+#include "asynctexture.h"
+
+AsyncTexture::AsyncTexture() : state_(std::make_shared<State>()) {
+}
+
+AsyncTexture::~AsyncTexture() {
+    int expected = PENDING;
+    if (!state_->status.compare_exchange_strong(expected, CANCELLED))
+        wait();
+}
+
+void AsyncTexture::run(State& s) {
+    int expected = PENDING;
+    if (!s.status.compare_exchange_strong(expected, RUNNING)) return;   //已被别的线程领走或已取消
+    auto start = std::chrono::steady_clock::now();
+    TGAImage image;
+    s.ok = image.read_tga_file(s.filename.c_str(), true);
+    if (s.ok) s.texture.build(image);
+    s.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "texture file " << s.filename << " loading " << (s.ok ? "ok" : "failed") << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.status = DONE;
+    }
+    s.cv.notify_all();
+}
+
+void AsyncTexture::load(const std::string& filename, ThreadPool* pool) {
+    wait();
+    state_ = std::make_shared<State>();
+    state_->filename = filename;
+    state_->status = PENDING;
+    std::shared_ptr<State> s = state_;
+    if (pool) pool->enqueue([s]() { run(*s); });
+    else run(*s);
+}
+
+void AsyncTexture::wait() const {
+    State& s = *state_;
+    int status = s.status.load(std::memory_order_acquire);
+    if (status == DONE || status == EMPTY || status == CANCELLED) return;
+    if (status == PENDING) run(s);       //还没开始：在当前线程执行
+    std::unique_lock<std::mutex> lock(s.mutex);
+    s.cv.wait(lock, [&s] { return s.status != RUNNING; });
+}
+
+const Texture& AsyncTexture::get() {
+    if (state_->status.load(std::memory_order_acquire) != DONE) wait();
+    return state_->texture;
+}
+
+bool AsyncTexture::ready() const {
+    int status = state_->status.load(std::memory_order_acquire);
+    return status == DONE || status == EMPTY;
+}
+
+bool AsyncTexture::ok() {
+    wait();
+    return state_->ok;
+}
+
+double AsyncTexture::load_ms() {
+    wait();
+    return state_->ms;
+}
+
+ThreadPool& AsyncTexture::default_pool() {
+    static ThreadPool pool(std::max(2, ThreadPool::hardware_threads()));
+    return pool;
+}
@@ -0,0 +1,193 @@
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "batch.h"
+
+RenderJob::RenderJob()
+    : shader("texture"), eye(1, 0.5f, 1.5f), center(0, 0, 0), up(0, 1, 0), light(0, 0, -1), width(800), height(800) {
+}
+
+static bool parse_vec3(const std::string& s, Vec3f& v) {
+    return sscanf(s.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+bool parse_jobs(std::istream& in, std::vector<RenderJob>& jobs, std::string& error) {
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream tokens(line);
+        std::string token;
+        RenderJob job;
+        bool any = false;
+        while (tokens >> token) {
+            any = true;
+            size_t eq = token.find('=');
+            std::string key = token.substr(0, eq), value = eq == std::string::npos ? "" : token.substr(eq + 1);
+            bool ok = eq != std::string::npos && !value.empty();
+            if (!ok) {
+            } else if (key == "model") {
+                job.model = value;
+            } else if (key == "output") {
+                job.output = value;
+            } else if (key == "shader") {
+                job.shader = value;
+            } else if (key == "eye") {
+                ok = parse_vec3(value, job.eye);
+            } else if (key == "center") {
+                ok = parse_vec3(value, job.center);
+            } else if (key == "up") {
+                ok = parse_vec3(value, job.up);
+            } else if (key == "light") {
+                ok = parse_vec3(value, job.light);
+            } else if (key == "size") {
+                ok = sscanf(value.c_str(), "%dx%d", &job.width, &job.height) == 2 && job.width > 0 && job.height > 0
+                  && job.width <= 16384 && job.height <= 16384;
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                error = "line " + std::to_string(lineno) + ": bad entry '" + token + "'";
+                return false;
+            }
+        }
+        if (!any) continue;
+        if (job.model.empty() || job.output.empty()) {
+            error = "line " + std::to_string(lineno) + ": model and output are required";
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool parse_job_file(const char* filename, std::vector<RenderJob>& jobs, std::string& error) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        error = std::string("can't open job file ") + filename;
+        return false;
+    }
+    return parse_jobs(in, jobs, error);
+}
+
+ModelCache::ModelCache() : loads_(0) {
+}
+
+std::shared_ptr<Model> ModelCache::get(const std::string& path) {
+    std::promise<std::shared_ptr<Model> > promise;
+    std::shared_future<std::shared_ptr<Model> > future;
+    bool load = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = models_.find(path);
+        if (it != models_.end()) {
+            future = it->second;
+        } else {
+            future = promise.get_future().share();
+            models_[path] = future;
+            loads_++;
+            load = true;
+        }
+    }
+    if (load) {
+        //不持锁加载，其他模型可以同时加载；请求同一模型的线程在future上等待
+        try {
+            std::shared_ptr<Model> model = std::make_shared<Model>(path.c_str());
+            model->wait_textures();
+            promise.set_value(model);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+    return future.get();
+}
+
+int ModelCache::loads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loads_;
+}
+
+void ModelCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    models_.clear();
+}
+
+double run_batch(const std::vector<RenderJob>& jobs, ModelCache& cache, ThreadPool& pool,
+                 const RenderJobFn& render, std::vector<JobResult>& results) {
+    typedef std::chrono::steady_clock Clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    results.assign(jobs.size(), JobResult());
+    //每个线程的帧缓冲和输出图像，按线程编号索引
+    std::vector<std::unique_ptr<Framebuffer> > buffers(pool.size());
+    std::vector<std::unique_ptr<TGAImage> > images(pool.size());
+
+    Clock::time_point begin = Clock::now();
+    pool.parallel_for((int)jobs.size(), [&](int i, int thread) {
+        const RenderJob& job = jobs[i];
+        JobResult& r = results[i];
+        r.thread = thread;
+        Clock::time_point t0 = Clock::now();
+        std::shared_ptr<Model> mesh;
+        try {
+            mesh = cache.get(job.model);
+        } catch (const std::exception& e) {
+            r.error = e.what();
+        }
+        Clock::time_point t1 = Clock::now();
+        r.modelMs = ms(t0, t1);
+        if (!mesh || mesh->nfaces() == 0) {
+            if (r.error.empty()) r.error = "can't load model " + job.model;
+            r.totalMs = ms(t0, t1);
+            return;
+        }
+
+        std::unique_ptr<Framebuffer>& fb = buffers[thread];
+        if (!fb || fb->width() != job.width || fb->height() != job.height)
+            fb.reset(new Framebuffer(job.width, job.height, Framebuffer::RGBA8, Framebuffer::TILED));
+        fb->clear();
+        r.ok = render(job, *mesh, *fb, r.error);
+        Clock::time_point t2 = Clock::now();
+        r.renderMs = ms(t1, t2);
+
+        if (r.ok) {
+            std::unique_ptr<TGAImage>& image = images[thread];
+            if (!image || image->get_width() != job.width || image->get_height() != job.height)
+                image.reset(new TGAImage(job.width, job.height, TGAImage::RGB));
+            fb->to_image(*image, true);
+            r.ok = image->write_tga_file(job.output.c_str());
+            if (!r.ok) r.error = "can't write " + job.output;
+        }
+        Clock::time_point t3 = Clock::now();
+        r.writeMs = ms(t2, t3);
+        r.totalMs = ms(t0, t3);
+    });
+    return ms(begin, Clock::now());
+}
+
+void print_batch_report(std::ostream& out, const std::vector<RenderJob>& jobs, const std::vector<JobResult>& results, double wallMs) {
+    int ok = 0;
+    double busy = 0;
+    long long pixels = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RenderJob& job = jobs[i];
+        const JobResult& r = results[i];
+        size_t slash = job.model.find_last_of("/\\");
+        out << "  job " << i << " [" << (slash == std::string::npos ? job.model : job.model.substr(slash + 1)) << " " << job.shader << " " << job.width << "x" << job.height << " " << job.output << "] thread " << r.thread
+            << ": model " << r.modelMs << " ms, render " << r.renderMs << " ms, write " << r.writeMs << " ms, total " << r.totalMs << " ms";
+        if (!r.ok) out << " FAILED: " << r.error;
+        out << std::endl;
+        if (r.ok) {
+            ok++;
+            pixels += (long long)job.width * job.height;
+        }
+        busy += r.totalMs;
+    }
+    double seconds = wallMs / 1000;
+    out << "  " << ok << "/" << jobs.size() << " jobs in " << wallMs << " ms: " << (seconds > 0 ? ok / seconds : 0) << " jobs/s, "
+        << (seconds > 0 ? pixels / seconds / 1e6 : 0) << " Mpixels/s, sum of job times " << busy << " ms" << std::endl;
+}
@@ -0,0 +1,419 @@
+#include <cmath>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "bvh.h"
+#include "rasterizer.h"
+
+namespace {
+
+//包围盒，分量用数组存放，便于按轴下标访问
+struct Bounds {
+    float lo[3], hi[3];
+    Bounds() {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = 1e30f;
+            hi[a] = -1e30f;
+        }
+    }
+    void grow(const float* p) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], p[a]);
+            hi[a] = std::max(hi[a], p[a]);
+        }
+    }
+    void grow(const Vec3f& p) {
+        float f[3] = { p.x, p.y, p.z };
+        grow(f);
+    }
+    void grow(const Bounds& b) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], b.lo[a]);
+            hi[a] = std::max(hi[a], b.hi[a]);
+        }
+    }
+    float area() const {
+        float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+        if (dx < 0) return 0;
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+};
+
+struct Center {
+    float c[3];
+};
+
+//二叉树节点，left < 0 为叶子(prims中[first, first+count)的三角形)
+struct BuildNode {
+    Bounds box;
+    int left, right;
+    int first, count;
+};
+
+//二叉树构建：节点预先分配(最多2n-1个)，并行构建的子树用原子计数领取节点序号
+struct Builder {
+    const std::vector<Bounds>& boxes;
+    const std::vector<Center>& centers;
+    std::vector<int>& prims;
+    std::vector<BuildNode> nodes;
+    std::atomic<int> used;
+    ThreadPool* pool;
+
+    static const int PARALLEL_MIN = 4096;   //三角形数不少于这个值的节点，两个子树并行构建
+    static const int MAX_SAH_DEPTH = 64;    //更深的节点按中位数划分，限制树的深度(遍历栈的大小)
+
+    Builder(const std::vector<Bounds>& b, const std::vector<Center>& c, std::vector<int>& p, ThreadPool* tp)
+        : boxes(b), centers(c), prims(p), nodes(std::max<size_t>(1, p.size() * 2)), used(1), pool(tp) {}
+
+    void build(int index, int first, int count, int depth) {
+        BuildNode& node = nodes[index];
+        Bounds box, cbox;
+        for (int i = first; i < first + count; i++) {
+            box.grow(boxes[prims[i]]);
+            cbox.grow(centers[prims[i]].c);
+        }
+        node.box = box;
+        node.left = node.right = -1;
+        node.first = first;
+        node.count = count;
+        if (count <= BVH_MIN_LEAF) return;
+
+        //按重心分桶(三个轴在同一遍中完成)，从左右两边扫描累计包围盒，
+        //划分代价 = 1 + (Al*Nl + Ar*Nr)/A，叶子代价 = N
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = 1e30f;
+        float scale[3];
+        if (depth < MAX_SAH_DEPTH) {
+            Bounds binBox[3][BVH_BINS];
+            int binCount[3][BVH_BINS] = { { 0 } };
+            for (int a = 0; a < 3; a++)
+                scale[a] = cbox.hi[a] > cbox.lo[a] ? BVH_BINS / (cbox.hi[a] - cbox.lo[a]) : 0;
+            for (int i = first; i < first + count; i++) {
+                const float* c = centers[prims[i]].c;
+                const Bounds& b = boxes[prims[i]];
+                for (int a = 0; a < 3; a++) {
+                    int k = std::min(BVH_BINS - 1, (int)((c[a] - cbox.lo[a]) * scale[a]));
+                    binCount[a][k]++;
+                    binBox[a][k].grow(b);
+                }
+            }
+            for (int a = 0; a < 3; a++) {
+                if (scale[a] == 0) continue;
+                float rightArea[BVH_BINS];
+                int rightCount[BVH_BINS];
+                Bounds acc;
+                int n = 0;
+                for (int k = BVH_BINS - 1; k > 0; k--) {
+                    acc.grow(binBox[a][k]);
+                    n += binCount[a][k];
+                    rightArea[k] = acc.area();
+                    rightCount[k] = n;
+                }
+                acc = Bounds();
+                n = 0;
+                for (int k = 0; k < BVH_BINS - 1; k++) {
+                    acc.grow(binBox[a][k]);
+                    n += binCount[a][k];
+                    if (n == 0 || rightCount[k + 1] == 0) continue;
+                    float cost = acc.area() * n + rightArea[k + 1] * rightCount[k + 1];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestSplit = k + 1;
+                    }
+                }
+            }
+        }
+        float area = box.area();
+        float splitCost = area > 0 ? 1 + bestCost / area : 1e30f;
+        if (count <= BVH_MAX_LEAF && (bestAxis < 0 || count <= splitCost)) return;
+
+        int mid;
+        if (bestAxis >= 0) {
+            int axis = bestAxis, split = bestSplit;
+            float lo = cbox.lo[axis], s = scale[axis];
+            int* p = std::partition(&prims[first], &prims[first] + count, [&](int t) {
+                return std::min(BVH_BINS - 1, (int)((centers[t].c[axis] - lo) * s)) < split;
+            });
+            mid = (int)(p - &prims[0]);
+        } else {
+            //重心重合或者树太深：按最长轴的中位数划分
+            int axis = 0;
+            for (int a = 1; a < 3; a++)
+                if (cbox.hi[a] - cbox.lo[a] > cbox.hi[axis] - cbox.lo[axis]) axis = a;
+            mid = first + count / 2;
+            std::nth_element(&prims[first], &prims[mid], &prims[first] + count, [&](int a, int b) {
+                return centers[a].c[axis] < centers[b].c[axis];
+            });
+        }
+
+        int left = used.fetch_add(2);
+        node.left = left;
+        node.right = left + 1;
+        int rightFirst = mid, rightCount = first + count - mid;
+        if (pool && count >= PARALLEL_MIN) {
+            pool->parallel_for(2, [&](int i, int) {
+                if (i == 0) build(left, first, mid - first, depth + 1);
+                else build(left + 1, rightFirst, rightCount, depth + 1);
+            });
+        } else {
+            build(left, first, mid - first, depth + 1);
+            build(left + 1, rightFirst, rightCount, depth + 1);
+        }
+    }
+};
+
+//遍历栈的大小：D层的4叉树深度优先遍历时，每层最多留下3个还没访问的兄弟，再加最后压入的4个子节点，共3D+1项；
+//MAX_SAH_DEPTH层以下按中位数划分，叶子编码中三角形序号小于2^27，再分27层就到叶子，合并成4叉树不会更深
+const int MAX_TREE_DEPTH = Builder::MAX_SAH_DEPTH + 28;
+const int STACK_SIZE = 3 * MAX_TREE_DEPTH + 1;
+
+void set_slot(Bvh::Node& n, int i, const Bounds& b, int child) {
+    n.minx[i] = b.lo[0]; n.miny[i] = b.lo[1]; n.minz[i] = b.lo[2];
+    n.maxx[i] = b.hi[0]; n.maxy[i] = b.hi[1]; n.maxz[i] = b.hi[2];
+    n.child[i] = child;
+}
+
+int leaf_child(int first, int count) {
+    return ~((first << 4) | count);
+}
+
+//把二叉树的内部节点b和它下面一层合并成一个4叉树节点：反复展开表面积最大的内部子节点，直到有4个子节点
+int collapse(const std::vector<BuildNode>& bin, int b, std::vector<Bvh::Node>& out, BvhBuildStats& stats, int depth) {
+    int slots[4] = { bin[b].left, bin[b].right, -1, -1 };
+    int n = 2;
+    while (n < 4) {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < n; i++) {
+            const BuildNode& c = bin[slots[i]];
+            if (c.left >= 0 && c.box.area() > bestArea) {
+                bestArea = c.box.area();
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int expanded = slots[best];
+        slots[best] = bin[expanded].left;
+        slots[n++] = bin[expanded].right;
+    }
+
+    int index = (int)out.size();
+    out.push_back(Bvh::Node());
+    stats.maxDepth = std::max(stats.maxDepth, depth + 1);
+    for (int i = 0; i < 4; i++) {
+        if (i >= n) {
+            set_slot(out[index], i, Bounds(), leaf_child(0, 0));
+            continue;
+        }
+        const BuildNode& c = bin[slots[i]];
+        int child;
+        if (c.left < 0) {
+            child = leaf_child(c.first, c.count);
+            stats.leaves++;
+        } else {
+            child = collapse(bin, slots[i], out, stats, depth + 1);
+        }
+        set_slot(out[index], i, c.box, child);
+    }
+    return index;
+}
+
+}
+
+Bvh::Bvh() {
+}
+
+void Bvh::build(Span<Vec3f> verts, Span<int> vertIdx, ThreadPool* pool) {
+    auto start = std::chrono::steady_clock::now();
+    nodes_.clear();
+    tris_.clear();
+    stats_ = BvhBuildStats();
+    int nfaces = vertIdx.size() / 3;
+
+    std::vector<Bounds> boxes(nfaces);
+    std::vector<Center> centers(nfaces);
+    std::vector<int> prims(nfaces);
+    for (int f = 0; f < nfaces; f++) {
+        for (int j = 0; j < 3; j++) boxes[f].grow(verts[vertIdx[f * 3 + j]]);
+        for (int a = 0; a < 3; a++) centers[f].c[a] = (boxes[f].lo[a] + boxes[f].hi[a]) * 0.5f;
+        prims[f] = f;
+    }
+
+    Builder builder(boxes, centers, prims, pool);
+    if (nfaces > 0) builder.build(0, 0, nfaces, 0);
+
+    //三角形按叶子的顺序存放
+    tris_.resize(nfaces);
+    for (int i = 0; i < nfaces; i++) {
+        int f = prims[i];
+        Vec3f v0 = verts[vertIdx[f * 3]];
+        tris_[i].v0 = v0;
+        tris_[i].e1 = verts[vertIdx[f * 3 + 1]] - v0;
+        tris_[i].e2 = verts[vertIdx[f * 3 + 2]] - v0;
+        tris_[i].face = f;
+    }
+
+    const std::vector<BuildNode>& bin = builder.nodes;
+    if (nfaces > 0 && bin[0].left >= 0) {
+        collapse(bin, 0, nodes_, stats_, 0);
+    } else {
+        //只有一个叶子(或者没有三角形)时根节点的第一个子节点就是叶子
+        nodes_.push_back(Node());
+        for (int i = 0; i < 4; i++) set_slot(nodes_[0], i, Bounds(), leaf_child(0, 0));
+        if (nfaces > 0) {
+            set_slot(nodes_[0], 0, bin[0].box, leaf_child(0, nfaces));
+            stats_.leaves = 1;
+        }
+        stats_.maxDepth = 1;
+    }
+    assert(3 * stats_.maxDepth + 1 <= STACK_SIZE);
+    stats_.nodes = (int)nodes_.size();
+    stats_.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+namespace {
+
+//遍历时每条光线不变的量：方向的倒数，以及每个轴上近/远平面在Node中的偏移(方向为负时近平面是max)
+struct RaySetup {
+    float org[3], inv[3];
+    int nearOff[3], farOff[3];
+    RaySetup(const Ray& ray) {
+        float d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+        float o[3] = { ray.org.x, ray.org.y, ray.org.z };
+        for (int a = 0; a < 3; a++) {
+            //方向分量为0时用很小的数代替，避免0*inf
+            float da = std::fabs(d[a]) > 1e-20f ? d[a] : (d[a] < 0 ? -1e-20f : 1e-20f);
+            org[a] = o[a];
+            inv[a] = 1 / da;
+            nearOff[a] = (inv[a] >= 0 ? a : a + 3) * 4;
+            farOff[a] = (inv[a] >= 0 ? a + 3 : a) * 4;
+        }
+    }
+};
+
+//一个节点的4个子包围盒与光线(0, tmax)段求交，返回击中的掩码，tnear[i]为进入距离
+inline int intersect_node(const Bvh::Node& node, const RaySetup& r, float tmax, float* tnear) {
+    const float* base = node.minx;
+#if RASTER_SSE2
+    __m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_set1_ps(r.org[a]), inv = _mm_set1_ps(r.inv[a]);
+        t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + r.nearOff[a]), o), inv));
+        t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + r.farOff[a]), o), inv));
+    }
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        float t0 = 0, t1 = tmax;
+        for (int a = 0; a < 3; a++) {
+            t0 = std::max(t0, (base[r.nearOff[a] + i] - r.org[a]) * r.inv[a]);
+            t1 = std::min(t1, (base[r.farOff[a] + i] - r.org[a]) * r.inv[a]);
+        }
+        tnear[i] = t0;
+        mask |= (t0 <= t1) << i;
+    }
+    return mask;
+#endif
+}
+
+//Möller-Trumbore求交，t在(0, tmax)内时返回true
+inline bool intersect_triangle(const Bvh::Triangle& tri, const Ray& ray, bool cullBack, float tmax, float& t, float& u, float& v) {
+    Vec3f p = ray.dir ^ tri.e2;
+    float det = tri.e1 * p;
+    //det = -dir·((v1-v0)^(v2-v0))，正面朝向光线时det > 0
+    if (cullBack ? det <= 0 : det == 0) return false;
+    float inv = 1 / det;
+    Vec3f s = ray.org - tri.v0;
+    u = (s * p) * inv;
+    if (u < 0 || u > 1) return false;
+    Vec3f q = s ^ tri.e1;
+    v = (ray.dir * q) * inv;
+    if (v < 0 || u + v > 1) return false;
+    t = (tri.e2 * q) * inv;
+    return t > 0 && t < tmax;
+}
+
+}
+
+bool Bvh::intersect(const Ray& ray, RayHit& hit, bool cullBack) const {
+    if (tris_.empty()) return false;
+    RaySetup r(ray);
+    float tmax = std::min(ray.tmax, hit.t);
+    bool found = false;
+    //栈中保存子节点和进入距离，出栈时进入距离已经超过当前最近交点的直接跳过
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+    stack[sp] = 0;
+    stackT[sp++] = 0;
+    while (sp > 0) {
+        sp--;
+        if (stackT[sp] > tmax) continue;
+        int child = stack[sp];
+        if (child < 0) {
+            int first = (~child) >> 4, count = (~child) & 15;
+            for (int i = first; i < first + count; i++) {
+                float t, u, v;
+                if (intersect_triangle(tris_[i], ray, cullBack, tmax, t, u, v)) {
+                    tmax = t;
+                    hit.t = t;
+                    hit.face = tris_[i].face;
+                    hit.u = u;
+                    hit.v = v;
+                    found = true;
+                }
+            }
+            continue;
+        }
+        const Node& node = nodes_[child];
+        float tnear[4];
+        int mask = intersect_node(node, r, tmax, tnear);
+        //按进入距离从远到近入栈，最近的先出栈
+        int order[4], n = 0;
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            int k = n++;
+            while (k > 0 && tnear[order[k - 1]] < tnear[i]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = i;
+        }
+        assert(sp + n <= STACK_SIZE);
+        for (int k = 0; k < n; k++) {
+            stack[sp] = node.child[order[k]];
+            stackT[sp++] = tnear[order[k]];
+        }
+    }
+    return found;
+}
+
+bool Bvh::occluded(const Ray& ray) const {
+    if (tris_.empty()) return false;
+    RaySetup r(ray);
+    int stack[STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        int child = stack[--sp];
+        if (child < 0) {
+            int first = (~child) >> 4, count = (~child) & 15;
+            for (int i = first; i < first + count; i++) {
+                float t, u, v;
+                if (intersect_triangle(tris_[i], ray, false, ray.tmax, t, u, v)) return true;
+            }
+            continue;
+        }
+        const Node& node = nodes_[child];
+        float tnear[4];
+        assert(sp + 4 <= STACK_SIZE);
+        for (int mask = intersect_node(node, r, ray.tmax, tnear); mask; mask &= mask - 1)
+            stack[sp++] = node.child[raster_lowest_bit(mask)];
+    }
+    return false;
+}
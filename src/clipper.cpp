@@ -0,0 +1,61 @@
+#include "clipper.h"
+
+const int CLIP_PLANES = 5;
+
+//顶点到第i个平面的有向距离，非负表示在内侧
+static float plane_distance(const Vec4f& v, int plane, const ClipParams& p) {
+    switch (plane) {
+    case 0:  return v.w - p.nearW;
+    case 1:  return p.guardX * v.w - v.x;
+    case 2:  return p.guardX * v.w + v.x;
+    case 3:  return p.guardY * v.w - v.y;
+    default: return p.guardY * v.w + v.y;
+    }
+}
+
+ClipParams ClipParams::guard_band(int width, int height, int guardPixels) {
+    return ClipParams(1.f + 2.f * guardPixels / width, 1.f + 2.f * guardPixels / height);
+}
+
+bool clip_trivial(const Vec4f* pos, const ClipParams& params, bool* outside) {
+    bool inside = true;
+    if (outside) *outside = false;
+    for (int plane = 0; plane < CLIP_PLANES; plane++) {
+        int n = 0;
+        for (int i = 0; i < 3; i++)
+            if (plane_distance(pos[i], plane, params) < 0) n++;
+        if (n == 3 && outside) *outside = true;
+        if (n > 0) inside = false;
+    }
+    return inside;
+}
+
+int clip_triangle(const Vec4f* pos, const ClipParams& params, ClipVertex* out) {
+    ClipVertex buf[2][CLIP_MAX_VERTS];
+    ClipVertex* src = buf[0];
+    ClipVertex* dst = buf[1];
+    int n = 3;
+    src[0] = ClipVertex(pos[0], Vec3f(1, 0, 0));
+    src[1] = ClipVertex(pos[1], Vec3f(0, 1, 0));
+    src[2] = ClipVertex(pos[2], Vec3f(0, 0, 1));
+
+    for (int plane = 0; plane < CLIP_PLANES && n > 0; plane++) {
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            const ClipVertex& a = src[i];
+            const ClipVertex& b = src[(i + 1) % n];
+            float da = plane_distance(a.pos, plane, params);
+            float db = plane_distance(b.pos, plane, params);
+            if (da >= 0) dst[m++] = a;
+            //边跨过平面时加入交点，位置和重心坐标按同一个比例线性插值
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                dst[m++] = ClipVertex(a.pos + (b.pos - a.pos) * t, a.bary + (b.bary - a.bary) * t);
+            }
+        }
+        n = m;
+        ClipVertex* tmp = src; src = dst; dst = tmp;
+    }
+    for (int i = 0; i < n; i++) out[i] = src[i];
+    return n < 3 ? 0 : n;
+}
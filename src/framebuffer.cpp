@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+
+#include "framebuffer.h"
+
+Framebuffer::Framebuffer(int width, int height, Format format, Layout layout)
+    : width_(width), height_(height), format_(format), layout_(layout), depth_(NULL) {
+    colorWords_ = format == RGBA8 ? 1 : 4;
+    tilesX_ = (width + TILE - 1) / TILE;
+    tilesY_ = (height + TILE - 1) / TILE;
+    tileWords_ = TILE * TILE * (colorWords_ + 1);
+    if (layout == LINEAR) {
+        storage_.resize((size_t)width * height * (colorWords_ + 1));
+        depth_ = &storage_[0] + (size_t)width * height * colorWords_;
+    } else {
+        storage_.resize((size_t)tilesX_ * tilesY_ * tileWords_);   //右边和下边不足一块的部分也按整块分配
+    }
+    clear();
+}
+
+void Framebuffer::write_span(int x, int y, int n, const uint32_t* colors) {
+    while (n > 0) {
+        int k = std::min(n, span(x));
+        memcpy(color(x, y), colors, k * sizeof(uint32_t));
+        x += k;
+        colors += k;
+        n -= k;
+    }
+}
+
+void Framebuffer::write_span(int x, int y, int n, const float* colors) {
+    while (n > 0) {
+        int k = std::min(n, span(x));
+        memcpy(color_f(x, y), colors, k * 4 * sizeof(float));
+        x += k;
+        colors += k * 4;
+        n -= k;
+    }
+}
+
+void Framebuffer::clear(const TGAColor& c, float depth) {
+    uint32_t color[4];
+    if (format_ == RGBA8) {
+        color[0] = pack(c);
+    } else {
+        for (int i = 0; i < 4; i++) {
+            float f = (float)c.bgra[i];
+            memcpy(&color[i], &f, 4);
+        }
+    }
+    uint32_t d;
+    memcpy(&d, &depth, 4);
+    //先按布局填好一块(LINEAR时是整个颜色平面和深度平面)，块与块的内容相同
+    size_t colorWords = layout_ == LINEAR ? (size_t)width_ * height_ * colorWords_ : (size_t)TILE * TILE * colorWords_;
+    size_t blockWords = layout_ == LINEAR ? storage_.size() : (size_t)tileWords_;
+    for (size_t i = 0; i < colorWords; i += colorWords_)
+        for (int k = 0; k < colorWords_; k++) storage_[i + k] = color[k];
+    std::fill(storage_.begin() + colorWords, storage_.begin() + blockWords, d);
+    for (size_t b = blockWords; b < storage_.size(); b += blockWords)
+        memcpy(&storage_[b], &storage_[0], blockWords * sizeof(uint32_t));
+}
+
+bool Framebuffer::to_image(TGAImage& image, bool flip) const {
+    if (image.get_width() != width_ || image.get_height() != height_ || !image.buffer()) return false;
+    int bpp = image.get_bytespp();
+    unsigned char* out = image.buffer();
+    for (int y = 0; y < height_; y++) {
+        unsigned char* row = out + (size_t)(flip ? height_ - 1 - y : y) * width_ * bpp;
+        for (int x = 0; x < width_; ) {
+            int n = std::min(span(x), width_ - x);
+            const uint32_t* src = pixel(x, y);
+            if (format_ == RGBA8) {
+                const unsigned char* b = reinterpret_cast<const unsigned char*>(src);
+                unsigned char* d = row + x * bpp;
+                if (bpp == 4) {
+                    memcpy(d, b, n * 4);
+                } else if (bpp == 3) {
+                    for (int i = 0; i < n; i++, d += 3, b += 4) {
+                        d[0] = b[0];
+                        d[1] = b[1];
+                        d[2] = b[2];
+                    }
+                } else {
+                    for (int i = 0; i < n; i++) d[i] = b[i * 4];
+                }
+            } else {
+                const float* f = reinterpret_cast<const float*>(src);
+                for (int i = 0; i < n; i++)
+                    for (int k = 0; k < bpp; k++) {
+                        float v = std::min(std::max(f[i * 4 + k], 0.f), 255.f);
+                        row[(x + i) * bpp + k] = (unsigned char)(v + 0.5f);
+                    }
+            }
+            x += n;
+        }
+    }
+    return true;
+}
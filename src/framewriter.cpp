@@ -0,0 +1,104 @@
+#include <chrono>
+
+#include "framewriter.h"
+
+FrameWriter::FrameWriter(int width, int height, int nbuffers, Framebuffer::Format format, Framebuffer::Layout layout)
+    : image_(width, height, TGAImage::RGB), stop_(false), busy_(0), written_(0), failed_(0), writeMs_(0) {
+    for (int i = 0; i < (nbuffers < 1 ? 1 : nbuffers); i++) {
+        buffers_.push_back(std::unique_ptr<Framebuffer>(new Framebuffer(width, height, format, layout)));
+        free_.push_back(buffers_.back().get());
+    }
+    //只有一个硬件线程时写线程不能和渲染重叠，只会多出线程切换，直接在submit中写
+    if (std::thread::hardware_concurrency() > 1)
+        thread_ = std::thread(&FrameWriter::writerLoop, this);
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+bool FrameWriter::background() const {
+    return thread_.joinable();
+}
+
+Framebuffer& FrameWriter::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !free_.empty(); });
+    Framebuffer* fb = free_.front();
+    free_.pop_front();
+    return *fb;
+}
+
+void FrameWriter::submit(Framebuffer& fb, const std::string& filename) {
+    Job job = { &fb, filename };
+    if (!background()) {
+        write(job);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(job);
+    }
+    cv_.notify_all();
+}
+
+void FrameWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return pending_.empty() && busy_ == 0; });
+}
+
+void FrameWriter::write(const Job& job) {
+    auto start = std::chrono::steady_clock::now();
+    job.fb->to_image(image_, true);
+    //转换完帧缓冲就可以还回去，渲染线程不用等文件写完；放在队首，下一次acquire先取刚用过(还在缓存里)的
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_front(job.fb);
+    }
+    cv_.notify_all();
+    bool ok = image_.write_tga_file(job.filename.c_str());
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = 0;
+        if (ok) written_++;
+        else failed_++;
+        writeMs_ += ms;
+    }
+    cv_.notify_all();
+}
+
+void FrameWriter::writerLoop() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            if (pending_.empty()) return;   //stop_且已写完
+            job = pending_.front();
+            pending_.pop_front();
+            busy_ = 1;
+        }
+        write(job);
+    }
+}
+
+int FrameWriter::written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+int FrameWriter::failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+double FrameWriter::write_ms() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return writeMs_;
+}
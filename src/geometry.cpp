@@ -57,7 +57,16 @@ Mat3f Mat3f::transpose()
 
 Mat3f Mat3f::inverse()
 {
-	return Mat3f::identity();
+	mat<3, 3> m;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			m[i][j] = rows[i][j];
+	m = m.inverse();
+	Mat3f result;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			result[i][j] = m[i][j];
+	return result;
 }
 
 Mat3f Mat3f::identity()
@@ -140,7 +149,16 @@ Mat4f Mat4f::transpose()
 
 Mat4f Mat4f::inverse()
 {
-	return Mat4f::identity();
+	mat<4, 4> m;
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			m[i][j] = rows[i][j];
+	m = m.inverse();
+	Mat4f result;
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			result[i][j] = m[i][j];
+	return result;
 }
 
 Mat4f Mat4f::identity()
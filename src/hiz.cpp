@@ -0,0 +1,112 @@
+#include <limits>
+
+#include "hiz.h"
+
+HiZBuffer::HiZBuffer(float* depth, int width, int height)
+    : depth_(depth), width_(width), height_(height),
+      tilesX_((width + TILE - 1) / TILE), tilesY_((height + TILE - 1) / TILE),
+      coarseX_((width + COARSE - 1) / COARSE), coarseY_((height + COARSE - 1) / COARSE),
+      tileMin_(tilesX_ * tilesY_), tileMax_(tilesX_ * tilesY_), dirty_(tilesX_ * tilesY_),
+      coarseMin_(coarseX_ * coarseY_), coarseDirty_(coarseX_ * coarseY_),
+      enabled_(false), skippedPixels_(0), rejectedTiles_(0), rejectedTriangles_(0) {
+    clear();
+}
+
+float* HiZBuffer::depth() {
+    return depth_;
+}
+
+void HiZBuffer::clear() {
+    const float far = -std::numeric_limits<float>::max();
+    std::fill(tileMin_.begin(), tileMin_.end(), far);
+    std::fill(tileMax_.begin(), tileMax_.end(), far);
+    std::fill(dirty_.begin(), dirty_.end(), 0);
+    std::fill(coarseMin_.begin(), coarseMin_.end(), far);
+    std::fill(coarseDirty_.begin(), coarseDirty_.end(), 0);
+}
+
+void HiZBuffer::set_enabled(bool enabled) {
+    enabled_ = enabled;
+}
+
+bool HiZBuffer::enabled() const {
+    return enabled_;
+}
+
+void HiZBuffer::reset_counters() {
+    skippedPixels_ = 0;
+    rejectedTiles_ = 0;
+    rejectedTriangles_ = 0;
+}
+
+long long HiZBuffer::skipped_pixels() const {
+    return skippedPixels_.load();
+}
+
+long long HiZBuffer::rejected_tiles() const {
+    return rejectedTiles_.load();
+}
+
+long long HiZBuffer::rejected_triangles() const {
+    return rejectedTriangles_.load();
+}
+
+//粗块的最小深度只会增大，过期的值(包括还没重新统计的8x8块)偏小，用来剔除仍然是保守的，所以只在查询时才重新统计
+float HiZBuffer::coarse_min(int c) {
+    if (coarseDirty_[c]) {
+        int cx = c % coarseX_, cy = c / coarseX_;
+        int r = COARSE / TILE;
+        float m = std::numeric_limits<float>::max();
+        for (int ty = cy * r; ty < std::min(tilesY_, (cy + 1) * r); ty++)
+            for (int tx = cx * r; tx < std::min(tilesX_, (cx + 1) * r); tx++)
+                m = std::min(m, tileMin_[tx + ty * tilesX_]);
+        coarseMin_[c] = m;
+        coarseDirty_[c] = 0;
+    }
+    return coarseMin_[c];
+}
+
+void HiZBuffer::update_tile(int tx, int ty) {
+    int x0 = tx * TILE, y0 = ty * TILE;
+    int x1 = std::min(width_, x0 + TILE), y1 = std::min(height_, y0 + TILE);
+    float mn, mx;
+#if RASTER_SSE2
+    if (x1 - x0 == TILE) {
+        __m128 vmin = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 vmax = _mm_set1_ps(-std::numeric_limits<float>::max());
+        for (int y = y0; y < y1; y++) {
+            const float* row = depth_ + y * width_ + x0;
+            __m128 a = _mm_loadu_ps(row), b = _mm_loadu_ps(row + 4);
+            vmin = _mm_min_ps(vmin, _mm_min_ps(a, b));
+            vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+        }
+        float lo[4], hi[4];
+        _mm_storeu_ps(lo, vmin);
+        _mm_storeu_ps(hi, vmax);
+        mn = std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3]));
+        mx = std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]));
+    } else
+#endif
+    {
+        mn = std::numeric_limits<float>::max();
+        mx = -std::numeric_limits<float>::max();
+        for (int y = y0; y < y1; y++) {
+            const float* row = depth_ + y * width_;
+            for (int x = x0; x < x1; x++) {
+                mn = std::min(mn, row[x]);
+                mx = std::max(mx, row[x]);
+            }
+        }
+    }
+    int t = tx + ty * tilesX_;
+    tileMin_[t] = mn;
+    tileMax_[t] = mx;
+    dirty_[t] = 0;
+}
+
+void HiZBuffer::mark_dirty(int tx, int ty, float zmax) {
+    int t = tx + ty * tilesX_;
+    tileMax_[t] = std::max(tileMax_[t], zmax);
+    dirty_[t] = 1;
+    coarseDirty_[tx * TILE / COARSE + (ty * TILE / COARSE) * coarseX_] = 1;
+}
@@ -0,0 +1,94 @@
+#include <cstdio>
+
+#include "mappedfile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MAPPEDFILE_MMAP 1
+#endif
+
+MappedFile::MappedFile() : data_(NULL), size_(0), mapped_(false) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char* filename, bool copyOnWrite) {
+    close();
+#if MAPPEDFILE_MMAP
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ == 0) {
+        ::close(fd);
+        buffer_.resize(1, 0);
+        data_ = &buffer_[0];
+        return true;
+    }
+    void* p = mmap(NULL, size_, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);   //映射建立之后文件描述符就不再需要了
+    if (p == MAP_FAILED) {
+        size_ = 0;
+        return false;
+    }
+    data_ = (char*)p;
+    mapped_ = true;
+    return true;
+#else
+    (void)copyOnWrite;   //读进来的缓冲区本来就可写
+    FILE* f = fopen(filename, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n < 0) {
+        fclose(f);
+        return false;
+    }
+    buffer_.resize(n + 1);
+    size_ = fread(&buffer_[0], 1, n, f);
+    fclose(f);
+    buffer_[size_] = 0;
+    data_ = &buffer_[0];
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#if MAPPEDFILE_MMAP
+    if (mapped_) munmap((void*)data_, size_);
+#endif
+    std::vector<char>().swap(buffer_);
+    data_ = NULL;
+    size_ = 0;
+    mapped_ = false;
+}
+
+const char* MappedFile::data() const {
+    return data_;
+}
+
+char* MappedFile::mutable_data() {
+    return data_;
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
+
+bool MappedFile::is_open() const {
+    return data_ != NULL;
+}
+
+bool MappedFile::is_mapped() const {
+    return mapped_;
+}
@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <sys/stat.h>
+
+#include "meshcache.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define MESHCACHE_POSIX 1
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#endif
+
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const size_t ALIGN = 16;
+
+//读取文件的修改时间(纳秒)和大小
+static bool source_stat(const char* filename, int64_t& mtime, uint64_t& size) {
+    struct stat st;
+    if (stat(filename, &st) != 0) return false;
+#if defined(__APPLE__)
+    mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+std::string mesh_cache_path(const char* objfile) {
+    return std::string(objfile) + ".mcache";
+}
+
+uint64_t mesh_checksum(const char* data, size_t size) {
+    const uint64_t prime = 1099511628211ull;
+    uint64_t h = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; i < size; i++) h = (h ^ (unsigned char)data[i]) * prime;
+    return h;
+}
+
+//在path旁边创建一个唯一的临时文件并打开写入，名字写入tmp；几个进程同时生成同一个缓存时各写各的临时文件
+static FILE* open_temp_file(const std::string& path, std::string& tmp) {
+#if MESHCACHE_POSIX
+    std::vector<char> name(path.begin(), path.end());
+    const char suffix[] = ".tmp.XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) return NULL;
+    tmp = &name[0];
+    fchmod(fd, 0644);   //mkstemp创建的文件只有本用户可读
+    FILE* f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(tmp.c_str());
+    }
+    return f;
+#else
+    static std::atomic<unsigned> counter(0);
+#ifdef _WIN32
+    unsigned long pid = (unsigned long)_getpid();
+#else
+    unsigned long pid = 0;
+#endif
+    tmp = path + ".tmp." + std::to_string(pid) + "." + std::to_string(counter++);
+    return fopen(tmp.c_str(), "wb");
+#endif
+}
+
+//用from替换to：读者看到的要么是旧文件要么是新文件，不会有找不到文件的时刻
+static bool replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;   //Windows上rename不能覆盖已有文件
+#else
+    return rename(from, to) == 0;   //POSIX的rename原子地替换已有文件
+#endif
+}
+
+bool write_mesh_cache(const char* objfile, const ObjData& data) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TRMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.headerSize = sizeof(header);
+    if (!source_stat(objfile, header.sourceMtime, header.sourceSize)) return false;
+
+    const void* arrays[6] = { data.verts.data(), data.uvs.data(), data.norms.data(),
+                              data.vertIdx.data(), data.uvIdx.data(), data.normIdx.data() };
+    const size_t counts[6] = { data.verts.size(), data.uvs.size(), data.norms.size(),
+                               data.vertIdx.size(), data.uvIdx.size(), data.normIdx.size() };
+    const size_t sizes[6] = { sizeof(Vec3f), sizeof(Vec2f), sizeof(Vec3f), sizeof(int), sizeof(int), sizeof(int) };
+
+    //整个文件先在内存中拼好，一次写出
+    size_t pos = (sizeof(header) + ALIGN - 1) / ALIGN * ALIGN;
+    for (int k = 0; k < 6; k++) {
+        header.count[k] = counts[k];
+        header.offset[k] = pos;
+        pos = (pos + counts[k] * sizes[k] + ALIGN - 1) / ALIGN * ALIGN;
+    }
+    std::vector<char> buffer(pos, 0);
+    for (int k = 0; k < 6; k++)
+        if (counts[k]) memcpy(&buffer[header.offset[k]], arrays[k], counts[k] * sizes[k]);
+    header.checksum = mesh_checksum(&buffer[sizeof(header)], buffer.size() - sizeof(header));
+    memcpy(&buffer[0], &header, sizeof(header));
+
+    std::string path = mesh_cache_path(objfile);
+    std::string tmp;
+    FILE* f = open_temp_file(path, tmp);
+    if (!f) return false;
+    bool ok = fwrite(&buffer[0], 1, buffer.size(), f) == buffer.size();
+    ok = (fclose(f) == 0) && ok;
+    if (ok) ok = replace_file(tmp.c_str(), path.c_str());
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+bool open_mesh_cache(const char* objfile, MappedFile& file, MeshView& view) {
+    int64_t mtime;
+    uint64_t size;
+    if (!source_stat(objfile, mtime, size)) return false;
+    if (!file.open(mesh_cache_path(objfile).c_str())) return false;
+
+    MeshCacheHeader header;
+    bool valid = file.size() >= sizeof(header);
+    if (valid) memcpy(&header, file.data(), sizeof(header));
+    valid = valid && !memcmp(header.magic, "TRMC", 4) && header.version == MESH_CACHE_VERSION
+         && header.byteOrder == BYTE_ORDER_MARK && header.headerSize == sizeof(header)
+         && header.sourceMtime == mtime && header.sourceSize == size;
+    const size_t sizes[6] = { sizeof(Vec3f), sizeof(Vec2f), sizeof(Vec3f), sizeof(int), sizeof(int), sizeof(int) };
+    for (int k = 0; valid && k < 6; k++)
+        valid = header.offset[k] % ALIGN == 0 && header.count[k] < (1u << 31)
+             && header.offset[k] + header.count[k] * sizes[k] <= file.size();
+    valid = valid && mesh_checksum(file.data() + sizeof(header), file.size() - sizeof(header)) == header.checksum;
+    if (!valid) {
+        file.close();
+        return false;
+    }
+
+    const char* base = file.data();
+    view.verts = Span<Vec3f>((const Vec3f*)(base + header.offset[0]), (int)header.count[0]);
+    view.uvs = Span<Vec2f>((const Vec2f*)(base + header.offset[1]), (int)header.count[1]);
+    view.norms = Span<Vec3f>((const Vec3f*)(base + header.offset[2]), (int)header.count[2]);
+    view.vertIdx = Span<int>((const int*)(base + header.offset[3]), (int)header.count[3]);
+    view.uvIdx = Span<int>((const int*)(base + header.offset[4]), (int)header.count[4]);
+    view.normIdx = Span<int>((const int*)(base + header.offset[5]), (int)header.count[5]);
+    return true;
+}
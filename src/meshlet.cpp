@@ -0,0 +1,234 @@
+#include <cmath>
+#include <algorithm>
+
+#include "meshlet.h"
+
+void MeshletData::clear() {
+    meshlets.clear();
+    faces.clear();
+    vertices.clear();
+}
+
+void build_meshlets(Span<Vec3f> verts, Span<int> vertIdx, MeshletData& out) {
+    out.clear();
+    int nfaces = vertIdx.size() / 3;
+    int nverts = verts.size();
+    if (nfaces == 0) return;
+
+    //面片的单位法线(退化的面片为0)、重心和顶点到面片的邻接表
+    std::vector<Vec3f> normals(nfaces), centroids(nfaces);
+    std::vector<int> adjStart(nverts + 1, 0), adjFaces(nfaces * 3);
+    double area = 0;
+    for (int f = 0; f < nfaces; f++) {
+        const int* v = &vertIdx[f * 3];
+        Vec3f n = (verts[v[1]] - verts[v[0]]) ^ (verts[v[2]] - verts[v[0]]);
+        float len = n.norm();
+        normals[f] = len > 0 ? n * (1.f / len) : Vec3f(0, 0, 0);
+        centroids[f] = (verts[v[0]] + verts[v[1]] + verts[v[2]]) * (1.f / 3);
+        area += len * 0.5;
+        for (int j = 0; j < 3; j++) adjStart[v[j] + 1]++;
+    }
+    //面片数满的簇近似为圆盘时的半径，用来把距离化成与模型大小无关的量
+    float expectedRadius = (float)std::sqrt(area / nfaces * MESHLET_MAX_FACES / 3.14159265);
+    if (!(expectedRadius > 0)) expectedRadius = 1;
+    for (int i = 0; i < nverts; i++) adjStart[i + 1] += adjStart[i];
+    std::vector<int> fill(adjStart.begin(), adjStart.end() - 1);
+    for (int f = 0; f < nfaces; f++)
+        for (int j = 0; j < 3; j++) adjFaces[fill[vertIdx[f * 3 + j]]++] = f;
+
+    std::vector<char> assigned(nfaces, 0);
+    std::vector<int> vertMark(nverts, -1);     //顶点所在的当前簇
+    std::vector<int> faceMark(nfaces, -1);     //面片已在当前簇的候选列表中
+    std::vector<int> frontier;
+    int seed = 0;
+    while (true) {
+        while (seed < nfaces && assigned[seed]) seed++;
+        if (seed == nfaces) break;
+        int id = (int)out.meshlets.size();
+        Meshlet m;
+        m.firstFace = (int)out.faces.size();
+        m.firstVertex = (int)out.vertices.size();
+        m.faceCount = m.vertexCount = 0;
+        Vec3f normalSum(0, 0, 0), centroidSum(0, 0, 0);
+        frontier.clear();
+
+        int next = seed;
+        while (next >= 0) {
+            //加入面片，它的顶点相邻的面片成为候选
+            assigned[next] = 1;
+            out.faces.push_back(next);
+            m.faceCount++;
+            normalSum = normalSum + normals[next];
+            centroidSum = centroidSum + centroids[next];
+            for (int j = 0; j < 3; j++) {
+                int v = vertIdx[next * 3 + j];
+                if (vertMark[v] != id) {
+                    vertMark[v] = id;
+                    out.vertices.push_back(v);
+                    m.vertexCount++;
+                }
+                for (int k = adjStart[v]; k < adjStart[v + 1]; k++) {
+                    int f = adjFaces[k];
+                    if (!assigned[f] && faceMark[f] != id) {
+                        faceMark[f] = id;
+                        frontier.push_back(f);
+                    }
+                }
+            }
+            if (m.faceCount == MESHLET_MAX_FACES) break;
+
+            //优先选新增顶点最少的候选；相同时比较到簇中心的距离和法线与平均法线的夹角，
+            //使簇紧凑(包围球小)、法线集中(法线锥窄)
+            next = -1;
+            int bestSlot = -1, bestNew = 4;
+            float bestCost = 1e30f;
+            Vec3f centroid = centroidSum * (1.f / m.faceCount);
+            float len = normalSum.norm();
+            Vec3f axis = len > 0 ? normalSum * (1.f / len) : Vec3f(0, 0, 0);
+            for (int c = 0; c < (int)frontier.size(); c++) {
+                int f = frontier[c];
+                if (assigned[f]) continue;
+                int added = 0;
+                for (int j = 0; j < 3; j++) added += vertMark[vertIdx[f * 3 + j]] != id;
+                if (m.vertexCount + added > MESHLET_MAX_VERTICES || added > bestNew) continue;
+                float dist = (centroids[f] - centroid).norm();
+                float cost = (1 + dist / expectedRadius) * (1 - 0.5f * (normals[f] * axis));
+                if (added < bestNew || cost < bestCost) {
+                    bestNew = added;
+                    bestCost = cost;
+                    next = f;
+                    bestSlot = c;
+                }
+            }
+            if (bestSlot >= 0) {
+                frontier[bestSlot] = frontier.back();
+                frontier.pop_back();
+            }
+        }
+        std::sort(out.vertices.begin() + m.firstVertex, out.vertices.end());
+
+        //包围球：包围盒中心，半径为到最远顶点的距离
+        Vec3f lo = verts[out.vertices[m.firstVertex]], hi = lo;
+        for (int k = m.firstVertex; k < m.firstVertex + m.vertexCount; k++) {
+            const Vec3f& p = verts[out.vertices[k]];
+            lo = Vec3f(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+            hi = Vec3f(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+        }
+        m.center = (lo + hi) * 0.5f;
+        float r2 = 0;
+        for (int k = m.firstVertex; k < m.firstVertex + m.vertexCount; k++) {
+            Vec3f d = verts[out.vertices[k]] - m.center;
+            r2 = std::max(r2, d * d);
+        }
+        m.radius = std::sqrt(r2);
+
+        //法线锥：轴为平均法线，半角为离轴最远的法线与轴的夹角(退化的面片不参与)
+        float len = normalSum.norm();
+        m.coneAxis = len > 0 ? normalSum * (1.f / len) : Vec3f(0, 0, 1);
+        float minCos = len > 0 ? 1.f : -1.f;
+        for (int k = m.firstFace; k < m.firstFace + m.faceCount; k++) {
+            const Vec3f& n = normals[out.faces[k]];
+            if (n * n > 0) minCos = std::min(minCos, n * m.coneAxis);
+        }
+        m.coneSin = minCos > 0 ? std::sqrt(std::max(0.f, 1 - minCos * minCos)) : 2.f;
+        out.meshlets.push_back(m);
+    }
+}
+
+void MeshletCullStats::clear() {
+    meshlets = frustumCulled = coneCulled = 0;
+    faces = facesCulled = 0;
+}
+
+MeshletCullStats& MeshletCullStats::operator+=(const MeshletCullStats& s) {
+    meshlets += s.meshlets;
+    frustumCulled += s.frustumCulled;
+    coneCulled += s.coneCulled;
+    faces += s.faces;
+    facesCulled += s.facesCulled;
+    return *this;
+}
+
+MeshletCuller::MeshletCuller(const float* mvp, const float* viewport, int width, int height, float nearW)
+    : perspective_(false), eye_(0, 0, 0), forward_(0, 0, -1) {
+    const float* r0 = mvp;
+    const float* r1 = mvp + 4;
+    const float* r2 = mvp + 8;
+    const float* r3 = mvp + 12;
+    //屏幕坐标(透视除法之前) X = sx*x + ox*w，Y = sy*y + oy*w；
+    //平面 w>=nearW、-1<=X/w<=width+1、-1<=Y/w<=height+1 换回模型空间
+    for (int k = 0; k < 4; k++) {
+        float sx = viewport[0] * r0[k] + viewport[3] * r3[k];
+        float sy = viewport[5] * r1[k] + viewport[7] * r3[k];
+        planes_[0][k] = r3[k] - (k == 3 ? nearW : 0);
+        planes_[1][k] = sx + r3[k];
+        planes_[2][k] = (width + 1) * r3[k] - sx;
+        planes_[3][k] = sy + r3[k];
+        planes_[4][k] = (height + 1) * r3[k] - sy;
+    }
+    for (int p = 0; p < MESHLET_FRUSTUM_PLANES; p++) {
+        float len = std::sqrt(planes_[p][0] * planes_[p][0] + planes_[p][1] * planes_[p][1] + planes_[p][2] * planes_[p][2]);
+        if (len > 0)
+            for (int k = 0; k < 4; k++) planes_[p][k] /= len;
+    }
+
+    //视点满足 r0·(e,1) = r1·(e,1) = r3·(e,1) = 0，按克拉默法则解
+    Vec3f a(r0[0], r0[1], r0[2]), b(r1[0], r1[1], r1[2]), c(r3[0], r3[1], r3[2]);
+    Vec3f rhs(-r0[3], -r1[3], -r3[3]);
+    Vec3f bc = b ^ c;
+    float det = a * bc;
+    float scale = a.norm() * b.norm() * c.norm();
+    if (scale > 0 && std::fabs(det) > 1e-6f * scale) {
+        perspective_ = true;
+        //e = (rhs.x*(b^c) + rhs.y*(c^a) + rhs.z*(a^b)) / det
+        eye_ = (bc * rhs.x + (c ^ a) * rhs.y + (a ^ b) * rhs.z) * (1.f / det);
+    } else {
+        //正交投影：视线方向与x、y两行都垂直，朝着深度(z)减小即变远的方向
+        Vec3f d = a ^ b;
+        if (d.x * r2[0] + d.y * r2[1] + d.z * r2[2] > 0) d = d * -1.f;
+        float len = d.norm();
+        if (len > 0) forward_ = d * (1.f / len);
+    }
+}
+
+bool MeshletCuller::outside_frustum(const Meshlet& m) const {
+    for (int p = 0; p < MESHLET_FRUSTUM_PLANES; p++) {
+        const float* pl = planes_[p];
+        if (pl[0] * m.center.x + pl[1] * m.center.y + pl[2] * m.center.z + pl[3] < -m.radius) return true;
+    }
+    return false;
+}
+
+bool MeshletCuller::backfacing(const Meshlet& m) const {
+    if (m.coneSin >= 1) return false;
+    if (!perspective_) return m.coneAxis * forward_ >= m.coneSin;
+    //球内任意一点p、锥内任意法线n都满足 n·(p-eye) >= 0 的充分条件：
+    //axis·d - r >= sinθ·(|d| + r)，d为球心减视点
+    Vec3f d = m.center - eye_;
+    return m.coneAxis * d - m.radius >= m.coneSin * (d.norm() + m.radius);
+}
+
+bool MeshletCuller::facing_along(const Meshlet& m, const Vec3f& dir) {
+    //夹角不超过θ的法线与dir的夹角不超过 θ + ∠(axis,dir)，留一点余量，
+    //点积接近0的面片交给逐面片的判断
+    return m.coneSin < 1 && m.coneAxis * dir >= m.coneSin + 1e-3f;
+}
+
+void MeshletCuller::cull(const MeshletData& data, std::vector<int>& visible, int coneTest, const Vec3f& dir,
+                         MeshletCullStats* stats) const {
+    visible.clear();
+    for (int i = 0; i < (int)data.meshlets.size(); i++) {
+        const Meshlet& m = data.meshlets[i];
+        bool frustum = outside_frustum(m);
+        bool cone = !frustum && (((coneTest & MESHLET_CONE_VIEW) && backfacing(m)) ||
+                                  ((coneTest & MESHLET_CONE_DIRECTION) && facing_along(m, dir)));
+        if (stats) {
+            stats->meshlets++;
+            stats->faces += m.faceCount;
+            stats->frustumCulled += frustum;
+            stats->coneCulled += cone;
+            if (frustum || cone) stats->facesCulled += m.faceCount;
+        }
+        if (!frustum && !cone) visible.push_back(i);
+    }
+}
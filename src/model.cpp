@@ -2,121 +2,154 @@
 
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <vector>
 
+#include "objparser.h"
+#include "meshcache.h"
+
 //构造函数，输入参数是.obj文件路径
-Model::Model(const char *filename) : verts_(), faces_(), norms_(), uv_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);//打开.obj文件
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {//没有到文件末尾的话
-        std::getline(in, line);//读入一行
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {//如果这一行的前两个字符是“v ”的话，代表是顶点数据
-            iss >> trash;
-            Vec3f v;//读入顶点坐标
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);//加入顶点集
-        } 
-        //纹理内容
-        else if(!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i = 0; i < 2; i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }
-        //纹理内容
-        else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f normal;
-            for (int i = 0; i < 3; i++) iss >> normal[i];
-            norms_.push_back(normal);
-        }
-        else if (!line.compare(0, 2, "f ")) {//如果这一行的前两个字符是“f ”的话，代表是面片数据
-            std::vector<Vec3i> f;
-            Vec3i tmp;    //顶点索引，纹理坐标，法线向量
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {//读取顶点索引，
-                for (int i = 0; i < 3; i++) tmp[i]--;
-                f.push_back(tmp);
-            }
-            faces_.push_back(f);//把该面片加入模型的面片集
-        }
+//有有效的二进制缓存时直接映射缓存；否则把文件内存映射后由parse_obj解析(大文件按行切块并行解析)，
+//pool为空时由parse_obj决定是否临时创建线程池
+Model::Model(const char *filename, ThreadPool* pool, bool useCache) : storage_(), cache_() {
+    MeshView view;
+    if (!useCache || !open_mesh_cache(filename, cache_, view)) {
+        if (!parse_obj_file(filename, storage_, pool)) return;//打开.obj文件
+        if (useCache) write_mesh_cache(filename, storage_);
+        view.verts = Span<Vec3f>(storage_.verts.data(), (int)storage_.verts.size());
+        view.uvs = Span<Vec2f>(storage_.uvs.data(), (int)storage_.uvs.size());
+        view.norms = Span<Vec3f>(storage_.norms.data(), (int)storage_.norms.size());
+        view.vertIdx = Span<int>(storage_.vertIdx.data(), (int)storage_.vertIdx.size());
+        view.uvIdx = Span<int>(storage_.uvIdx.data(), (int)storage_.uvIdx.size());
+        view.normIdx = Span<int>(storage_.normIdx.data(), (int)storage_.normIdx.size());
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;  //输出顶点、面片、纹理坐标、法线向量数量
-    loadTexture(filename, "_diffuse.tga", diffusemap_);     //纹理内容
-    loadTexture(filename, "_nm.tga",      normalmap_);
-    loadTexture(filename, "_spec.tga",    specularmap_);
+    verts_ = view.verts;
+    uv_ = view.uvs;
+    norms_ = view.norms;
+    vertIdx_ = view.vertIdx;
+    uvIdx_ = view.uvIdx;
+    normIdx_ = view.normIdx;
+    build_meshlets(verts_, vertIdx_, meshlets_);
+    std::cerr << "# v# " << verts_.size() << " f# "  << nfaces() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;  //输出顶点、面片、纹理坐标、法线向量数量
+    //纹理内容：提交到线程池并行解码，几何数据就绪后构造函数就返回，第一次采样时才等待
+    ThreadPool* texturePool = pool ? pool : &AsyncTexture::default_pool();
+    loadTexture(filename, "_diffuse.tga", diffusemap_, texturePool);
+    loadTexture(filename, "_nm.tga",      normalmap_, texturePool);
+    loadTexture(filename, "_spec.tga",    specularmap_, texturePool);
 }
 
 
 Model::~Model() {
 }
 
-int Model::nverts() {
+int Model::nverts() const {
     return (int)verts_.size();
 }
 
-int Model::nfaces() {
-    return (int)faces_.size();
+int Model::nfaces() const {
+    return (int)vertIdx_.size() / 3;
 }
 
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    std::vector<Vec3i> tmp = faces_[idx];
-    for (int i = 0; i < tmp.size(); i++)
-        face.push_back(tmp[i][0]);
-    return face;
+Span<int> Model::face(int idx) const {
+    return Span<int>(&vertIdx_[idx * 3], 3);
 }
 
-Vec3f Model::vert(int i) {
+Vec3f Model::vert(int i) const {
     return verts_[i];
 }
 
-Vec3f Model::vert(int iface, int nthvert) {
-    return verts_[faces_[iface][nthvert][0]];
+Vec3f Model::vert(int iface, int nthvert) const {
+    return verts_[vertIdx_[iface * 3 + nthvert]];
+}
+
+Span<Vec3f> Model::verts() const {
+    return verts_;
+}
+
+Span<Vec2f> Model::uvs() const {
+    return uv_;
+}
+
+Span<Vec3f> Model::normals() const {
+    return norms_;
 }
 
-void Model::loadTexture(std::string filename, const char* suffix, TGAImage& image)
+Span<int> Model::vert_indices() const {
+    return vertIdx_;
+}
+
+Span<int> Model::uv_indices() const {
+    return uvIdx_;
+}
+
+Span<int> Model::normal_indices() const {
+    return normIdx_;
+}
+
+const MeshletData& Model::meshlets() const {
+    return meshlets_;
+}
+
+bool Model::from_cache() const {
+    return cache_.is_open();
+}
+
+void Model::loadTexture(std::string filename, const char* suffix, AsyncTexture& texture, ThreadPool* pool)
 {
     std::string texfile(filename);
     size_t dot = texfile.find_last_of(".");
     if (dot != std::string::npos) {
         texfile = texfile.substr(0, dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (image.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        image.flip_vertically();
+        texture.load(texfile, pool);   //读取完成后输出 "texture file ... loading ok/failed"
     }
 }
 
+void Model::wait_textures() {
+    diffusemap_.get();
+    normalmap_.get();
+    specularmap_.get();
+}
+
+bool Model::textures_ready() const {
+    return diffusemap_.ready() && normalmap_.ready() && specularmap_.ready();
+}
+
+const Texture& Model::diffuse_map() {
+    return diffusemap_.get();
+}
+
+const Texture& Model::normal_map() {
+    return normalmap_.get();
+}
+
+const Texture& Model::specular_map() {
+    return specularmap_.get();
+}
+
 TGAColor Model::diffuse(Vec2f uvf) {
-    Vec2i uv(uvf[0]*diffusemap_.get_width(), uvf[1]*diffusemap_.get_height());
-    return diffusemap_.get(uv[0], uv[1]);
+    return diffusemap_.get().nearest(uvf);
 }
 
 Vec3f Model::normal(Vec2f uvf) {
-    Vec2i uv(uvf[0]*normalmap_.get_width(), uvf[1]*normalmap_.get_height());
-    TGAColor c = normalmap_.get(uv[0], uv[1]);
+    TGAColor c = normalmap_.get().nearest(uvf);
     Vec3f res;
     for (int i=0; i<3; i++)
         res[2-i] = (float)c[i]/255.f*2.f - 1.f;
     return res;
 }
 
-Vec2f Model::uv(int iface, int nthvert) {
-    return uv_[faces_[iface][nthvert][1]];
+Vec2f Model::uv(int iface, int nthvert) const {
+    int idx = uvIdx_[iface * 3 + nthvert];
+    return idx < 0 ? Vec2f() : uv_[idx];     //面片没有给出纹理坐标
 }
 
 float Model::specular(Vec2f uvf) {
-    Vec2i uv(uvf[0]*specularmap_.get_width(), uvf[1]*specularmap_.get_height());
-    return specularmap_.get(uv[0], uv[1])[0]/1.f;
+    return specularmap_.get().nearest(uvf)[0]/1.f;
 }
 
-Vec3f Model::normal(int iface, int nthvert) {
-    int idx = faces_[iface][nthvert][2];
-    return norms_[idx].normalize();
+Vec3f Model::normal(int iface, int nthvert) const {
+    int idx = normIdx_[iface * 3 + nthvert];
+    if (idx < 0) return Vec3f();            //面片没有给出法线
+    Vec3f n = norms_[idx];
+    return n.normalize();
 }
 
@@ -0,0 +1,309 @@
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <sstream>
+
+#include "objparser.h"
+#include "mappedfile.h"
+
+void ObjData::clear() {
+    verts.clear();
+    uvs.clear();
+    norms.clear();
+    vertIdx.clear();
+    uvIdx.clear();
+    normIdx.clear();
+}
+
+template <class T>
+static bool same_bytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+bool ObjData::identical(const ObjData& o) const {
+    return same_bytes(verts, o.verts) && same_bytes(uvs, o.uvs) && same_bytes(norms, o.norms)
+        && same_bytes(vertIdx, o.vertIdx) && same_bytes(uvIdx, o.uvIdx) && same_bytes(normIdx, o.normIdx);
+}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+const char* parse_float(const char* p, const char* end, float& out) {
+    static const float pow10[11] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    const char* start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;          //有效数字位数(不含前导0)
+    int exponent = 0;
+    bool any = false, exact = true;
+    for (; p < end && is_digit(*p); p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+            exact = false;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            } else {
+                exact = false;
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+        if (q < end && is_digit(*q)) {
+            int e = 0;
+            for (; q < end && is_digit(*q); q++)
+                if (e < 100000) e = e * 10 + (*q - '0');
+            exponent += eneg ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any && exact && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+        float f = (float)mantissa;
+        f = exponent < 0 ? f / pow10[-exponent] : f * pow10[exponent];
+        out = neg ? -f : f;
+        return p;
+    }
+
+    //慢速路径：把这个数复制成以0结尾的字符串交给strtof(也处理inf、nan等)
+    char buf[64];
+    int n = 0;
+    for (const char* q = start; q < end && !is_space(*q) && *q != '\n' && n < 63; q++) buf[n++] = *q;
+    buf[n] = 0;
+    char* stop;
+    float f = strtof(buf, &stop);
+    if (stop == buf) return start;
+    out = f;
+    return start + (stop - buf);
+}
+
+static const char* parse_int(const char* p, const char* end, int& out, bool& ok) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    ok = p < end && is_digit(*p);
+    int v = 0;
+    for (; p < end && is_digit(*p); p++) v = v * 10 + (*p - '0');
+    out = neg ? -v : v;
+    return p;
+}
+
+//一块文本的解析结果
+//负索引相对于"到这一行为止"的元素个数，块内只知道本块的个数，所以先按块内个数换算，
+//再记下这些位置，合并时加上前面各块的元素个数
+struct ObjChunk {
+    ObjData data;
+    std::vector<int> relative[3];   //vertIdx/uvIdx/normIdx中需要加上基数的位置
+};
+
+static void parse_chunk(const char* p, const char* end, ObjChunk& chunk) {
+    ObjData& d = chunk.data;
+    int corner[3][3];          //扇形三角化：第一个顶点、上一个顶点、当前顶点，每个顶点(v, vt, vn)
+    bool cornerRel[3][3];
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        while (p < eol && is_space(*p)) p++;
+
+        if (eol - p >= 2 && p[0] == 'v' && is_space(p[1])) {
+            Vec3f v;
+            p += 2;
+            for (int i = 0; i < 3; i++) {
+                while (p < eol && is_space(*p)) p++;
+                p = parse_float(p, eol, v[i]);
+            }
+            d.verts.push_back(v);
+        } else if (eol - p >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
+            Vec2f uv;
+            p += 3;
+            for (int i = 0; i < 2; i++) {
+                while (p < eol && is_space(*p)) p++;
+                p = parse_float(p, eol, uv[i]);
+            }
+            d.uvs.push_back(uv);
+        } else if (eol - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+            Vec3f n;
+            p += 3;
+            for (int i = 0; i < 3; i++) {
+                while (p < eol && is_space(*p)) p++;
+                p = parse_float(p, eol, n[i]);
+            }
+            d.norms.push_back(n);
+        } else if (eol - p >= 2 && p[0] == 'f' && is_space(p[1])) {
+            const int counts[3] = { (int)d.verts.size(), (int)d.uvs.size(), (int)d.norms.size() };
+            int n = 0;
+            p += 2;
+            while (true) {
+                while (p < eol && is_space(*p)) p++;
+                if (p >= eol) break;
+                //一个顶点：v、v/vt、v//vn 或 v/vt/vn
+                int idx[3] = { -1, -1, -1 };
+                bool rel[3] = { false, false, false };
+                for (int k = 0; k < 3; k++) {
+                    if (k > 0) {
+                        if (p >= eol || *p != '/') break;
+                        p++;
+                    }
+                    int value;
+                    bool ok;
+                    p = parse_int(p, eol, value, ok);
+                    if (!ok) continue;
+                    if (value < 0) {
+                        idx[k] = counts[k] + value;
+                        rel[k] = true;
+                    } else {
+                        idx[k] = value - 1;
+                    }
+                }
+                while (p < eol && !is_space(*p)) p++;   //跳过不认识的内容
+                int slot = n < 2 ? n : 2;
+                for (int k = 0; k < 3; k++) {
+                    corner[slot][k] = idx[k];
+                    cornerRel[slot][k] = rel[k];
+                }
+                if (++n >= 3) {
+                    std::vector<int>* arrays[3] = { &d.vertIdx, &d.uvIdx, &d.normIdx };
+                    for (int j = 0; j < 3; j++)
+                        for (int k = 0; k < 3; k++) {
+                            if (cornerRel[j][k]) chunk.relative[k].push_back((int)arrays[k]->size());
+                            arrays[k]->push_back(corner[j][k]);
+                        }
+                    //当前顶点成为下一个三角形的"上一个顶点"
+                    for (int k = 0; k < 3; k++) {
+                        corner[1][k] = corner[2][k];
+                        cornerRel[1][k] = cornerRel[2][k];
+                    }
+                }
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+template <class T>
+static void append(std::vector<T>& dst, const std::vector<T>& src) {
+    dst.insert(dst.end(), src.begin(), src.end());
+}
+
+void parse_obj(const char* data, size_t size, ObjData& out, ThreadPool* pool) {
+    const size_t minChunk = 256 * 1024;      //每块至少这么大，小文件不值得切分
+    const size_t autoParallel = 4 << 20;     //没有给线程池时，超过这个大小才临时创建
+    if (!pool && size >= autoParallel && ThreadPool::hardware_threads() > 1) {
+        ThreadPool local(ThreadPool::hardware_threads());
+        parse_obj(data, size, out, &local);
+        return;
+    }
+
+    out.clear();
+    int nchunks = 1;
+    if (pool && pool->size() > 1)
+        nchunks = (int)std::max<size_t>(1, std::min<size_t>(pool->size() * 4, size / minChunk));
+    if (nchunks == 1) {
+        ObjChunk chunk;
+        parse_chunk(data, data + size, chunk);
+        out = chunk.data;
+        return;
+    }
+
+    //块边界移到下一行的开头
+    std::vector<const char*> bounds(nchunks + 1);
+    bounds[0] = data;
+    bounds[nchunks] = data + size;
+    for (int c = 1; c < nchunks; c++) {
+        const char* b = std::max(bounds[c - 1], data + size * c / nchunks);
+        const char* eol = (const char*)memchr(b, '\n', data + size - b);
+        bounds[c] = eol ? eol + 1 : data + size;
+    }
+    std::vector<ObjChunk> chunks(nchunks);
+    pool->parallel_for(nchunks, [&](int c, int) { parse_chunk(bounds[c], bounds[c + 1], chunks[c]); });
+
+    //按顺序合并，块内的索引加上前面各块的元素个数
+    size_t totals[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int c = 0; c < nchunks; c++) {
+        const ObjData& d = chunks[c].data;
+        totals[0] += d.verts.size(); totals[1] += d.uvs.size(); totals[2] += d.norms.size();
+        totals[3] += d.vertIdx.size(); totals[4] += d.uvIdx.size(); totals[5] += d.normIdx.size();
+    }
+    out.verts.reserve(totals[0]); out.uvs.reserve(totals[1]); out.norms.reserve(totals[2]);
+    out.vertIdx.reserve(totals[3]); out.uvIdx.reserve(totals[4]); out.normIdx.reserve(totals[5]);
+    for (int c = 0; c < nchunks; c++) {
+        ObjChunk& chunk = chunks[c];
+        std::vector<int>* arrays[3] = { &chunk.data.vertIdx, &chunk.data.uvIdx, &chunk.data.normIdx };
+        const int base[3] = { (int)out.verts.size(), (int)out.uvs.size(), (int)out.norms.size() };
+        for (int k = 0; k < 3; k++)
+            for (size_t i = 0; i < chunk.relative[k].size(); i++) (*arrays[k])[chunk.relative[k][i]] += base[k];
+        append(out.verts, chunk.data.verts);
+        append(out.uvs, chunk.data.uvs);
+        append(out.norms, chunk.data.norms);
+        append(out.vertIdx, chunk.data.vertIdx);
+        append(out.uvIdx, chunk.data.uvIdx);
+        append(out.normIdx, chunk.data.normIdx);
+    }
+}
+
+bool parse_obj_file(const char* filename, ObjData& out, ThreadPool* pool) {
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    parse_obj(file.data(), file.size(), out, pool);
+    return true;
+}
+
+void parse_obj_stream(std::istream& in, ObjData& out) {
+    out.clear();
+    std::string line;
+    while (!in.eof()) {
+        std::getline(in, line);
+        std::istringstream iss(line.c_str());
+        char trash;
+        if (!line.compare(0, 2, "v ")) {
+            iss >> trash;
+            Vec3f v;
+            for (int i = 0; i < 3; i++) iss >> v[i];
+            out.verts.push_back(v);
+        } else if (!line.compare(0, 3, "vt ")) {
+            iss >> trash >> trash;
+            Vec2f uv;
+            for (int i = 0; i < 2; i++) iss >> uv[i];
+            out.uvs.push_back(uv);
+        } else if (!line.compare(0, 3, "vn ")) {
+            iss >> trash >> trash;
+            Vec3f normal;
+            for (int i = 0; i < 3; i++) iss >> normal[i];
+            out.norms.push_back(normal);
+        } else if (!line.compare(0, 2, "f ")) {
+            std::vector<Vec3i> f;
+            Vec3i tmp;
+            iss >> trash;
+            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
+                for (int i = 0; i < 3; i++) tmp[i]--;
+                f.push_back(tmp);
+            }
+            for (int k = 1; k + 1 < (int)f.size(); k++) {
+                const Vec3i* corner[3] = { &f[0], &f[k], &f[k + 1] };
+                for (int j = 0; j < 3; j++) {
+                    out.vertIdx.push_back(corner[j]->x);
+                    out.uvIdx.push_back(corner[j]->y);
+                    out.normIdx.push_back(corner[j]->z);
+                }
+            }
+        }
+    }
+}
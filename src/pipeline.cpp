@@ -0,0 +1,57 @@
+#include "pipeline.h"
+
+vec<4> local2homo(Vec3f v) {
+    return vec<4>{ { v.x, v.y, v.z, 1.0f } };
+}
+
+Vec3f homo2vertices(const vec<4>& m) {
+    return Vec3f(m[0], m[1], m[2]);
+}
+
+Vec4f homo2vec4(const vec<4>& m) {
+    return Vec4f(m[0], m[1], m[2], m[3]);
+}
+
+void matrix2floats(const mat<4, 4>& m, float* out) {
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[i * 4 + j] = m[i][j];
+}
+
+vec<4> projectionDivision(vec<4> m) {
+    m[0] = m[0] / m[3];
+    m[1] = m[1] / m[3];
+    m[2] = m[2] / m[3];
+    m[3] = 1.0f;
+    return m;
+}
+
+Vec3f clip2screen(const Vec4f& v, const mat<4, 4>& viewport) {
+    return homo2vertices(viewport * projectionDivision(vec<4>{ { v.x, v.y, v.z, v.w } }));
+}
+
+int clip_project(const ClipParams& params, const mat<4, 4>& viewport,
+                 const Vec4f* clip, Vec3f* screen, Vec3f* bary, bool& clipped, const Vec3f* projected) {
+    bool outside;
+    clipped = !clip_trivial(clip, params, &outside);
+    if (!clipped) {
+        for (int j = 0; j < 3; j++) {
+            screen[j] = projected ? projected[j] : clip2screen(clip[j], viewport);
+            bary[j] = Vec3f(j == 0, j == 1, j == 2);
+        }
+        return 1;
+    }
+    if (outside) return 0;   //整个在某个平面外侧
+
+    ClipVertex poly[CLIP_MAX_VERTS];
+    int n = clip_triangle(clip, params, poly);
+    //凸多边形按扇形三角化
+    for (int k = 0; k + 2 < n; k++) {
+        const ClipVertex* v[3] = { &poly[0], &poly[k + 1], &poly[k + 2] };
+        for (int j = 0; j < 3; j++) {
+            screen[k * 3 + j] = clip2screen(v[j]->pos, viewport);
+            bary[k * 3 + j] = v[j]->bary;
+        }
+    }
+    return n < 3 ? 0 : n - 2;
+}
@@ -0,0 +1,162 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "rasterizer.h"
+
+bool setup_triangle(const Vec3f* pts, const TileRect& clip, EdgeSetup& s) {
+    //屏幕坐标取整(与World2Screen一样，像素中心在整数坐标上)
+    int64_t x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        x[i] = static_cast<int64_t>(std::floor(pts[i].x + 0.5f));
+        y[i] = static_cast<int64_t>(std::floor(pts[i].y + 0.5f));
+        s.z[i] = pts[i].z;
+    }
+
+    //包围盒，限制在裁剪矩形内
+    int64_t minx = std::max<int64_t>(std::min({ x[0], x[1], x[2] }), clip.x0);
+    int64_t miny = std::max<int64_t>(std::min({ y[0], y[1], y[2] }), clip.y0);
+    int64_t maxx = std::min<int64_t>(std::max({ x[0], x[1], x[2] }), clip.x1);
+    int64_t maxy = std::min<int64_t>(std::max({ y[0], y[1], y[2] }), clip.y1);
+    if (minx > maxx || miny > maxy) return false;
+    s.box = TileRect((int)minx, (int)miny, (int)maxx, (int)maxy);
+
+    //第i条边是顶点i对面的边(j,k)，E_i(P) = (k-j)x(P-j)，在三角形内部三个值同号
+    int64_t A[3], B[3], C[3];
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        A[i] = y[j] - y[k];
+        B[i] = x[k] - x[j];
+        C[i] = x[j] * y[k] - y[j] * x[k];
+    }
+    int64_t area = C[0] + C[1] + C[2];    //2倍有向面积，等于任意一点处三个边函数之和
+    if (area == 0) return false;          //三点共线
+    if (area < 0) {                       //统一成逆时针，内部的边函数值都为非负
+        for (int i = 0; i < 3; i++) { A[i] = -A[i]; B[i] = -B[i]; C[i] = -C[i]; }
+        area = -area;
+    }
+
+    //系数和包围盒四角(包括最后一个块多出的像素)处的值都在32位范围内时才能走SIMD路径
+    const int64_t limit = std::numeric_limits<int>::max() / 2;
+    s.narrow = true;
+    for (int i = 0; i < 3; i++) {
+        s.A[i] = (int)A[i];
+        s.B[i] = (int)B[i];
+        s.C[i] = C[i];
+        if (std::llabs(A[i]) * RASTER_BLOCK > limit || std::llabs(B[i]) > limit) {
+            s.narrow = false;
+            continue;
+        }
+        int64_t xs[2] = { minx, maxx + RASTER_BLOCK };
+        int64_t ys[2] = { miny, maxy };
+        for (int a = 0; a < 2; a++)
+            for (int b = 0; b < 2; b++)
+                if (std::llabs(A[i] * xs[a] + B[i] * ys[b] + C[i]) > limit) s.narrow = false;
+    }
+    //系数本身超出32位时只能走64位路径，这里保持原值
+    if (!s.narrow) {
+        for (int i = 0; i < 3; i++) {
+            if (std::llabs(A[i]) > std::numeric_limits<int>::max() || std::llabs(B[i]) > std::numeric_limits<int>::max())
+                return false;
+        }
+    }
+    s.invArea = 1.f / static_cast<float>(area);
+    return true;
+}
+
+void setup_perspective(const EdgeSetup& s, const float* w, PerspectiveSetup& p) {
+    p.x0 = s.box.x0;
+    p.y0 = s.box.y0;
+    //b_i = E_i * invArea，原点处的边函数值用64位整数算；1/w = b0/w0 + b1/w1 + b2/w2
+    double q[3], b[3][3];
+    for (int i = 0; i < 3; i++) {
+        q[i] = 1.0 / w[i];
+        b[i][0] = static_cast<double>(s.A[i] * (int64_t)p.x0 + s.B[i] * (int64_t)p.y0 + s.C[i]) * s.invArea;
+        b[i][1] = static_cast<double>(s.A[i]) * s.invArea;
+        b[i][2] = static_cast<double>(s.B[i]) * s.invArea;
+    }
+    for (int c = 0; c < 3; c++) {
+        p.plane[0][c] = static_cast<float>(b[0][c] * q[0] + b[1][c] * q[1] + b[2][c] * q[2]);
+        p.plane[1][c] = static_cast<float>(b[1][c] * q[1]);
+        p.plane[2][c] = static_cast<float>(b[2][c] * q[2]);
+    }
+}
+
+int rasterize_depth(const EdgeSetup& s, const TileRect& box, float* depth, int pitch) {
+    int written = 0;
+    const int x0 = box.x0;
+    const int width = box.x1 - box.x0 + 1;
+#if RASTER_SSE2
+    if (s.narrow) {
+        //一次4个像素：只算深度，与深度缓冲比较后按掩码混合写回
+        //整组都在box内时才整组读写，行尾不足4个像素的一组逐像素处理，不碰box外的像素
+        const __m128i dx0 = _mm_setr_epi32(0, s.A[0], 2 * s.A[0], 3 * s.A[0]);
+        const __m128i dx1 = _mm_setr_epi32(0, s.A[1], 2 * s.A[1], 3 * s.A[1]);
+        const __m128i dx2 = _mm_setr_epi32(0, s.A[2], 2 * s.A[2], 3 * s.A[2]);
+        const __m128i step0 = _mm_set1_epi32(s.A[0] * 4);
+        const __m128i step1 = _mm_set1_epi32(s.A[1] * 4);
+        const __m128i step2 = _mm_set1_epi32(s.A[2] * 4);
+        const __m128 inv = _mm_set1_ps(s.invArea);
+        const __m128 z0 = _mm_set1_ps(s.z[0]), z1 = _mm_set1_ps(s.z[1]), z2 = _mm_set1_ps(s.z[2]);
+        const __m128i minus1 = _mm_set1_epi32(-1);
+        for (int y = box.y0; y <= box.y1; y++) {
+            float* row = depth + (size_t)y * pitch + x0;
+            __m128i e0 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[0] * (int64_t)x0 + s.B[0] * (int64_t)y + s.C[0])), dx0);
+            __m128i e1 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[1] * (int64_t)x0 + s.B[1] * (int64_t)y + s.C[1])), dx1);
+            __m128i e2 = _mm_add_epi32(_mm_set1_epi32((int)(s.A[2] * (int64_t)x0 + s.B[2] * (int64_t)y + s.C[2])), dx2);
+            for (int dx = 0; dx < width; dx += 4) {
+                __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), minus1);
+                if (_mm_movemask_ps(_mm_castsi128_ps(inside))) {
+                    __m128 b0 = _mm_mul_ps(_mm_cvtepi32_ps(e0), inv);
+                    __m128 b1 = _mm_mul_ps(_mm_cvtepi32_ps(e1), inv);
+                    __m128 b2 = _mm_mul_ps(_mm_cvtepi32_ps(e2), inv);
+                    __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, z0), _mm_mul_ps(b1, z1)), _mm_mul_ps(b2, z2));
+                    if (width - dx >= 4) {
+                        __m128 old = _mm_loadu_ps(row + dx);
+                        __m128 pass = _mm_and_ps(_mm_cmplt_ps(old, z), _mm_castsi128_ps(inside));
+                        int mask = _mm_movemask_ps(pass);
+                        if (mask) {
+                            _mm_storeu_ps(row + dx, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old)));
+                            written += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+                        }
+                    } else {
+                        float zs[4];
+                        _mm_storeu_ps(zs, z);
+                        int mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+                        for (int i = 0; i < width - dx; i++) {
+                            if ((mask >> i & 1) && row[dx + i] < zs[i]) {
+                                row[dx + i] = zs[i];
+                                written++;
+                            }
+                        }
+                    }
+                }
+                e0 = _mm_add_epi32(e0, step0);
+                e1 = _mm_add_epi32(e1, step1);
+                e2 = _mm_add_epi32(e2, step2);
+            }
+        }
+        return written;
+    }
+#endif
+    //标量路径，与raster_interpolate的运算相同
+    for (int y = box.y0; y <= box.y1; y++) {
+        float* row = depth + (size_t)y * pitch + x0;
+        for (int dx = 0; dx < width; dx++) {
+            int64_t x = x0 + dx;
+            int64_t e0 = s.A[0] * x + s.B[0] * (int64_t)y + s.C[0];
+            int64_t e1 = s.A[1] * x + s.B[1] * (int64_t)y + s.C[1];
+            int64_t e2 = s.A[2] * x + s.B[2] * (int64_t)y + s.C[2];
+            if ((e0 | e1 | e2) < 0) continue;
+            float b0 = static_cast<float>(e0) * s.invArea;
+            float b1 = static_cast<float>(e1) * s.invArea;
+            float b2 = static_cast<float>(e2) * s.invArea;
+            float z = s.z[0] * b0 + s.z[1] * b1 + s.z[2] * b2;
+            if (row[dx] < z) {
+                row[dx] = z;
+                written++;
+            }
+        }
+    }
+    return written;
+}
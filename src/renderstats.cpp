@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstring>
+
+#include "renderstats.h"
+#include "tgaimage.h"
+
+RenderCounters::RenderCounters() {
+    clear();
+}
+
+void RenderCounters::clear() {
+    faces = facesCulled = facesMeshletCulled = facesClipped = 0;
+    triangles = trianglesRejected = 0;
+    bboxPixels = coveredPixels = 0;
+    depthPass = depthFail = 0;
+    fragmentsShaded = fragmentsDiscarded = 0;
+}
+
+RenderCounters& RenderCounters::operator+=(const RenderCounters& c) {
+    faces += c.faces;
+    facesCulled += c.facesCulled;
+    facesMeshletCulled += c.facesMeshletCulled;
+    facesClipped += c.facesClipped;
+    triangles += c.triangles;
+    trianglesRejected += c.trianglesRejected;
+    bboxPixels += c.bboxPixels;
+    coveredPixels += c.coveredPixels;
+    depthPass += c.depthPass;
+    depthFail += c.depthFail;
+    fragmentsShaded += c.fragmentsShaded;
+    fragmentsDiscarded += c.fragmentsDiscarded;
+    return *this;
+}
+
+RenderStats::RenderStats(int nthreads, int width, int height)
+    : slots_(std::max(1, nthreads)), width_(width), height_(height), shaded_((size_t)width * height, 0),
+      shadedPixels_(0), maxOverdraw_(0) {
+}
+
+void RenderStats::begin_frame() {
+    for (Slot& s : slots_) s.c.clear();
+    std::fill(shaded_.begin(), shaded_.end(), 0);
+    frame_.clear();
+    shadedPixels_ = 0;
+    maxOverdraw_ = 0;
+}
+
+void RenderStats::end_frame() {
+    frame_.clear();
+    for (const Slot& s : slots_) frame_ += s.c;
+    shadedPixels_ = 0;
+    maxOverdraw_ = 0;
+    for (uint16_t n : shaded_) {
+        shadedPixels_ += n != 0;
+        maxOverdraw_ = std::max(maxOverdraw_, (int)n);
+    }
+}
+
+static double percent(long long a, long long b) {
+    return b ? 100.0 * a / b : 0;
+}
+
+void RenderStats::report(std::ostream& out, const char* name) const {
+    const RenderCounters& c = frame_;
+    long long tested = c.depthPass + c.depthFail;
+    out << "render stats [" << name << "]" << std::endl;
+    out << "  faces " << c.faces << ", meshlet culled " << c.facesMeshletCulled << " (" << percent(c.facesMeshletCulled, c.faces) << "%)"
+        << ", culled " << c.facesCulled << " (" << percent(c.facesCulled, c.faces) << "%), clipped " << c.facesClipped
+        << ", triangles rasterized " << c.triangles << ", rejected at setup " << c.trianglesRejected << std::endl;
+    out << "  bbox pixels " << c.bboxPixels << ", covered " << c.coveredPixels << " (" << percent(c.coveredPixels, c.bboxPixels) << "%)"
+        << ", depth test pass " << c.depthPass << " / fail " << c.depthFail << " (pass rate " << percent(c.depthPass, tested) << "%)" << std::endl;
+    out << "  fragments shaded " << c.fragmentsShaded << ", discarded " << c.fragmentsDiscarded << ", overwritten " << fragments_overwritten()
+        << " (" << percent(fragments_overwritten(), fragments_written()) << "%), pixels " << shadedPixels_
+        << ", overdraw " << overdraw() << " avg / " << maxOverdraw_ << " max" << std::endl;
+}
+
+bool RenderStats::write_heatmap(const char* filename) const {
+    //1到5次依次为蓝、青、绿、黄、红，5次以上也是红色；固定的刻度便于比较不同的帧
+    static const unsigned char ramp[5][3] = { { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+    TGAImage image(width_, height_, TGAImage::RGB);
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            int n = shaded_[(size_t)y * width_ + x];
+            if (!n) continue;
+            const unsigned char* c = ramp[std::min(n, 5) - 1];
+            image.set(x, y, TGAColor(c[0], c[1], c[2], 255));
+        }
+    }
+    image.flip_vertically();
+    return image.write_tga_file(filename);
+}
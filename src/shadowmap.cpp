@@ -0,0 +1,52 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "shadowmap.h"
+
+ShadowMap::ShadowMap(int size) : size_(size), depth_((size_t)size * size) {
+    clear();
+}
+
+void ShadowMap::clear() {
+    std::fill(depth_.begin(), depth_.end(), -std::numeric_limits<float>::max());
+}
+
+float ShadowMap::pcf(float x, float y, float z, float bias, int radius) const {
+    //texel中心在整数坐标上，与光栅化的像素一致
+    int cx = (int)std::floor(x + 0.5f), cy = (int)std::floor(y + 0.5f);
+    float threshold = z + bias;
+    int lit = 0;
+    for (int j = cy - radius; j <= cy + radius; j++) {
+        for (int i = cx - radius; i <= cx + radius; i++) {
+            if (i < 0 || j < 0 || i >= size_ || j >= size_) {
+                lit++;
+                continue;
+            }
+            lit += threshold >= depth_[(size_t)j * size_ + i];
+        }
+    }
+    int taps = (2 * radius + 1) * (2 * radius + 1);
+    return (float)lit / taps;
+}
+
+bool ShadowMap::write_tga_file(const char* filename) const {
+    //按有效深度的范围拉伸到1..255
+    float lo = std::numeric_limits<float>::max(), hi = -lo;
+    for (float d : depth_) {
+        if (d == -std::numeric_limits<float>::max()) continue;
+        lo = std::min(lo, d);
+        hi = std::max(hi, d);
+    }
+    TGAImage image(size_, size_, TGAImage::GRAYSCALE);
+    for (int y = 0; y < size_; y++) {
+        for (int x = 0; x < size_; x++) {
+            float d = depth_[(size_t)y * size_ + x];
+            if (d == -std::numeric_limits<float>::max()) continue;
+            float t = hi > lo ? (d - lo) / (hi - lo) : 1;
+            image.set(x, y, TGAColor((unsigned char)(1 + t * 254)));
+        }
+    }
+    image.flip_vertically();
+    return image.write_tga_file(filename);
+}
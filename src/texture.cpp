@@ -0,0 +1,174 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "texture.h"
+
+//块内坐标(0..7)的Morton编码：x占偶数位，y占奇数位
+static const int MORTON_X[8] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+static const int MORTON_Y[8] = { 0, 2, 8, 10, 32, 34, 40, 42 };
+
+Texture::Texture() : bytespp_(0) {
+}
+
+void Texture::clear() {
+    levels_.clear();
+    bytespp_ = 0;
+}
+
+inline uint32_t Texture::fetch(const Level& l, int x, int y) {
+    return l.texels[(((y >> 3) * l.tilesX + (x >> 3)) << 6) + MORTON_X[x & 7] + MORTON_Y[y & 7]];
+}
+
+static void init_level(int w, int h, std::vector<uint32_t>& texels, int& tilesX) {
+    tilesX = (w + 7) / 8;
+    texels.assign((size_t)tilesX * ((h + 7) / 8) * 64, 0);
+}
+
+void Texture::build(TGAImage& image, bool mipmaps) {
+    clear();
+    int w = image.get_width(), h = image.get_height();
+    if (!image.buffer() || w <= 0 || h <= 0) return;
+    bytespp_ = image.get_bytespp();
+
+    Level base;
+    base.width = w;
+    base.height = h;
+    init_level(w, h, base.texels, base.tilesX);
+    const unsigned char* src = image.buffer();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint32_t t = 0;
+            memcpy(&t, src + ((size_t)y * w + x) * bytespp_, bytespp_);
+            base.texels[(((y >> 3) * base.tilesX + (x >> 3)) << 6) + MORTON_X[x & 7] + MORTON_Y[y & 7]] = t;
+        }
+    }
+    levels_.push_back(base);
+
+    //下一层的每个texel是上一层2x2的平均，奇数尺寸时最后一行/列只参与一次
+    while (mipmaps && (w > 1 || h > 1)) {
+        const Level& prev = levels_.back();
+        Level next;
+        next.width = w = std::max(1, w / 2);
+        next.height = h = std::max(1, h / 2);
+        init_level(w, h, next.texels, next.tilesX);
+        for (int y = 0; y < h; y++) {
+            int y0 = std::min(2 * y, prev.height - 1), y1 = std::min(2 * y + 1, prev.height - 1);
+            for (int x = 0; x < w; x++) {
+                int x0 = std::min(2 * x, prev.width - 1), x1 = std::min(2 * x + 1, prev.width - 1);
+                uint32_t a = fetch(prev, x0, y0), b = fetch(prev, x1, y0), c = fetch(prev, x0, y1), d = fetch(prev, x1, y1);
+                uint32_t t = 0;
+                for (int k = 0; k < 32; k += 8) {
+                    uint32_t sum = ((a >> k) & 255) + ((b >> k) & 255) + ((c >> k) & 255) + ((d >> k) & 255);
+                    t |= ((sum + 2) >> 2) << k;
+                }
+                next.texels[(((y >> 3) * next.tilesX + (x >> 3)) << 6) + MORTON_X[x & 7] + MORTON_Y[y & 7]] = t;
+            }
+        }
+        levels_.push_back(next);
+    }
+}
+
+bool Texture::empty() const {
+    return levels_.empty();
+}
+
+int Texture::width(int level) const {
+    return levels_.empty() ? 0 : levels_[level].width;
+}
+
+int Texture::height(int level) const {
+    return levels_.empty() ? 0 : levels_[level].height;
+}
+
+int Texture::levels() const {
+    return (int)levels_.size();
+}
+
+int Texture::bytespp() const {
+    return bytespp_;
+}
+
+TGAColor Texture::texel(int x, int y, int level) const {
+    if (levels_.empty()) return TGAColor();
+    const Level& l = levels_[level];
+    if (x < 0 || y < 0 || x >= l.width || y >= l.height) return TGAColor();
+    uint32_t t = fetch(l, x, y);
+    unsigned char bytes[4];
+    memcpy(bytes, &t, 4);
+    return TGAColor(bytes, bytespp_);
+}
+
+TGAColor Texture::nearest(Vec2f uv) const {
+    if (levels_.empty()) return TGAColor();
+    Vec2i p(uv[0] * levels_[0].width, uv[1] * levels_[0].height);
+    return texel(p[0], p[1]);
+}
+
+float Texture::lod(const Vec2f& duvdx, const Vec2f& duvdy) const {
+    if (levels_.empty()) return 0;
+    float w = (float)levels_[0].width, h = (float)levels_[0].height;
+    float dx = duvdx.x * w * duvdx.x * w + duvdx.y * h * duvdx.y * h;
+    float dy = duvdy.x * w * duvdy.x * w + duvdy.y * h * duvdy.y * h;
+    float rho2 = std::max(dx, dy);
+    return rho2 > 0 ? 0.5f * std::log2(rho2) : -100.f;
+}
+
+static inline Vec4f unpack(uint32_t t) {
+    return Vec4f((float)(t & 255), (float)((t >> 8) & 255), (float)((t >> 16) & 255), (float)(t >> 24));
+}
+
+Vec4f Texture::bilinear(int level, float u, float v) const {
+    const Level& l = levels_[level];
+    //texel中心在(x+0.5, y+0.5)
+    float fx = u * l.width - 0.5f, fy = v * l.height - 0.5f;
+    float flx = std::floor(fx), fly = std::floor(fy);
+    float tx = fx - flx, ty = fy - fly;
+    int x0 = (int)flx, y0 = (int)fly;
+    int x1 = std::min(std::max(x0 + 1, 0), l.width - 1), y1 = std::min(std::max(y0 + 1, 0), l.height - 1);
+    x0 = std::min(std::max(x0, 0), l.width - 1);
+    y0 = std::min(std::max(y0, 0), l.height - 1);
+    uint32_t a = fetch(l, x0, y0), b = fetch(l, x1, y0), c = fetch(l, x0, y1), d = fetch(l, x1, y1);
+#if GEOMETRY_SSE2
+    //四个texel各展开成4个float，一次算完四个通道
+    const __m128i zero = _mm_setzero_si128();
+    __m128i ab = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)b, (int)a), zero);
+    __m128i cd = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)d, (int)c), zero);
+    __m128 fa = _mm_cvtepi32_ps(_mm_unpacklo_epi16(ab, zero)), fb = _mm_cvtepi32_ps(_mm_unpackhi_epi16(ab, zero));
+    __m128 fc = _mm_cvtepi32_ps(_mm_unpacklo_epi16(cd, zero)), fd = _mm_cvtepi32_ps(_mm_unpackhi_epi16(cd, zero));
+    __m128 vtx = _mm_set1_ps(tx), vty = _mm_set1_ps(ty);
+    __m128 top = _mm_add_ps(fa, _mm_mul_ps(_mm_sub_ps(fb, fa), vtx));
+    __m128 bottom = _mm_add_ps(fc, _mm_mul_ps(_mm_sub_ps(fd, fc), vtx));
+    float r[4];
+    _mm_storeu_ps(r, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), vty)));
+    return Vec4f(r[0], r[1], r[2], r[3]);
+#else
+    Vec4f fa = unpack(a), fb = unpack(b), fc = unpack(c), fd = unpack(d);
+    Vec4f top = fa + (fb - fa) * tx;
+    Vec4f bottom = fc + (fd - fc) * tx;
+    return top + (bottom - top) * ty;
+#endif
+}
+
+Vec4f Texture::sample(Vec2f uv, TextureFilter filter, float lod) const {
+    if (levels_.empty()) return Vec4f();
+    int last = (int)levels_.size() - 1;
+    lod = std::min(std::max(lod, 0.f), (float)last);
+    if (filter == FILTER_NEAREST) {
+        const Level& l = levels_[(int)(lod + 0.5f)];
+        int x = std::min(std::max((int)std::floor(uv.x * l.width), 0), l.width - 1);
+        int y = std::min(std::max((int)std::floor(uv.y * l.height), 0), l.height - 1);
+        return unpack(fetch(l, x, y));
+    }
+    if (filter == FILTER_BILINEAR) return bilinear((int)(lod + 0.5f), uv.x, uv.y);
+    int l0 = (int)lod;
+    float t = lod - l0;
+    Vec4f c0 = bilinear(l0, uv.x, uv.y);
+    if (t <= 0 || l0 == last) return c0;
+    Vec4f c1 = bilinear(l0 + 1, uv.x, uv.y);
+    return c0 + (c1 - c0) * t;
+}
+
+Vec4f Texture::sample(Vec2f uv, const Vec2f& duvdx, const Vec2f& duvdy, TextureFilter filter) const {
+    return sample(uv, filter, lod(duvdx, duvdy));
+}
@@ -1,32 +1,54 @@
 #include <iostream>
+#include <cstdio>
 #include <fstream>
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include "tgaimage.h"
+#include "mappedfile.h"
+#include "threadpool.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TGA_SSE2 1
+#endif
+
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), mapping(NULL) {
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), mapping(NULL) {
     unsigned long nbytes = width*height*bytespp;
     data = new unsigned char[nbytes];
     memset(data, 0, nbytes);
 }
 
-TGAImage::TGAImage(const TGAImage &img) : data(NULL), width(img.width), height(img.height), bytespp(img.bytespp) {
+TGAImage::TGAImage(const TGAImage &img) : data(NULL), width(img.width), height(img.height), bytespp(img.bytespp), mapping(NULL) {
     unsigned long nbytes = width*height*bytespp;
     data = new unsigned char[nbytes];
     memcpy(data, img.data, nbytes);
 }
 
 TGAImage::~TGAImage() {
-    if (data) delete [] data;
+    release();
+}
+
+void TGAImage::release() {
+    if (mapping) {
+        delete mapping;
+        mapping = NULL;
+    } else if (data) {
+        delete [] data;
+    }
+    data = NULL;
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
     if (this != &img) {
-        if (data) delete [] data;
+        release();
         width  = img.width;
         height = img.height;
         bytespp = img.bytespp;
@@ -37,9 +59,139 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
     return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
-    if (data) delete [] data;
-    data = NULL;
+bool TGAImage::mapped() const {
+    return mapping != NULL;
+}
+
+bool TGAImage::read_tga_file(const char *filename, bool flip) {
+    release();
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(filename, true)) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    const unsigned char *begin = (const unsigned char *)file->data();
+    const unsigned char *end = begin + file->size();
+    TGA_Header header;
+    if (file->size() < sizeof(header)) {
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    memcpy(&header, begin, sizeof(header));
+    width   = header.width;
+    height  = header.height;
+    bytespp = header.bitsperpixel>>3;
+    if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
+    }
+    const unsigned char *p = begin + sizeof(header) + (unsigned char)header.idlength;
+    // 文件中的行顺序与要求的相反时，第r行写到第height-1-r行
+    bool reversed = ((header.imagedescriptor & 0x20) != 0) == flip;
+    unsigned long linebytes = width*bytespp;
+    unsigned long nbytes = linebytes*height;
+    if (3==header.datatypecode || 2==header.datatypecode) {
+        if (p > end || (unsigned long)(end-p) < nbytes) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        if (!reversed && !(header.imagedescriptor & 0x10)) {
+            // 直接使用映射的内存：私有映射，写像素时只复制被写的页，不会改动文件
+            data = (unsigned char *)file->mutable_data() + (p-begin);
+            mapping = file.release();
+        } else {
+            data = new unsigned char[nbytes];
+            if (reversed) {
+                for (int j=0; j<height; j++)
+                    memcpy(data+(height-1-j)*linebytes, p+j*linebytes, linebytes);
+            } else {
+                memcpy(data, p, nbytes);
+            }
+        }
+    } else if (10==header.datatypecode||11==header.datatypecode) {
+        data = new unsigned char[nbytes];
+        if (p > end || !load_rle_data(p, end, reversed)) {
+            release();
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+    } else {
+        std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+        return false;
+    }
+    if (header.imagedescriptor & 0x10) {
+        flip_horizontally();
+    }
+    std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
+    return true;
+}
+
+// 用pixel填充n个像素
+static void fill_pixels(unsigned char *dst, const unsigned char *pixel, unsigned long n, int bytespp) {
+    if (bytespp==1) {
+        memset(dst, pixel[0], n);
+    } else if (bytespp==4) {
+        uint32_t v;
+        memcpy(&v, pixel, 4);
+        for (unsigned long i=0; i<n; i++) memcpy(dst+i*4, &v, 4);
+    } else {
+        // 先写一个像素，再成倍复制已经写好的部分
+        memcpy(dst, pixel, bytespp);
+        unsigned long done = 1;
+        while (done<n) {
+            unsigned long c = std::min(done, n-done);
+            memcpy(dst+done*bytespp, dst, c*bytespp);
+            done += c;
+        }
+    }
+}
+
+// 每个包整体处理：原始包一次memcpy，重复包一次填充
+// reversed时包可能跨过行尾，要按行拆开写到翻转后的位置
+bool TGAImage::load_rle_data(const unsigned char *p, const unsigned char *end, bool reversed) {
+    unsigned long pixelcount = width*height;
+    unsigned long currentpixel = 0;
+    while (currentpixel < pixelcount) {
+        if (p >= end) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        unsigned char chunkheader = *p++;
+        bool run = chunkheader >= 128;
+        unsigned long n = (chunkheader & 0x7f) + 1;
+        if ((unsigned long)(end-p) < (run ? 1 : n)*bytespp) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        if (currentpixel+n > pixelcount) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        while (n) {
+            unsigned long k = n;
+            unsigned char *dst = data + currentpixel*bytespp;
+            if (reversed) {
+                unsigned long row = currentpixel / width;
+                unsigned long col = currentpixel - row*width;
+                k = std::min(n, width-col);
+                dst = data + ((height-1-row)*width + col)*bytespp;
+            }
+            if (run) {
+                fill_pixels(dst, p, k, bytespp);
+            } else {
+                memcpy(dst, p, k*bytespp);
+                p += k*bytespp;
+            }
+            currentpixel += k;
+            n -= k;
+        }
+        if (run) p += bytespp;
+    }
+    return true;
+}
+
+bool TGAImage::read_tga_file_stream(const char *filename) {
+    release();
     std::ifstream in;
     in.open (filename, std::ios::binary);
     if (!in.is_open()) {
@@ -142,7 +294,151 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
     return true;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
+static int lowest_bit(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, (unsigned long)mask);
+    return (int)idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// 像素x与下一个像素是否相同，按字比较
+static inline bool same_as_next(const unsigned char *x, int bytespp) {
+    if (bytespp==1) return x[0]==x[1];
+    if (bytespp==4) {
+        uint32_t a, b;
+        memcpy(&a, x, 4);
+        memcpy(&b, x+4, 4);
+        return a==b;
+    }
+    uint16_t a, b;
+    memcpy(&a, x, 2);
+    memcpy(&b, x+3, 2);
+    return a==b && x[2]==x[5];
+}
+
+// 在一行内从第i个像素开始，找第一个"与下一个像素是否相同"等于want的像素j(i<=j<limit)，找不到时返回limit
+// SSE2一次比较16个字节和它后面bytespp个字节的16个字节，一个像素的字节全部相同才算相同
+static int scan_row(const unsigned char *row, int n, int bytespp, int i, int limit, bool want) {
+#if TGA_SSE2
+    const int per = 16/bytespp;
+    const unsigned int pixels = bytespp==1 ? 0xFFFF : (bytespp==3 ? 0x1249 : 0x1111);
+    while (i+per <= limit && (i+1)*bytespp+16 <= n*bytespp) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(row+i*bytespp));
+        __m128i b = _mm_loadu_si128((const __m128i *)(row+(i+1)*bytespp));
+        unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        for (int t=1; t<bytespp; t++) m &= m>>1;   // 第k位表示从第k个字节起的一个像素全部相同
+        m = (want ? m : ~m) & pixels;
+        if (m) return i + lowest_bit(m)/bytespp;
+        i += per;
+    }
+#endif
+    for (; i<limit; i++)
+        if (same_as_next(row+i*bytespp, bytespp)==want) return i;
+    return limit;
+}
+
+// 编码[y0, y1)行写到out，返回写完之后的位置；每行单独编码，包不跨行
+// 连续相同的像素组成重复包，其余像素组成原始包，包长不超过128
+// 每个像素最多多占一个字节的包头，out至少要有(y1-y0)*width*(bytespp+1)字节
+unsigned char *TGAImage::encode_rle_rows(int y0, int y1, unsigned char *out) const {
+    const int max_chunk_length = 128;
+    for (int y=y0; y<y1; y++) {
+        const unsigned char *row = data + (unsigned long)y*width*bytespp;
+        int i = 0;
+        while (i<width) {
+            int limit = std::min(width-1, i+max_chunk_length-1);
+            if (i+1<width && same_as_next(row+i*bytespp, bytespp)) {
+                int j = scan_row(row, width, bytespp, i+1, limit, false);   // 重复包覆盖i..j
+                *out++ = (unsigned char)(j-i+128);
+                memcpy(out, row+i*bytespp, bytespp);
+                out += bytespp;
+                i = j+1;
+            } else {
+                // 下一个重复包的开头；行尾的最后一个像素后面没有像素，只能放进原始包
+                int j = scan_row(row, width, bytespp, i+1, std::min(width-1, i+max_chunk_length), true);
+                if (j==width-1) j = width;
+                j = std::min(j, i+max_chunk_length);   // 原始包覆盖i..j-1
+                *out++ = (unsigned char)(j-i-1);
+                memcpy(out, row+i*bytespp, (j-i)*bytespp);
+                out += (j-i)*bytespp;
+                i = j;
+            }
+        }
+    }
+    return out;
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle, ThreadPool *pool) {
+    const int min_band_rows = 64;             // 每个条带至少这么多行
+    const unsigned long auto_parallel = 1<<20; // 没有给线程池时，像素数超过这个值才临时创建
+    if (!pool && rle && data && (unsigned long)width*height >= auto_parallel && ThreadPool::hardware_threads() > 1) {
+        ThreadPool local(ThreadPool::hardware_threads());
+        return write_tga_file(filename, rle, &local);
+    }
+    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+    unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+    TGA_Header header;
+    memset((void *)&header, 0, sizeof(header));
+    header.bitsperpixel = bytespp<<3;
+    header.width  = width;
+    header.height = height;
+    header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
+    header.imagedescriptor = 0x20; // top-left origin
+
+    unsigned long nbytes = (unsigned long)width*height*bytespp;
+    unsigned long linebound = (unsigned long)width*(bytespp+1);
+    std::vector<unsigned char> file(sizeof(header) + (rle ? linebound*height : nbytes) + 26);
+    memcpy(&file[0], &header, sizeof(header));
+    unsigned char *p = &file[sizeof(header)];
+    if (!rle) {
+        memcpy(p, data, nbytes);
+        p += nbytes;
+    } else {
+        int nbands = 1;
+        if (pool && pool->size() > 1)
+            nbands = std::max(1, std::min(pool->size()*4, height/min_band_rows));
+        if (nbands==1) {
+            p = encode_rle_rows(0, height, p);
+        } else {
+            // 各条带编码到自己的区域，再按顺序紧挨着搬到前面
+            std::vector<unsigned char *> ends(nbands);
+            pool->parallel_for(nbands, [&](int b, int) {
+                int y0 = height*b/nbands;
+                ends[b] = encode_rle_rows(y0, height*(b+1)/nbands, p + linebound*y0);
+            });
+            for (int b=0; b<nbands; b++) {
+                unsigned char *start = &file[sizeof(header)] + linebound*(height*b/nbands);
+                memmove(p, start, ends[b]-start);
+                p += ends[b]-start;
+            }
+        }
+    }
+    memcpy(p, developer_area_ref, sizeof(developer_area_ref));
+    p += sizeof(developer_area_ref);
+    memcpy(p, extension_area_ref, sizeof(extension_area_ref));
+    p += sizeof(extension_area_ref);
+    memcpy(p, footer, sizeof(footer));
+    p += sizeof(footer);
+    unsigned long size = p - &file[0];
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    bool ok = fwrite(&file[0], 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        std::cerr << "can't dump the tga file\n";
+    }
+    return ok;
+}
+
+bool TGAImage::write_tga_file_stream(const char *filename, bool rle) {
     unsigned char developer_area_ref[4] = {0, 0, 0, 0};
     unsigned char extension_area_ref[4] = {0, 0, 0, 0};
     unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
@@ -348,7 +644,7 @@ bool TGAImage::scale(int w, int h) {
             nscanline += nlinebytes;
         }
     }
-    delete [] data;
+    release();
     data = tdata;
     width = w;
     height = h;
@@ -0,0 +1,104 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+static thread_local int t_thread_index = 0;
+
+//一次parallel_for的共享状态，晚启动的辅助任务可能在调用返回后才运行，所以用shared_ptr保存
+struct ParallelJob {
+    std::atomic<int> next;
+    std::atomic<int> done;
+    int n;
+    const std::function<void(int, int)>* fn;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    ParallelJob(int count, const std::function<void(int, int)>* f) : next(0), done(0), n(count), fn(f) {}
+
+    //领取并执行下标，直到没有剩余
+    void run() {
+        int finished = 0;
+        for (int i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            (*fn)(i, ThreadPool::thread_index());
+            finished++;
+        }
+        if (finished > 0 && done.fetch_add(finished) + finished == n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cv.notify_all();
+        }
+    }
+};
+
+ThreadPool::ThreadPool(int nthreads) : stop_(false) {
+    if (nthreads <= 0) nthreads = hardware_threads();
+    for (int i = 1; i < nthreads; i++)
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i].join();
+}
+
+int ThreadPool::size() const {
+    return (int)workers_.size() + 1;
+}
+
+void ThreadPool::workerLoop(int index) {
+    t_thread_index = index;
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    if (workers_.empty()) {    //没有工作线程时直接在调用线程执行
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int, int)>& fn) {
+    if (n <= 0) return;
+    if (workers_.empty() || n == 1) {
+        for (int i = 0; i < n; i++) fn(i, thread_index());
+        return;
+    }
+    std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>(n, &fn);
+    int helpers = std::min((int)workers_.size(), n - 1);
+    for (int i = 0; i < helpers; i++)
+        enqueue([job] { job->run(); });
+    job->run();
+    //等待的是所有下标完成，而不是所有辅助任务结束，避免嵌套调用时互相等待
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->cv.wait(lock, [&job] { return job->done.load() == job->n; });
+}
+
+int ThreadPool::thread_index() {
+    return t_thread_index;
+}
+
+int ThreadPool::hardware_threads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+
+#include "tiler.h"
+
+TileBinner::TileBinner(int width, int height, int tileSize)
+    : width_(width), height_(height), tileSize_(tileSize),
+      tilesX_((width + tileSize - 1) / tileSize), tilesY_((height + tileSize - 1) / tileSize),
+      bins_(tilesX_ * tilesY_) {
+}
+
+void TileBinner::clear() {
+    for (size_t i = 0; i < bins_.size(); i++) bins_[i].clear();
+}
+
+void TileBinner::bin(int tri, const Vec3f* pts) {
+    //包围盒(先限制在屏幕内，完全在屏幕外的三角形不进入任何块)
+    float minx = std::min({ pts[0].x, pts[1].x, pts[2].x });
+    float miny = std::min({ pts[0].y, pts[1].y, pts[2].y });
+    float maxx = std::max({ pts[0].x, pts[1].x, pts[2].x });
+    float maxy = std::max({ pts[0].y, pts[1].y, pts[2].y });
+    if (maxx < 0 || maxy < 0 || minx > width_ - 1 || miny > height_ - 1) return;
+
+    int tx0 = std::max(0, static_cast<int>(minx)) / tileSize_;
+    int ty0 = std::max(0, static_cast<int>(miny)) / tileSize_;
+    int tx1 = std::min(width_ - 1,  static_cast<int>(maxx)) / tileSize_;
+    int ty1 = std::min(height_ - 1, static_cast<int>(maxy)) / tileSize_;
+    for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++)
+            bins_[tx + ty * tilesX_].push_back(tri);
+}
+
+int TileBinner::ntiles() const {
+    return (int)bins_.size();
+}
+
+int TileBinner::tile_size() const {
+    return tileSize_;
+}
+
+TileRect TileBinner::tile_rect(int tile) const {
+    int tx = tile % tilesX_;
+    int ty = tile / tilesX_;
+    return TileRect(tx * tileSize_, ty * tileSize_,
+                    std::min(width_ - 1,  (tx + 1) * tileSize_ - 1),
+                    std::min(height_ - 1, (ty + 1) * tileSize_ - 1));
+}
+
+const std::vector<int>& TileBinner::tile_triangles(int tile) const {
+    return bins_[tile];
+}
+
+void TileBinner::render(ThreadPool& pool, const std::function<void(int, const TileRect&, int)>& raster) const {
+    //只调度非空块，三角形多的块先领取，减少最后几个大块拖尾
+    std::vector<int> order;
+    for (int t = 0; t < ntiles(); t++)
+        if (!bins_[t].empty()) order.push_back(t);
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return bins_[a].size() > bins_[b].size(); });
+
+    pool.parallel_for((int)order.size(), [&](int i, int thread) {
+        int tile = order[i];
+        TileRect rect = tile_rect(tile);
+        const std::vector<int>& tris = bins_[tile];
+        for (size_t k = 0; k < tris.size(); k++)
+            raster(tris[k], rect, thread);
+    });
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+
+#include "vertexstage.h"
+#include "rasterizer.h"
+
+VertexStage::VertexStage() {
+    for (int i = 0; i < 16; i++) mvp_[i] = (i % 5 == 0);
+    for (int i = 0; i < 4; i++) {
+        scale_[i] = 1;
+        offset_[i] = 0;
+    }
+}
+
+void VertexStage::set_transform(const float* mvp, const float* viewport) {
+    std::copy(mvp, mvp + 16, mvp_);
+    for (int i = 0; i < 3; i++) {
+        scale_[i] = viewport[i * 4 + i];
+        offset_[i] = viewport[i * 4 + 3];
+    }
+    scale_[3] = 1;
+    offset_[3] = 0;
+}
+
+void VertexStage::process(const Vec3f* verts, int n, ThreadPool* pool) {
+    clip_.resize(n);
+    screen_.resize(n);
+    if (n == 0) return;
+    const int chunk = 4096;
+    int nchunks = (n + chunk - 1) / chunk;
+    if (!pool || nchunks == 1) {
+        transform_vertices(mvp_, scale_, offset_, verts, n, &clip_[0], &screen_[0]);
+        return;
+    }
+    pool->parallel_for(nchunks, [&](int c, int) {
+        int begin = c * chunk;
+        int count = std::min(n, begin + chunk) - begin;
+        transform_vertices(mvp_, scale_, offset_, verts + begin, count, &clip_[begin], &screen_[begin]);
+    });
+}
+
+void VertexStage::process(const Vec3f* verts, int n, const unsigned char* mask) {
+    clip_.resize(n);
+    screen_.resize(n);
+    int i = 0;
+    while (i < n) {
+        while (i < n && !mask[i]) i++;
+        int begin = i;
+        while (i < n && mask[i]) i++;
+        if (i > begin) transform_vertices(mvp_, scale_, offset_, verts + begin, i - begin, &clip_[begin], &screen_[begin]);
+    }
+}
+
+int VertexStage::size() const {
+    return (int)clip_.size();
+}
+
+const Vec4f& VertexStage::clip(int i) const {
+    return clip_[i];
+}
+
+const Vec3f& VertexStage::screen(int i) const {
+    return screen_[i];
+}
+
+void transform_vertices(const float* mvp, const float* scale, const float* offset,
+                        const Vec3f* in, int n, Vec4f* clip, Vec3f* screen) {
+#if RASTER_SSE2
+    //一个顶点占一个寄存器的四个通道(x,y,z,w)，矩阵按列放在四个寄存器中
+    __m128 c0 = _mm_setr_ps(mvp[0], mvp[4], mvp[8], mvp[12]);
+    __m128 c1 = _mm_setr_ps(mvp[1], mvp[5], mvp[9], mvp[13]);
+    __m128 c2 = _mm_setr_ps(mvp[2], mvp[6], mvp[10], mvp[14]);
+    __m128 c3 = _mm_setr_ps(mvp[3], mvp[7], mvp[11], mvp[15]);
+    __m128 vs = _mm_loadu_ps(scale);
+    __m128 vo = _mm_loadu_ps(offset);
+    for (int i = 0; i < n; i++) {
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in[i].x)),
+                                                    _mm_mul_ps(c1, _mm_set1_ps(in[i].y))),
+                                         _mm_mul_ps(c2, _mm_set1_ps(in[i].z))),
+                              c3);
+        _mm_storeu_ps(&clip[i].x, r);
+        __m128 w = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128 s = _mm_add_ps(_mm_mul_ps(_mm_div_ps(r, w), vs), vo);
+        float tmp[4];
+        _mm_storeu_ps(tmp, s);
+        screen[i] = Vec3f(tmp[0], tmp[1], tmp[2]);
+    }
+#else
+    for (int i = 0; i < n; i++) {
+        float r[4];
+        for (int k = 0; k < 4; k++)
+            r[k] = mvp[k * 4] * in[i].x + mvp[k * 4 + 1] * in[i].y + mvp[k * 4 + 2] * in[i].z + mvp[k * 4 + 3];
+        clip[i] = Vec4f(r[0], r[1], r[2], r[3]);
+        screen[i] = Vec3f(r[0] / r[3] * scale[0] + offset[0], r[1] / r[3] * scale[1] + offset[1], r[2] / r[3] * scale[2] + offset[2]);
+    }
+#endif
+}
@@ -0,0 +1,75 @@
+#include <limits>
+#include <algorithm>
+
+#include "visbuffer.h"
+#include "rasterizer.h"
+
+VisibilityBuffer::VisibilityBuffer(int width, int height)
+    : width_(width), height_(height), depth_(width * height), triangle_(width * height), bary_(width * height),
+      depthPasses_(0) {
+    clear();
+}
+
+int VisibilityBuffer::width() const {
+    return width_;
+}
+
+int VisibilityBuffer::height() const {
+    return height_;
+}
+
+void VisibilityBuffer::clear() {
+    std::fill(depth_.begin(), depth_.end(), -std::numeric_limits<float>::max());
+    std::fill(triangle_.begin(), triangle_.end(), -1);
+    depthPasses_ = 0;
+}
+
+void VisibilityBuffer::rasterize(int id, const Vec3f* pts, const TileRect& clip, const Vec3f* bary, const float* w) {
+    EdgeSetup s;
+    if (!setup_triangle(pts, clip, s)) return;
+    PerspectiveSetup persp;
+    if (w) setup_perspective(s, w, persp);
+    long long passes = 0;
+    ::rasterize(s, [&](const RasterBlock& blk) {
+        float* zrow = &depth_[blk.x + blk.y * width_];
+        int mask = depth_test(blk, zrow);
+        if (!mask) return;
+        const float *bc0 = blk.bc0, *bc1 = blk.bc1, *bc2 = blk.bc2;
+        float pc[3][RASTER_BLOCK];
+        if (w) {
+            perspective_bary(persp, blk.x, blk.y, pc[0], pc[1], pc[2]);
+            bc0 = pc[0], bc1 = pc[1], bc2 = pc[2];
+        }
+        for (; mask; mask &= mask - 1) {
+            int i = raster_lowest_bit(mask);
+            int idx = blk.x + i + blk.y * width_;
+            Vec3f bc(bc0[i], bc1[i], bc2[i]);
+            if (bary) bc = bary[0] * bc.x + bary[1] * bc.y + bary[2] * bc.z;
+            zrow[i] = blk.z[i];
+            triangle_[idx] = id;
+            bary_[idx] = bc;
+            passes++;
+        }
+    });
+    if (passes) depthPasses_ += passes;
+}
+
+int VisibilityBuffer::triangle(int x, int y) const {
+    return triangle_[x + y * width_];
+}
+
+Vec3f VisibilityBuffer::bary(int x, int y) const {
+    return bary_[x + y * width_];
+}
+
+float VisibilityBuffer::depth(int x, int y) const {
+    return depth_[x + y * width_];
+}
+
+long long VisibilityBuffer::depth_passes() const {
+    return depthPasses_.load();
+}
+
+long long VisibilityBuffer::covered_pixels() const {
+    return std::count_if(triangle_.begin(), triangle_.end(), [](int id) { return id >= 0; });
+}